@@ -0,0 +1,222 @@
+/*
+ * archive.cpp -- a file holding many named scanners
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "archive.h"
+#include "align.h"
+#include "scanners/fixed.h"
+
+#include <string.h>
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#define PIRE_HAVE_CRC32_INSTRUCTION
+#include <nmmintrin.h>
+#endif
+
+namespace Pire {
+
+namespace Impl {
+
+namespace {
+	struct Crc32cTable {
+		ui32 Table[256];
+
+		Crc32cTable()
+		{
+			for (ui32 i = 0; i != 256; ++i) {
+				ui32 crc = i;
+				for (size_t bit = 0; bit != 8; ++bit)
+					crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+				Table[i] = crc;
+			}
+		}
+	};
+}
+
+ui32 Crc32c(const void* data, size_t size, ui32 crc)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+	crc = ~crc;
+#ifdef PIRE_HAVE_CRC32_INSTRUCTION
+	for (; p != end && !IsAligned(p, sizeof(ui64)); ++p)
+		crc = _mm_crc32_u8(crc, *p);
+	ui64 crc64 = crc;
+	for (; end - p >= (ptrdiff_t) sizeof(ui64); p += sizeof(ui64))
+		crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const ui64*>(p));
+	crc = static_cast<ui32>(crc64);
+	for (; p != end; ++p)
+		crc = _mm_crc32_u8(crc, *p);
+#else
+	static const Crc32cTable table;
+	for (; p != end; ++p)
+		crc = table.Table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+#endif
+	return ~crc;
+}
+
+}
+
+ArchiveWriter::ArchiveWriter(size_t alignment, bool checksums)
+	: m_alignment(alignment)
+	, m_checksums(checksums)
+{
+	if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(size_t))
+		throw Error("Pire::ArchiveWriter: alignment must be a power of two, at least a machine word");
+}
+
+void ArchiveWriter::AddData(const ystring& name, const void* data, size_t size)
+{
+	if (!m_entries.insert(ymake_pair(name, ystring(static_cast<const char*>(data), size))).second)
+		throw Error("Pire::ArchiveWriter: duplicate entry " + name);
+}
+
+void ArchiveWriter::Save(yostream* s) const
+{
+	Impl::ArchiveHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.EntriesCount = static_cast<ui32>(m_entries.size());
+	hdr.Flags = m_checksums ? Archive::Checksums : 0;
+	hdr.Alignment = m_alignment;
+
+	TVector<Impl::ArchiveEntry> entries;
+	ystring names;
+	for (auto&& i : m_entries) {
+		Impl::ArchiveEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.Size = i.second.size();
+		if (entry.Size >= sizeof(Pire::Header)) {
+			Pire::Header header(ScannerIOTypes::NoScanner, 0);
+			memcpy(&header, i.second.data(), sizeof(header));
+			entry.Type = header.Type;
+		}
+		if (m_checksums)
+			entry.Checksum = Impl::Crc32c(i.second.data(), i.second.size());
+		entry.NameOffset = static_cast<ui32>(names.size());
+		entry.NameLength = static_cast<ui32>(i.first.size());
+		names += i.first;
+		entries.push_back(entry);
+	}
+	hdr.NamesSize = names.size();
+
+	// Place objects after the directory
+	const size_t directoryEnd = Impl::AlignUp(sizeof(Pire::Header), sizeof(size_t)) + sizeof(hdr)
+		+ entries.size() * sizeof(Impl::ArchiveEntry) + names.size();
+	size_t offset = directoryEnd;
+	for (auto&& entry : entries) {
+		entry.Offset = Impl::AlignUp(offset, m_alignment);
+		offset = entry.Offset + entry.Size;
+	}
+
+	SavePodType(s, Pire::Header(ScannerIOTypes::Archive, sizeof(hdr)));
+	Impl::AlignSave(s, sizeof(Pire::Header));
+	SavePodType(s, hdr);
+	if (!entries.empty())
+		SavePodArray(s, entries.data(), entries.size());
+	SavePodArray(s, names.data(), names.size());
+
+	TVector<char> zeros(m_alignment);
+	offset = directoryEnd;
+	auto data = m_entries.begin();
+	for (auto&& entry : entries) {
+		SavePodArray(s, zeros.data(), entry.Offset - offset);
+		SavePodArray(s, data->second.data(), entry.Size);
+		offset = entry.Offset + entry.Size;
+		++data;
+	}
+	Impl::AlignSave(s, offset);
+}
+
+Archive::Archive(const void* ptr, size_t size)
+{
+	Impl::CheckAlign(ptr, sizeof(size_t));
+	m_begin = static_cast<const char*>(ptr);
+	const size_t total = size;
+	const size_t* p = static_cast<const size_t*>(ptr);
+	Impl::ValidateHeader(p, size, ScannerIOTypes::Archive, sizeof(Impl::ArchiveHeader));
+	Impl::MapPtr(m_header, 1, p, size);
+	Impl::MapPtr(m_entries, m_header->EntriesCount, p, size);
+	if (size < m_header->NamesSize)
+		throw Error("EOF reached while mapping Pire::Archive");
+	m_names = reinterpret_cast<const char*>(p);
+
+	for (size_t i = 0; i != Size(); ++i) {
+		const Impl::ArchiveEntry& entry = m_entries[i];
+		if (entry.NameOffset > m_header->NamesSize || entry.NameLength > m_header->NamesSize - entry.NameOffset)
+			throw Error("Pire::Archive: corrupted directory");
+		if (entry.Offset > total || entry.Size > total - entry.Offset || !Impl::IsAligned(entry.Offset, sizeof(size_t)))
+			throw Error("Pire::Archive: corrupted directory");
+		if (i && !(Name(i - 1) < Name(i)))
+			throw Error("Pire::Archive: corrupted directory");
+	}
+}
+
+ystring Archive::Name(size_t i) const
+{
+	return ystring(m_names + m_entries[i].NameOffset, m_entries[i].NameLength);
+}
+
+const Impl::ArchiveEntry* Archive::Find(const ystring& name) const
+{
+	size_t lo = 0, hi = Size();
+	while (lo != hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		ystring midName = Name(mid);
+		if (midName == name)
+			return m_entries + mid;
+		else if (midName < name)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+ypair<const void*, size_t> Archive::Get(const ystring& name, bool verify) const
+{
+	const Impl::ArchiveEntry* entry = Find(name);
+	if (!entry)
+		throw Error("Pire::Archive: no entry " + name);
+	const char* data = m_begin + entry->Offset;
+	if (verify && HasChecksums() && Impl::Crc32c(data, entry->Size) != entry->Checksum)
+		throw Error("Pire::Archive: checksum mismatch in " + name);
+	return ymake_pair(static_cast<const void*>(data), entry->Size);
+}
+
+MappedArchive::MappedArchive(const char* filename)
+	: m_addr(Impl::MapFile(filename, m_size))
+{
+	try {
+		static_cast<Archive&>(*this) = Archive(m_addr, m_size);
+	}
+	catch (...) {
+		Impl::UnmapFile(m_addr, m_size);
+		throw;
+	}
+}
+
+MappedArchive::~MappedArchive()
+{
+	Impl::UnmapFile(m_addr, m_size);
+}
+
+}
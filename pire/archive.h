@@ -0,0 +1,159 @@
+/*
+ * archive.h -- a file holding many named scanners
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_ARCHIVE_H
+#define PIRE_ARCHIVE_H
+
+#include "stub/stl.h"
+#include "stub/defaults.h"
+#include "stub/saveload.h"
+#include "stub/memstreams.h"
+#include "stub/noncopyable.h"
+#include "scanners/common.h"
+
+namespace Pire {
+
+namespace Impl {
+	/// CRC32C (Castagnoli) of the memory range, continuing the given checksum.
+	/// Uses the crc32 instruction if built with SSE4.2 for x86_64.
+	ui32 Crc32c(const void* data, size_t size, ui32 crc = 0);
+
+	struct ArchiveHeader {
+		ui32 EntriesCount;
+		ui32 Flags;
+		size_t Alignment;
+		size_t NamesSize;
+	};
+
+	/// A directory entry. Entries are sorted by their names.
+	struct ArchiveEntry {
+		size_t Offset;   ///< From the beginning of the archive, a multiple of the alignment
+		size_t Size;
+		ui32 Type;       ///< ScannerIOTypes value of the stored object
+		ui32 Checksum;   ///< CRC32C of the stored object, if the archive has checksums
+		ui32 NameOffset; ///< In the names block
+		ui32 NameLength;
+	};
+}
+
+/**
+ * Collects serialized scanners (or any other objects having Save())
+ * under distinct names and saves them in a single archive.
+ *
+ * Each object starts at a multiple of the alignment (a page by default),
+ * so that mapping one of them does not bring its neighbours into memory.
+ */
+class ArchiveWriter {
+public:
+	static const size_t DefaultAlignment = 4096;
+
+	explicit ArchiveWriter(size_t alignment = DefaultAlignment, bool checksums = true);
+
+	template<class Scanner>
+	void Add(const ystring& name, const Scanner& scanner)
+	{
+		BufferOutput buf;
+		Pire::Save(&buf, scanner);
+		AddData(name, buf.Buffer().Data(), buf.Buffer().Size());
+	}
+
+	/// Adds an already serialized object
+	void AddData(const ystring& name, const void* data, size_t size);
+
+	void Save(yostream* s) const;
+
+private:
+	size_t m_alignment;
+	bool m_checksums;
+	TMap<ystring, ystring> m_entries;
+};
+
+/**
+ * A read-only view of an archive saved by ArchiveWriter.
+ *
+ * Only the header and the directory are checked on construction;
+ * objects themselves are neither read nor verified until requested,
+ * so a mmap()-ed archive only costs the pages actually used.
+ */
+class Archive {
+public:
+	Archive(): m_begin(0), m_header(0), m_entries(0), m_names(0) {}
+	Archive(const void* ptr, size_t size);
+
+	size_t Size() const { return m_header ? m_header->EntriesCount : 0; }
+	bool HasChecksums() const { return m_header && (m_header->Flags & Checksums); }
+
+	/// Names of entries in sorted order
+	ystring Name(size_t i) const;
+	ui32 Type(size_t i) const { return m_entries[i].Type; }
+
+	bool Has(const ystring& name) const { return Find(name) != 0; }
+
+	/// Returns the serialized object, verifying its checksum if asked to
+	/// (verification is a no-op for archives saved without checksums)
+	ypair<const void*, size_t> Get(const ystring& name, bool verify = false) const;
+
+	/// Mmap()-s the scanner stored under the name
+	template<class Scanner>
+	void Mmap(const ystring& name, Scanner& scanner, bool verify = false) const
+	{
+		ypair<const void*, size_t> entry = Get(name, verify);
+		scanner.Mmap(entry.first, entry.second);
+	}
+
+	/// Loads the scanner stored under the name (for scanners which cannot be mmap()-ed)
+	template<class Scanner>
+	void Load(const ystring& name, Scanner& scanner, bool verify = false) const
+	{
+		ypair<const void*, size_t> entry = Get(name, verify);
+		MemoryInput input(static_cast<const char*>(entry.first), entry.second);
+		Pire::Load(&input, scanner);
+	}
+
+private:
+	enum { Checksums = 1 };
+
+	const Impl::ArchiveEntry* Find(const ystring& name) const;
+
+	const char* m_begin;
+	const Impl::ArchiveHeader* m_header;
+	const Impl::ArchiveEntry* m_entries;
+	const char* m_names;
+
+	friend class ArchiveWriter;
+};
+
+/// An archive mapped from a file for the lifetime of the object
+class MappedArchive: public Archive, public NonCopyable {
+public:
+	explicit MappedArchive(const char* filename);
+	~MappedArchive();
+
+private:
+	const void* m_addr;
+	size_t m_size;
+};
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * compile_service.cpp -- the thread pool compiling patterns
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+
+#include "compile_service.h"
+
+namespace Pire {
+namespace Impl {
+
+ThreadPool::ThreadPool(size_t threads)
+	: m_stopping(false)
+{
+	for (size_t i = 0; i != threads; ++i)
+		m_threads.push_back(std::thread([this] { Work(); }));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_wakeup.notify_all();
+	for (auto&& thread : m_threads)
+		thread.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_tasks.push_back(std::move(task));
+	}
+	m_wakeup.notify_one();
+}
+
+void ThreadPool::Work()
+{
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wakeup.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+			// Tasks may submit further ones, so stop only once there are none left
+			if (m_tasks.empty())
+				return;
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+}
+
+CompileService::CompileService(size_t threads)
+	: m_pool(threads ? threads : ymax<size_t>(std::thread::hardware_concurrency(), 1))
+{
+}
+
+}
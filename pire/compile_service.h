@@ -0,0 +1,460 @@
+/*
+ * compile_service.h -- compiling large sets of patterns on several threads
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_COMPILE_SERVICE_H
+#define PIRE_COMPILE_SERVICE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "fsm.h"
+#include "literals.h"
+#include "re_lexer.h"
+#include "stub/stl.h"
+#include "stub/defaults.h"
+#include "stub/noncopyable.h"
+
+namespace Pire {
+
+namespace Impl {
+
+	/// A fixed set of threads running submitted tasks in order of submission
+	class ThreadPool: public NonCopyable {
+	public:
+		explicit ThreadPool(size_t threads);
+
+		/// Runs all the tasks submitted so far and stops the threads
+		~ThreadPool();
+
+		void Submit(std::function<void()> task);
+
+		size_t ThreadsCount() const { return m_threads.size(); }
+
+	private:
+		void Work();
+
+		std::mutex m_lock;
+		std::condition_variable m_wakeup;
+		std::deque< std::function<void()> > m_tasks;
+		bool m_stopping;
+		TVector<std::thread> m_threads;
+	};
+
+	template<class Scanner> class CompileState;
+
+	/// The scanner a CompileJob<Result> glues
+	template<class Result> struct GluedScanner { typedef Result Type; };
+	template<class Scanner> struct GluedScanner< HybridScanner<Scanner> > { typedef Scanner Type; };
+}
+
+/// Settings of a CompileService::Compile() call
+struct CompileOptions {
+	/// Turns a pattern into an automaton. By default the pattern is parsed
+	/// by a Lexer; set this to use another encoding, features or literals.
+	std::function<Fsm(const ystring&)> Parse;
+
+	/// Whether each automaton should be Surround()-ed before compilation
+	bool Surround;
+
+	/// The limit passed to Scanner::Glue() (0 for its default)
+	size_t MaxSize;
+
+	/// Called with the number of steps done and the total number of steps
+	/// after each pattern is compiled and each pair of scanners is glued
+	std::function<void(size_t done, size_t total)> Progress;
+
+	/// Called after each step with the size of the tables of all the scanners
+	/// built but not glued yet. Returning false cancels the compilation.
+	/// Callbacks are called one at a time, in a pool thread, and may use the job
+	/// (e.g. Cancel() it), but the last Progress() call precedes its completion.
+	std::function<bool(size_t bytes)> Memory;
+
+	/// Tells which patterns CompileService::CompileHybrid() should look up
+	/// in a hash table. By default these are AnchoredLiteral() ones unless
+	/// Parse is set, and none otherwise.
+	LiteralSet::Recognizer Literal;
+
+	CompileOptions(): Surround(false), MaxSize(0) {}
+};
+
+/**
+ * The result of a compilation running in the background.
+ * Copies refer to the same compilation.
+ */
+template<class Result>
+class CompileJob {
+private:
+	typedef typename Impl::GluedScanner<Result>::Type Glued;
+
+public:
+	/// Whether the compilation has finished, successfully or not
+	bool Ready() const { return m_state->Ready(); }
+
+	void Wait() const { m_state->Wait(); }
+
+	/// Waits no longer than the given time, returning whether the compilation has finished
+	template<class Rep, class Period>
+	bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) const { return m_state->WaitFor(timeout); }
+
+	/**
+	 * Waits for the compilation and returns the glued scanner.
+	 * Rethrows the exception the parser has thrown, or throws an Error
+	 * if some of the scanners could not be glued within the size limit
+	 * or the compilation was cancelled.
+	 */
+	Result Get() const { return m_finish(m_state->Get()); }
+
+	/// Stops the compilation. The steps already running are completed
+	/// in the background, but their results are thrown away.
+	void Cancel() { m_state->Fail(std::make_exception_ptr(Error("Pire::CompileJob: cancelled"))); }
+
+	size_t StepsDone() const { return m_state->StepsDone(); }
+	size_t StepsTotal() const { return m_state->StepsTotal(); }
+
+private:
+	CompileJob(const std::shared_ptr< Impl::CompileState<Glued> >& state, const std::function<Result(const Glued&)>& finish)
+		: m_state(state)
+		, m_finish(finish)
+	{
+	}
+
+	std::shared_ptr< Impl::CompileState<Glued> > m_state;
+	std::function<Result(const Glued&)> m_finish;
+
+	friend class CompileService;
+};
+
+/**
+ * Builds a multiregexp scanner out of many patterns on a pool of threads.
+ *
+ * Compiling and gluing scanners one after another takes time proportional
+ * to the number of patterns. Here all the patterns are parsed and compiled
+ * independently; the scanners are then glued pairwise in a balanced tree,
+ * each pair as soon as both of its halves are ready. Neighbours are always
+ * glued in the original order, so the resulting scanner numbers
+ * the regexps exactly as a serial chain of Glue() calls would.
+ *
+ * The Scanner should support Glue(), e.g. Scanner, NonrelocScanner and their
+ * variants. One service can run any number of compilations at once; the
+ * destructor waits for all of them to finish (Cancel() them to make it quick).
+ */
+class CompileService: public NonCopyable {
+public:
+	/// Zero stands for the number of processors
+	explicit CompileService(size_t threads = 0);
+
+	size_t ThreadsCount() const { return m_pool.ThreadsCount(); }
+
+	template<class Scanner>
+	CompileJob<Scanner> Compile(const TVector<ystring>& patterns, const CompileOptions& options = CompileOptions());
+
+	/**
+	 * Like Compile(), but puts literal patterns into a LiteralSet, so that
+	 * only the other ones are compiled and glued. The resulting HybridScanner
+	 * numbers the patterns exactly as the scanner Compile() builds would.
+	 */
+	template<class Scanner>
+	CompileJob< HybridScanner<Scanner> > CompileHybrid(const TVector<ystring>& patterns, const CompileOptions& options = CompileOptions());
+
+private:
+	Impl::ThreadPool m_pool;
+};
+
+namespace Impl {
+
+	/// Patterns, the reduction tree and the result of a single compilation
+	template<class Scanner>
+	class CompileState: public std::enable_shared_from_this< CompileState<Scanner> > {
+	public:
+		CompileState(ThreadPool& pool, const TVector<ystring>& patterns, const CompileOptions& options)
+			: m_pool(pool)
+			, m_patterns(patterns)
+			, m_options(options)
+			, m_cancelled(false)
+			, m_ready(false)
+			, m_done(0)
+			, m_reported(0)
+			, m_total(patterns.empty() ? 0 : 2 * patterns.size() - 1)
+			, m_bytes(0)
+		{
+			if (!m_options.Parse)
+				m_options.Parse = [](const ystring& pattern) { return Lexer(pattern).Parse(); };
+			m_leaves.resize(patterns.size());
+			if (!patterns.empty())
+				BuildTree(0, patterns.size(), NoNode, 0);
+		}
+
+		/// Submits compilation of every pattern to the pool
+		void Start()
+		{
+			if (m_patterns.empty()) {
+				std::lock_guard<std::mutex> lock(m_lock);
+				Finish(Scanner());
+				return;
+			}
+			auto self = this->shared_from_this();
+			for (size_t i = 0; i != m_patterns.size(); ++i)
+				m_pool.Submit([self, i] { self->Run([&] { self->CompileLeaf(i); }); });
+		}
+
+		bool Ready() const
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			return m_ready;
+		}
+
+		void Wait() const
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_finished.wait(lock, [this] { return m_ready; });
+		}
+
+		template<class Rep, class Period>
+		bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) const
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			return m_finished.wait_for(lock, timeout, [this] { return m_ready; });
+		}
+
+		Scanner Get() const
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_finished.wait(lock, [this] { return m_ready; });
+			if (m_error)
+				std::rethrow_exception(m_error);
+			return m_result;
+		}
+
+		void Fail(std::exception_ptr error)
+		{
+			m_cancelled.store(true, std::memory_order_relaxed);
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_ready)
+				return;
+			m_error = error;
+			m_ready = true;
+			ReleaseParts();
+			m_finished.notify_all();
+		}
+
+		size_t StepsDone() const
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			return m_done;
+		}
+
+		size_t StepsTotal() const { return m_total; }
+
+	private:
+		static const size_t NoNode = static_cast<size_t>(-1);
+
+		/// Glues the scanners for two adjacent ranges of patterns
+		struct Node {
+			size_t begin, end;
+			size_t parent;
+			size_t side; ///< Which of the parent's parts this node fills
+			Scanner parts[2];
+			size_t pending;
+		};
+
+		/// Where the scanner for a single pattern goes
+		struct Leaf {
+			size_t parent;
+			size_t side;
+		};
+
+		void BuildTree(size_t begin, size_t end, size_t parent, size_t side)
+		{
+			if (end - begin == 1) {
+				m_leaves[begin].parent = parent;
+				m_leaves[begin].side = side;
+				return;
+			}
+			size_t index = m_nodes.size();
+			Node node;
+			node.begin = begin;
+			node.end = end;
+			node.parent = parent;
+			node.side = side;
+			node.pending = 2;
+			m_nodes.push_back(node);
+			size_t mid = begin + (end - begin) / 2;
+			BuildTree(begin, mid, index, 0);
+			BuildTree(mid, end, index, 1);
+		}
+
+		/// Runs a step unless the compilation is over, turning exceptions into its result
+		template<class Step>
+		void Run(Step step)
+		{
+			if (m_cancelled.load(std::memory_order_relaxed))
+				return;
+			try {
+				step();
+			} catch (...) {
+				Fail(std::current_exception());
+			}
+		}
+
+		void CompileLeaf(size_t i)
+		{
+			Fsm fsm = m_options.Parse(m_patterns[i]);
+			if (m_options.Surround)
+				fsm.Surround();
+			Deliver(m_leaves[i].parent, m_leaves[i].side, fsm.Compile<Scanner>());
+		}
+
+		void GlueNode(size_t n)
+		{
+			Scanner lhs, rhs;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				if (m_ready)
+					return;
+				lhs = m_nodes[n].parts[0];
+				rhs = m_nodes[n].parts[1];
+			}
+			Scanner glued = Scanner::Glue(lhs, rhs, m_options.MaxSize);
+			if (glued.Empty() && !lhs.Empty() && !rhs.Empty())
+				throw Error("Pire::CompileService: patterns " + ToString(m_nodes[n].begin) + ".." + ToString(m_nodes[n].end - 1) + " do not fit into a single scanner");
+			Deliver(m_nodes[n].parent, m_nodes[n].side, glued, n);
+		}
+
+		/// Stores a step's result in the parent node, scheduling the glue once both parts are there
+		void Deliver(size_t parent, size_t side, const Scanner& scanner, size_t glued = NoNode)
+		{
+			bool complete = false;
+			size_t done = 0, bytes = 0;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				if (m_ready)
+					return;
+				if (glued != NoNode) {
+					for (size_t i = 0; i != 2; ++i) {
+						m_bytes -= m_nodes[glued].parts[i].BufSize();
+						m_nodes[glued].parts[i] = Scanner();
+					}
+				}
+				done = ++m_done;
+				if (parent != NoNode) {
+					m_nodes[parent].parts[side] = scanner;
+					m_bytes += scanner.BufSize();
+					bytes = m_bytes;
+					complete = (--m_nodes[parent].pending == 0);
+				}
+			}
+
+			// Callbacks are called outside of m_lock, so that they may use the job
+			if (!Report(done, parent != NoNode ? &bytes : 0))
+				throw Error("Pire::CompileJob: cancelled by the memory callback");
+
+			if (parent == NoNode) {
+				std::lock_guard<std::mutex> lock(m_lock);
+				if (!m_ready)
+					Finish(scanner);
+			} else if (complete) {
+				auto self = this->shared_from_this();
+				m_pool.Submit([self, parent] { self->Run([&] { self->GlueNode(parent); }); });
+			}
+		}
+
+		/// Calls the callbacks one at a time. Progress is reported for every step
+		/// in order, even if steps are delivered out of it.
+		bool Report(size_t done, const size_t* bytes)
+		{
+			std::lock_guard<std::mutex> lock(m_callbackLock);
+			while (m_reported < done) {
+				++m_reported;
+				if (m_options.Progress)
+					m_options.Progress(m_reported, m_total);
+			}
+			return !bytes || !m_options.Memory || m_options.Memory(*bytes);
+		}
+
+		/// Must be called under the lock
+		void Finish(const Scanner& scanner)
+		{
+			m_result = scanner;
+			m_ready = true;
+			m_finished.notify_all();
+		}
+
+		/// Drops the intermediate scanners of a failed compilation; must be called under the lock
+		void ReleaseParts()
+		{
+			for (auto&& node : m_nodes)
+				node.parts[0] = node.parts[1] = Scanner();
+			m_bytes = 0;
+		}
+
+		ThreadPool& m_pool;
+		TVector<ystring> m_patterns;
+		CompileOptions m_options;
+		TVector<Node> m_nodes;
+		TVector<Leaf> m_leaves;
+
+		std::atomic<bool> m_cancelled;
+		mutable std::mutex m_lock;
+		mutable std::condition_variable m_finished;
+		bool m_ready;
+		Scanner m_result;
+		std::exception_ptr m_error;
+		size_t m_done;
+		std::mutex m_callbackLock;
+		size_t m_reported; ///< Guarded by m_callbackLock
+		const size_t m_total;
+		size_t m_bytes;
+	};
+}
+
+template<class Scanner>
+inline CompileJob<Scanner> CompileService::Compile(const TVector<ystring>& patterns, const CompileOptions& options)
+{
+	std::shared_ptr< Impl::CompileState<Scanner> > state(new Impl::CompileState<Scanner>(m_pool, patterns, options));
+	state->Start();
+	return CompileJob<Scanner>(state, [](const Scanner& scanner) { return scanner; });
+}
+
+template<class Scanner>
+inline CompileJob< HybridScanner<Scanner> > CompileService::CompileHybrid(const TVector<ystring>& patterns, const CompileOptions& options)
+{
+	LiteralSet::Recognizer recognize = options.Literal;
+	if (!recognize && !options.Parse)
+		recognize = &AnchoredLiteral;
+	TVector<ystring> regexps;
+	std::shared_ptr<const LiteralSet> literals(new LiteralSet(patterns, regexps, recognize));
+
+	std::shared_ptr< Impl::CompileState<Scanner> > state(new Impl::CompileState<Scanner>(m_pool, regexps, options));
+	state->Start();
+	return CompileJob< HybridScanner<Scanner> >(state, [literals](const Scanner& scanner) { return HybridScanner<Scanner>(literals, scanner); });
+}
+
+}
+
+#endif
@@ -105,6 +105,16 @@ namespace Pire {
 #	endif
 #endif
 
+#ifndef PIRE_PAGE_ALIGNED_DECL
+#	if defined(PIRE_HAVE_ALIGNAS)
+#		define PIRE_PAGE_ALIGNED_DECL(x) alignas(4096) static const char x[]
+#	elif defined(PIRE_HAVE_ATTR_ALIGNED)
+#		define PIRE_PAGE_ALIGNED_DECL(x) static const char x[] __attribute__((aligned(4096)))
+#	elif defined(PIRE_HAVE_DECLSPEC_ALIGN)
+#		define PIRE_PAGE_ALIGNED_DECL(x) __declspec(align(4096)) static const char x[]
+#	endif
+#endif
+
 #ifndef PIRE_LITERAL
 #	if defined(PIRE_HAVE_LAMBDAS)
 #		define PIRE_LITERAL(data) ([]() -> const char* { PIRE_ALIGNED_DECL(__pire_regexp__) = data; return __pire_regexp__; })()
@@ -113,4 +123,14 @@ namespace Pire {
 #	endif
 #endif
 
+/// The same as PIRE_LITERAL, but starts the data at a page boundary
+/// (used by pire_inline for bundles of regexps)
+#ifndef PIRE_PAGE_LITERAL
+#	if defined(PIRE_HAVE_LAMBDAS)
+#		define PIRE_PAGE_LITERAL(data) ([]() -> const char* { PIRE_PAGE_ALIGNED_DECL(__pire_bundle__) = data; return __pire_bundle__; })()
+#	elif defined(PIRE_HAVE_SCOPED_EXPR)
+#		define PIRE_PAGE_LITERAL(data) ({ PIRE_PAGE_ALIGNED_DECL(__pire_bundle__) = data; __pire_bundle__; })
+#	endif
+#endif
+
 #endif
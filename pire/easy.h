@@ -53,6 +53,7 @@
 #include "vbitset.h"
 #include "stub/stl.h"
 #include <iterator>
+#include <memory>
 
 namespace Pire {
 	
@@ -150,14 +151,16 @@ public:
 	}
 	
 	explicit Regexp(Scanner sc): m_scanner(sc) {}
-	explicit Regexp(SlowScanner ssc): m_slow(ssc) {}
+	explicit Regexp(SlowScanner ssc): m_slow(new SlowScanner(ssc)) {}
 	
 	bool Matches(const char* begin, const char* end) const
 	{
 		if (!m_scanner.Empty())
 			return Runner(m_scanner).Begin().Run(begin, end).End();
+		else if (m_slow)
+			return Runner(*m_slow).Begin().Run(begin, end).End();
 		else
-			return Runner(m_slow).Begin().Run(begin, end).End();
+			return false;
 	}
 	
 	bool Matches(const char* str) const { return Matches(str, str + strlen(str)); }
@@ -181,8 +184,9 @@ public:
 	MatchProxy operator ~() const { return MatchProxy(*this); }
 		
 private:
+	// Copies of a regexp share both scanners
 	Scanner m_scanner;
-	SlowScanner m_slow;
+	std::shared_ptr<const SlowScanner> m_slow;
 	
 	ypair<const char*, const char*> PatternBounds(const ystring& pattern)
 	{
@@ -211,7 +215,7 @@ private:
 		if (fsm.Determine())
 			m_scanner = fsm.Compile<Scanner>();
 		else
-			m_slow = fsm.Compile<SlowScanner>();
+			m_slow.reset(new SlowScanner(fsm.Compile<SlowScanner>()));
 	}
 	
 	static bool BeginsWithCircumflex(const Fsm& fsm)
@@ -28,6 +28,7 @@
 
 #include "extra/capture.h"
 #include "extra/count.h"
+#include "extra/count_batch.h"
 #include "extra/glyphs.h"
 
 #endif
@@ -137,6 +137,14 @@ public:
 
 	CapturingScanner() {}
 	CapturingScanner(const CapturingScanner& s): LoadedScanner(s) {}
+
+	/// Returns a copy having its own tables (ordinary copies share them)
+	CapturingScanner Clone() const
+	{
+		CapturingScanner s(*this);
+		s.Detach();
+		return s;
+	}
 	explicit CapturingScanner(Fsm& fsm, size_t distance = 0)
 	{
 		if (distance) {
@@ -152,6 +160,30 @@ public:
 
 	size_t StateIndex(const State& s) const { return StateIdx(s.m_state); }
 
+	/// Saves the state along with the capture found so far in a position-independent
+	/// form, which can be restored with LoadState() of any copy of the scanner.
+	void SaveState(yostream* s, const State& state) const
+	{
+		Impl::SaveStateHeader(s, StateIOTypes::CapturingScanner, Size());
+		SavePodType(s, StateIdx(state.m_state));
+		SavePodType(s, state.m_begin);
+		SavePodType(s, state.m_end);
+		SavePodType(s, state.m_counter);
+	}
+
+	void LoadState(yistream* s, State& state) const
+	{
+		Impl::ValidateStateHeader(s, StateIOTypes::CapturingScanner, Size());
+		State st;
+		st.m_state = IndexToState(Impl::LoadStateIndex(s, Size()));
+		LoadPodType(s, st.m_begin);
+		LoadPodType(s, st.m_end);
+		LoadPodType(s, st.m_counter);
+		if (!*s)
+			throw Error("Serialized state does not belong to this scanner");
+		state = st;
+	}
+
 private:
 
 	friend void BuildScanner<CapturingScanner>(const Fsm&, CapturingScanner&);
@@ -179,7 +211,7 @@ public:
 		FinalFlag = 1,
 	};
 
-	const ui32 ActionsCapture = BeginCapture | EndCapture;
+	static const ui32 ActionsCapture = BeginCapture | EndCapture;
 
 	class SingleState {
 	public:
@@ -249,11 +281,22 @@ public:
 		static const size_t m_npos = static_cast<size_t>(-1);
 	};
 
+	/**
+	 * The list of NFA states (in priority order) the scanner is in.
+	 *
+	 * Besides the list itself, the state carries all the scratch space needed
+	 * to make a step: the next list (the two are swapped after each step),
+	 * a sparse set of states already visited during the step and a pool of
+	 * list nodes used to order the visited states by their priorities.
+	 * Everything is sized from the scanner in Initialize(), so Next()
+	 * does not touch the heap.
+	 */
 	class State {
 	public:
 		State()
 			: m_strpos(0)
-			, m_matched(false) {}
+			, m_matched(false)
+			, m_usedCount(0) {}
 
 		size_t GetPos() const
 		{
@@ -311,6 +354,32 @@ public:
 		size_t m_strpos;
 		bool m_matched;
 		SingleState m_match;
+
+		TVector<SingleState> m_next;
+
+		// Sparse set of NFA states visited during current step;
+		// the index of a state in m_dense is also its node index in m_nodes.
+		TVector<size_t> m_sparse;
+		TVector<size_t> m_dense;
+		size_t m_usedCount;
+
+		TVector<SingleState> m_nodes;
+		TVector<size_t> m_links;
+
+		bool Used(size_t st) const
+		{
+			size_t idx = m_sparse[st];
+			return idx < m_usedCount && m_dense[idx] == st;
+		}
+
+		size_t Use(size_t st)
+		{
+			m_sparse[st] = m_usedCount;
+			m_dense[m_usedCount] = st;
+			return m_usedCount++;
+		}
+
+		friend class SlowCapturingScanner;
 	};
 
 	class Transition {
@@ -336,41 +405,27 @@ public:
 		}
 	};
 
+	/// Three lists of state nodes (one per repetition type), chained through State::m_links
 	class PriorityStates {
-	private:
-		TVector<SingleState> m_nonGreedy;
-		TVector<SingleState> m_nothing;
-		TVector<SingleState> m_greedy;
-
 	public:
-		void Push(const SingleState& st, RepetitionTypes repetition)
-		{
-			Get(repetition).push_back(st);
-		}
+		struct Chain {
+			size_t head;
+			size_t tail;
+		};
 
-		TVector<SingleState>& Get(RepetitionTypes repetition)
-		{
-			switch (repetition) {
-				case NonGreedyRepetition:
-					return m_nonGreedy;
-				case NoRepetition:
-					return m_nothing;
-				case GreedyRepetition:
-					return m_greedy;
-			}
-		}
+		static const size_t Npos = static_cast<size_t>(-1);
 
-		const TVector<SingleState>& Get(RepetitionTypes repetition) const
+		PriorityStates()
 		{
-			switch (repetition) {
-				case NonGreedyRepetition:
-					return m_nonGreedy;
-				case NoRepetition:
-					return m_nothing;
-				case GreedyRepetition:
-					return m_greedy;
-			}
+			for (auto& chain : m_chains)
+				chain.head = chain.tail = Npos;
 		}
+
+		Chain& Get(RepetitionTypes repetition) { return m_chains[repetition]; }
+		const Chain& Get(RepetitionTypes repetition) const { return m_chains[repetition]; }
+
+	private:
+		Chain m_chains[GreedyRepetition + 1];
 	};
 
 	SlowScanner::State GetNextStates(const SingleState& cur, Char letter) const
@@ -387,44 +442,47 @@ public:
 		return state.GetNum() * GetLettersCount() + letter;
 	}
 
-	void NextStates(const SingleState& state, Char letter, TVector<Transition>& nextStates) const
+	/// Returns the number of transitions from @p state by @p letter,
+	/// pointing @p jumps and @p actions at their destinations and actions
+	size_t Transitions(const SingleState& state, Char letter, const unsigned*& jumps, const Action*& actions) const
 	{
 		if (IsMmaped()) {
 			const size_t* pos = GetJumpPos() + GetPosition(state, letter);
-			size_t posBegin = pos[0];
-			size_t posEnd = pos[1];
-			for (size_t i = posBegin; i < posEnd; ++i)
-				nextStates.emplace_back(GetJump(i), GetAction(i));
+			jumps = GetJumps() + pos[0];
+			actions = GetActions() + pos[0];
+			return pos[1] - pos[0];
 		} else {
 			size_t num = GetPosition(state, letter);
 			const auto& jumpVec = GetJumpsVec(num);
-			const auto& actionVec = GetActionsVec(num);
-			for (size_t i = 0; i < jumpVec.size(); ++i)
-				nextStates.emplace_back(jumpVec[i], actionVec[i]);
+			jumps = jumpVec.data();
+			actions = GetActionsVec(num).data();
+			return jumpVec.size();
 		}
 	}
 
-	void InsertStates(const PriorityStates& states, TVector<SingleState>& nonGreedy, TVector<SingleState>& nothing, TVector<SingleState>& greedy) const
+	void NextStates(const SingleState& state, Char letter, TVector<Transition>& nextStates) const
 	{
-		for (auto& greed : {ymake_pair(&nonGreedy, NonGreedyRepetition), ymake_pair(&nothing, NoRepetition), ymake_pair(&greedy, GreedyRepetition)}) {
-			auto& vec = greed.first;
-			auto& tag = greed.second;
-			vec->insert(vec->end(), states.Get(tag).begin(), states.Get(tag).end());
-		}
+		const unsigned* jumps;
+		const Action* actions;
+		size_t count = Transitions(state, letter, jumps, actions);
+		for (size_t i = 0; i < count; ++i)
+			nextStates.emplace_back(jumps[i], actions[i]);
 	}
 
-	void NextAndGetToGroups(PriorityStates& states, const SingleState& cur,
-							Char letter, size_t pos, TVector<bool>& used) const
+	void NextAndGetToGroups(State& s, PriorityStates& states, const SingleState& cur, Char letter, size_t pos) const
 	{
-		TVector<Transition> nextStates;
-		NextStates(cur, letter, nextStates);
-		for (const auto& trans : nextStates) {
-			size_t st = trans.GetState();
-			if (used[st])
+		const unsigned* jumps;
+		const Action* actions;
+		size_t count = Transitions(cur, letter, jumps, actions);
+		for (size_t i = 0; i < count; ++i) {
+			size_t st = jumps[i];
+			if (s.Used(st))
 				continue;
-			used[st] = true;
-			SingleState state(st);
-			const auto& action = trans.GetAction();
+			size_t node = s.Use(st);
+			SingleState& state = s.m_nodes[node];
+			state = SingleState(st);
+			s.m_links[node] = PriorityStates::Npos;
+			const auto& action = actions[i];
 			state.SetBegin(cur.GetBegin());
 			state.SetEnd(cur.GetEnd());
 			if (action & BeginCapture && !cur.HasBegin()) {
@@ -434,18 +492,14 @@ public:
 				state.SetEnd(pos);
 			}
 			PriorityStates statesInside;
-			NextAndGetToGroups(statesInside, state, Translate(Epsilon), pos, used);
-			statesInside.Push(state, NoRepetition);
-			if (action & EndNonGreedyRepetition) {
-				auto& nongreedy = states.Get(NonGreedyRepetition);
-				InsertStates(statesInside, nongreedy, nongreedy, nongreedy);
-			}
+			NextAndGetToGroups(s, statesInside, state, Translate(Epsilon), pos);
+			Append(s, statesInside.Get(NoRepetition), PriorityStates::Chain{node, node});
+			if (action & EndNonGreedyRepetition)
+				InsertStates(s, statesInside, NonGreedyRepetition, NonGreedyRepetition, NonGreedyRepetition, states);
 			else if (!(action & EndRepetition))
-				InsertStates(statesInside, states.Get(NonGreedyRepetition), states.Get(NoRepetition), states.Get(GreedyRepetition));
-			else {
-				auto& greedy = states.Get(GreedyRepetition);
-				InsertStates(statesInside, greedy, greedy, greedy);
-			}
+				InsertStates(s, statesInside, NonGreedyRepetition, NoRepetition, GreedyRepetition, states);
+			else
+				InsertStates(s, statesInside, GreedyRepetition, GreedyRepetition, GreedyRepetition, states);
 		}
 	}
 
@@ -457,24 +511,23 @@ public:
 			if (st.HasBegin())
 				return true;
 		}
-		TVector<Transition> nextStates;
-		NextStates(st, Translate(EndMark), nextStates);
-		for (const auto& trans : nextStates)
-		{
-			size_t state = trans.GetState();
+		const unsigned* jumps;
+		const Action* actions;
+		size_t count = Transitions(st, Translate(EndMark), jumps, actions);
+		for (size_t i = 0; i < count; ++i) {
+			size_t state = jumps[i];
 			if (IsFinal(state)) {
 				matched = true;
-				if (st.HasBegin() || (trans.GetAction() & ActionsCapture))
+				if (st.HasBegin() || (actions[i] & ActionsCapture))
 					return true;
 			} else { // After EndMark there can be Epsilon-transitions to the Final State
-				TVector<Transition> epsilonTrans;
-				SingleState newSt(state);
-				NextStates(newSt, Translate(Epsilon), epsilonTrans);
-				for (auto new_trans : epsilonTrans) {
-					size_t fin = new_trans.GetState();
-					if (IsFinal(fin)) {
+				const unsigned* epsJumps;
+				const Action* epsActions;
+				size_t epsCount = Transitions(SingleState(state), Translate(Epsilon), epsJumps, epsActions);
+				for (size_t j = 0; j < epsCount; ++j) {
+					if (IsFinal(epsJumps[j])) {
 						matched = true;
-						if (st.HasBegin() || (trans.GetAction() & ActionsCapture))
+						if (st.HasBegin() || (actions[i] & ActionsCapture))
 							return true;
 					}
 				}
@@ -511,53 +564,36 @@ public:
 		}
 	}
 
-	bool PushState(State& nlist, const SingleState& state) const
-	{
-		nlist.PushState(state);
-		if (Matched(state)) {
-			nlist.AddMatch(state);
-			return true;
-		}
-		return false;
-	}
-
-	void UpdateNList(State& nlist, const PriorityStates& states) const
-	{
-		static constexpr std::array<RepetitionTypes, 3> m_type_by_priority{{NonGreedyRepetition, NoRepetition, GreedyRepetition}};
-		for (const auto type : m_type_by_priority) {
-			for (const auto& state : states.Get(type)) {
-				if (PushState(nlist, state)) // Because we have strict priorities, after matching some state, we can be sure, that not states after will be better
-					return;
-			}
-		}
-	}
-
 	void Initialize(State& nlist) const
 	{
+		Reserve(nlist);
+		nlist.m_states.clear();
+		nlist.m_next.clear();
+		nlist.m_strpos = 0;
+		nlist.m_matched = false;
+		nlist.m_match = SingleState();
+		nlist.m_usedCount = 0;
+
 		PriorityStates states;
 		SingleState init(GetStart());
-		TVector<bool> used(GetSize());
-		NextAndGetToGroups(states, init, Translate(BeginMark), 0, used);
-		NextAndGetToGroups(states, 0, Translate(BeginMark), 0, used);
+		NextAndGetToGroups(nlist, states, init, Translate(BeginMark), 0);
+		NextAndGetToGroups(nlist, states, 0, Translate(BeginMark), 0);
 		UpdateNList(nlist, states);
+		nlist.m_states.swap(nlist.m_next);
 	}
 
 	Action NextTranslated(State& clist, Char letter) const
 	{
-		State nlist;
-		if (clist.IsMatched())
-			nlist.AddMatch(clist.GetMatched());
-		nlist.SetPos(clist.GetPos() + 1);
-		size_t strpos = nlist.GetPos();
-		TVector<bool> used(GetSize());
-		size_t pos = 0;
-		while (pos < clist.GetSize()) {
+		Reserve(clist);
+		clist.m_next.clear();
+		clist.m_usedCount = 0;
+		size_t strpos = ++clist.m_strpos;
+		for (size_t pos = 0; pos < clist.m_states.size(); ++pos) {
 			PriorityStates states;
-			NextAndGetToGroups(states, clist.GetState(pos), letter, strpos, used);
-			UpdateNList(nlist, states);
-			++pos;
+			NextAndGetToGroups(clist, states, clist.m_states[pos], letter, strpos);
+			UpdateNList(clist, states);
 		}
-		DoSwap(clist, nlist);
+		clist.m_states.swap(clist.m_next);
 		return 0;
 	}
 
@@ -568,6 +604,101 @@ public:
 		return NextTranslated(st, Translate(letter));
 	}
 
+	/// Saves the list of NFA states with their captures and the current position,
+	/// which can be restored with LoadState() of any copy of the scanner.
+	/// Scratch space is not saved.
+	void SaveState(yostream* s, const State& state) const
+	{
+		Impl::SaveStateHeader(s, StateIOTypes::SlowCapturingScanner, GetSize());
+		SavePodType(s, state.m_strpos);
+		SavePodType(s, state.m_matched);
+		SavePodType(s, state.m_match);
+		SavePodType(s, state.m_states.size());
+		if (!state.m_states.empty())
+			SavePodArray(s, &state.m_states[0], state.m_states.size());
+	}
+
+	void LoadState(yistream* s, State& state) const
+	{
+		Impl::ValidateStateHeader(s, StateIOTypes::SlowCapturingScanner, GetSize());
+		State st;
+		size_t count;
+		LoadPodType(s, st.m_strpos);
+		LoadPodType(s, st.m_matched);
+		LoadPodType(s, st.m_match);
+		LoadPodType(s, count);
+		if (!*s || count > GetSize())
+			throw Error("Serialized state does not belong to this scanner");
+		st.m_states.resize(count);
+		if (count)
+			LoadPodArray(s, &st.m_states[0], count);
+		if (!*s)
+			throw Error("Serialized state does not belong to this scanner");
+		for (auto&& i : st.m_states)
+			if (i.GetNum() >= GetSize())
+				throw Error("Serialized state does not belong to this scanner");
+
+		// The state is only changed once the image is known to be good;
+		// its scratch space is kept
+		state.m_states.swap(st.m_states);
+		state.m_strpos = st.m_strpos;
+		state.m_matched = st.m_matched;
+		state.m_match = st.m_match;
+		state.m_usedCount = 0;
+	}
+
+private:
+	/// Sizes all the scratch space in the state (a no-op unless
+	/// the state is fresh or has been used with another scanner)
+	void Reserve(State& s) const
+	{
+		if (s.m_sparse.size() != GetSize()) {
+			s.m_sparse.assign(GetSize(), 0);
+			s.m_dense.assign(GetSize(), 0);
+			s.m_nodes.resize(GetSize());
+			s.m_links.resize(GetSize());
+		}
+		// Each NFA state gets into the list at most once per step
+		s.m_states.reserve(GetSize());
+		s.m_next.reserve(GetSize());
+	}
+
+	static void Append(State& s, PriorityStates::Chain& to, const PriorityStates::Chain& from)
+	{
+		if (from.head == PriorityStates::Npos)
+			return;
+		if (to.head == PriorityStates::Npos)
+			to.head = from.head;
+		else
+			s.m_links[to.tail] = from.head;
+		to.tail = from.tail;
+	}
+
+	/// Moves non-greedy, plain and greedy nodes of @p from
+	/// to the given lists of @p to, respectively
+	static void InsertStates(State& s, const PriorityStates& from, RepetitionTypes nonGreedy, RepetitionTypes nothing, RepetitionTypes greedy, PriorityStates& to)
+	{
+		Append(s, to.Get(nonGreedy), from.Get(NonGreedyRepetition));
+		Append(s, to.Get(nothing), from.Get(NoRepetition));
+		Append(s, to.Get(greedy), from.Get(GreedyRepetition));
+	}
+
+	void UpdateNList(State& s, const PriorityStates& states) const
+	{
+		static constexpr std::array<RepetitionTypes, 3> m_type_by_priority{{NonGreedyRepetition, NoRepetition, GreedyRepetition}};
+		for (const auto type : m_type_by_priority) {
+			for (size_t node = states.Get(type).head; node != PriorityStates::Npos; node = s.m_links[node]) {
+				const SingleState& state = s.m_nodes[node];
+				s.m_next.push_back(state);
+				if (Matched(state)) {
+					// Because we have strict priorities, after matching some state, we can be sure, that not states after will be better
+					s.AddMatch(state);
+					return;
+				}
+			}
+		}
+	}
+
 public:
 	SlowCapturingScanner()
 		: SlowScanner(true)
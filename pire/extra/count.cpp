@@ -50,13 +50,13 @@ public:
 		Separated = 1 << 2,
 	};
 
-	explicit CountingFsm(Fsm re, Fsm sep)
+	explicit CountingFsm(Fsm re, Fsm sep, size_t maxSize = 0)
 		: mFsm(std::move(re))
 	{
-		mFsm.Canonize();
+		mFsm.Canonize(maxSize);
 		const auto reMatchedStates = mFsm.Finals();
 
-		sep.Canonize();
+		sep.Canonize(maxSize);
 		for (size_t state = 0; state < sep.Size(); ++state) {
 			sep.SetTag(state, Separated);
 		}
@@ -100,6 +100,11 @@ public:
 	bool Determine();
 	void Minimize();
 
+	/// Builds the precise automaton; fails if it takes more than maxSize states
+	bool DetermineAdvanced(size_t maxSize);
+	/// Builds the simplified automaton; fails if it takes more than maxSize states
+	bool DetermineSimple(size_t maxSize);
+
 private:
 	void SwapTaskOutputs(CountingFsmTask& task);
 
@@ -706,20 +711,24 @@ private:
 };
 
 bool CountingFsm::Determine() {
+	return DetermineAdvanced(mFsm.Size() * 4096) || DetermineSimple(std::numeric_limits<size_t>::max());
+}
+
+bool CountingFsm::DetermineAdvanced(size_t maxSize) {
 	CountingFsmDetermineTask task{mFsm, mReInitial};
-	size_t maxSize = mFsm.Size() * 4096;
-	if (Pire::Impl::Determine(task, maxSize)) {
-		SwapTaskOutputs(task);
-		mSimple = false;
-	} else {
-		SimpleCountingFsmDetermineTask simpleTask{mFsm, mReInitial};
-		if (Pire::Impl::Determine(simpleTask, std::numeric_limits<size_t>::max())) {
-			SwapTaskOutputs(simpleTask);
-			mSimple = true;
-		} else {
-			return false;
-		}
-	}
+	if (!Pire::Impl::Determine(task, maxSize))
+		return false;
+	SwapTaskOutputs(task);
+	mSimple = false;
+	return true;
+}
+
+bool CountingFsm::DetermineSimple(size_t maxSize) {
+	SimpleCountingFsmDetermineTask task{mFsm, mReInitial};
+	if (!Pire::Impl::Determine(task, maxSize))
+		return false;
+	SwapTaskOutputs(task);
+	mSimple = true;
 	return true;
 }
 
@@ -741,12 +750,22 @@ namespace {
 	Pire::Fsm FsmForChar(Pire::Char c) { Pire::Fsm f; f.AppendSpecial(c); return f; }
 }
 
-CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
+namespace Impl {
+
+/// Builds the automaton of the CountingScanner into sq.
+/// Returns false if any of the intermediate automata takes more than maxSize states
+/// (zero means the default limits, which are not enforced).
+bool BuildClassicCountingFsm(const Fsm& re, const Fsm& sep, Fsm& sq, size_t maxSize)
 {
+	using Pire::CountingScanner;
+	const auto Matched = CountingScanner::Matched;
+	const auto DeadFlag = CountingScanner::DeadFlag;
+
 	Fsm res = re;
 	res.Surround();
 	Fsm sep_re = ((sep & ~res) /* | Fsm()*/) + re;
-	sep_re.Determine();
+	if (!sep_re.Determine(maxSize) && maxSize)
+		return false;
 
 	Fsm dup = sep_re;
 	for (size_t i = 0; i < dup.Size(); ++i)
@@ -760,14 +779,13 @@ CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
 	sep_re |= (FsmForDot() | FsmForChar(Pire::BeginMark) | FsmForChar(Pire::EndMark));
 
 	// Make a full Cartesian product of two sep_res
-	sep_re.Determine();
+	if (!sep_re.Determine(maxSize) && maxSize)
+		return false;
 	sep_re.Unsparse();
 	TSet<size_t> dead = sep_re.DeadStates();
 
 	PIRE_IFDEBUG(Cdbg << "=== Original FSM ===" << Endl << sep_re << ">>> " << sep_re.Size() << " states, dead: [" << Join(dead.begin(), dead.end(), ", ") << "]" << Endl);
 
-	Fsm sq;
-
 	typedef ypair<size_t, size_t> NewState;
 	TVector<NewState> states;
 	TMap<NewState, size_t> invstates;
@@ -813,6 +831,8 @@ CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
 
 			TMap<NewState, size_t>::iterator nsi = invstates.find(ns);
 			if (nsi == invstates.end()) {
+				if (maxSize && states.size() >= maxSize)
+					return false;
 				PIRE_IFDEBUG(Cdbg << "New state " << states.size() << " = (" << ns.first << ", " << ns.second << ")" << Endl);
 				states.push_back(ns);
 				nsi = invstates.insert(ymake_pair(states.back(), states.size() - 1)).first;
@@ -826,18 +846,98 @@ CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
 		}
 	}
 
-	sq.Determine();
+	if (!sq.Determine(maxSize) && maxSize)
+		return false;
 
 	PIRE_IFDEBUG(Cdbg << "=== FSM ===" << Endl << sq << Endl);
+	return true;
+}
+
+}
+
+CountingScanner::CountingScanner(const Fsm& re, const Fsm& sep)
+{
+	Fsm sq;
+	Impl::BuildClassicCountingFsm(re, sep, sq, 0);
 	Init(sq.Size(), sq.Letters(), sq.Initial(), 1);
 	BuildScanner(sq, *this);
 }
 
 namespace Impl {
+
+/// The largest number of states of a counting scanner fitting in the budget
+inline size_t StatesBudget(const CountingCompileBudget& budget, size_t lettersCount)
+{
+	size_t limit = budget.MaxStates ? budget.MaxStates : std::numeric_limits<size_t>::max();
+	if (budget.MaxMemory) {
+		const size_t overhead = MaxChar * sizeof(LoadedScanner::Letter);
+		const size_t stateSize = lettersCount * sizeof(LoadedScanner::Transition) + sizeof(LoadedScanner::Tag);
+		limit = ymin(limit, budget.MaxMemory > overhead ? (budget.MaxMemory - overhead) / stateSize : 0);
+	}
+	return ymax<size_t>(limit, 1);
+}
+
+inline CountingFsm MakeCountingFsm(const Fsm& re, const Fsm& sep, size_t maxSize)
+{
+	try {
+		return CountingFsm{re, sep, maxSize};
+	} catch (Error&) {
+		if (!maxSize)
+			throw;
+		throw Error("regexp pattern too complicated: regexp or separator exceeds " + ToString(maxSize) + " states");
+	}
+}
+
 template <class AdvancedScanner>
-AdvancedScanner MakeAdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple) {
-	Impl::CountingFsm countingFsm{re, sep};
-	if (!countingFsm.Determine()) {
+AdvancedScanner MakeAdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple, const CountingCompileBudget& budget, CountingCompileReport* report)
+{
+	const bool budgeted = budget.MaxStates || budget.MaxMemory;
+	CountingCompileReport rep;
+	AdvancedScanner scanner;
+
+	// The budget also bounds intermediate automata (of the regexp, the separator, etc.)
+	const size_t maxSize = budgeted ? StatesBudget(budget, 1) : 0;
+	Impl::CountingFsm countingFsm = MakeCountingFsm(re, sep, maxSize);
+	bool determined = false;
+	if (!budgeted) {
+		determined = countingFsm.Determine();
+	} else {
+		const size_t limit = StatesBudget(budget, countingFsm.Letters().Size());
+		rep.Used = CountingCompileReport::Advanced;
+		determined = countingFsm.DetermineAdvanced(limit);
+		if (!determined) {
+			rep.Used = CountingCompileReport::AdvancedSimple;
+			rep.Reason = "precise counting automaton exceeds " + ToString(limit) + " states";
+			determined = countingFsm.DetermineSimple(limit);
+		}
+		if (!determined) {
+			rep.Used = CountingCompileReport::Classic;
+			rep.Reason += "; simplified counting automaton exceeds " + ToString(limit) + " states";
+			Fsm sq;
+			if (!BuildClassicCountingFsm(re, sep, sq, maxSize) || sq.Size() > StatesBudget(budget, sq.Letters().Size()))
+				throw Error("regexp pattern too complicated: " + rep.Reason + "; classic counting automaton exceeds the budget as well");
+
+			// Classic automaton either increments or resets a counter on a transition, never both,
+			// so it behaves the same under the advanced actions semantics
+			scanner.Init(sq.Size(), sq.Letters(), sq.Initial(), 1);
+			for (size_t from = 0; from != sq.Size(); ++from)
+				for (auto&& letter : sq.Letters()) {
+					const auto& tos = sq.Destinations(from, letter.first);
+					Y_ASSERT(tos.size() == 1);
+					const auto output = sq.Output(from, *tos.begin());
+					Action action = 0;
+					if (output & CountingScanner::DeadFlag)
+						action = (output & CountingScanner::Matched) ? AdvancedCountingScanner::IncrementAction : AdvancedCountingScanner::ResetAction;
+					scanner.SetJump(from, letter.first, *tos.begin(), scanner.RemapAction(action));
+				}
+			if (simple)
+				*simple = true;
+			if (report)
+				*report = rep;
+			return scanner;
+		}
+	}
+	if (!determined) {
 		throw Error("regexp pattern too complicated");
 	}
 	countingFsm.Minimize();
@@ -845,30 +945,41 @@ AdvancedScanner MakeAdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool*
 		*simple = countingFsm.Simple();
 	}
 
-	const auto& determined = countingFsm.Determined();
+	const auto& determinedFsm = countingFsm.Determined();
 	const auto& letters = countingFsm.Letters();
 
-	AdvancedScanner scanner;
-	scanner.Init(determined.Size(), letters, determined.Initial(), 1);
-	for (size_t from = 0; from != determined.Size(); ++from) {
+	scanner.Init(determinedFsm.Size(), letters, determinedFsm.Initial(), 1);
+	for (size_t from = 0; from != determinedFsm.Size(); ++from) {
 		for (auto&& lettersEl : letters) {
 			const auto letter = lettersEl.first;
-			const auto& tos = determined.Destinations(from, letter);
+			const auto& tos = determinedFsm.Destinations(from, letter);
 			Y_ASSERT(tos.size() == 1);
 			scanner.SetJump(from, letter, *tos.begin(), scanner.RemapAction(countingFsm.Output(from, letter)));
 		}
 	}
+	if (report)
+		*report = rep;
 	return scanner;
 }
 }  // namespace Impl
 
 AdvancedCountingScanner::AdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple)
-	: AdvancedCountingScanner(Impl::MakeAdvancedCountingScanner<AdvancedCountingScanner>(re, sep, simple))
+	: AdvancedCountingScanner(Impl::MakeAdvancedCountingScanner<AdvancedCountingScanner>(re, sep, simple, CountingCompileBudget(), nullptr))
+{
+}
+
+AdvancedCountingScanner::AdvancedCountingScanner(const Fsm& re, const Fsm& sep, const CountingCompileBudget& budget, CountingCompileReport* report)
+	: AdvancedCountingScanner(Impl::MakeAdvancedCountingScanner<AdvancedCountingScanner>(re, sep, nullptr, budget, report))
 {
 }
 
 NoGlueLimitCountingScanner::NoGlueLimitCountingScanner(const Fsm& re, const Fsm& sep, bool* simple)
-	: NoGlueLimitCountingScanner(Impl::MakeAdvancedCountingScanner<NoGlueLimitCountingScanner>(re, sep, simple))
+	: NoGlueLimitCountingScanner(Impl::MakeAdvancedCountingScanner<NoGlueLimitCountingScanner>(re, sep, simple, CountingCompileBudget(), nullptr))
+{
+}
+
+NoGlueLimitCountingScanner::NoGlueLimitCountingScanner(const Fsm& re, const Fsm& sep, const CountingCompileBudget& budget, CountingCompileReport* report)
+	: NoGlueLimitCountingScanner(Impl::MakeAdvancedCountingScanner<NoGlueLimitCountingScanner>(re, sep, nullptr, budget, report))
 {
 }
 
@@ -32,6 +32,33 @@
 namespace Pire {
 class Fsm;
 
+/**
+ * Limits for compiling an advanced counting scanner (zero means no limit).
+ * When the precise counting automaton does not fit, the compiler falls back
+ * to the simplified one and then to the automaton of the CountingScanner.
+ */
+struct CountingCompileBudget {
+	size_t MaxStates;
+	size_t MaxMemory; ///< Bytes of the compiled scanner
+
+	explicit CountingCompileBudget(size_t maxStates = 0, size_t maxMemory = 0)
+		: MaxStates(maxStates), MaxMemory(maxMemory) {}
+};
+
+/// Tells how a counting scanner has been compiled under a budget
+struct CountingCompileReport {
+	enum Method {
+		Advanced,       ///< The precise counting automaton
+		AdvancedSimple, ///< The simplified one (the `simple' flag of constructors)
+		Classic,        ///< The automaton of the CountingScanner (counts just as a CountingScanner does)
+	};
+
+	Method Used;
+	ystring Reason; ///< Why more precise methods have been given up, if they have
+
+	CountingCompileReport(): Used(Advanced) {}
+};
+
 namespace Impl {
 	template<class T>
 	class ScannerGlueCommon;
@@ -42,7 +69,7 @@ namespace Impl {
 	class NoGlueLimitCountingScannerGlueTask;
 
 	template <class AdvancedScanner>
-	AdvancedScanner MakeAdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple);
+	AdvancedScanner MakeAdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple, const CountingCompileBudget& budget, CountingCompileReport* report);
 };
 
 template<size_t I>
@@ -147,6 +174,14 @@ public:
 		return m_letters[static_cast<size_t>(ch)];
 	}
 
+	/// Returns a copy having its own tables (ordinary copies share them)
+	DerivedScanner Clone() const
+	{
+		DerivedScanner s(static_cast<const DerivedScanner&>(*this));
+		s.Detach();
+		return s;
+	}
+
 	Action NextTranslated(State& s, Char c) const
 	{
 		Transition x = reinterpret_cast<const Transition*>(s.m_state)[c];
@@ -173,6 +208,29 @@ public:
 
 	size_t StateIndex(const State& s) const { return StateIdx(s.m_state); }
 
+	/// Zeroes all counters of the state, leaving the automaton where it is
+	void ResetCounters(State& state) const { state.ResetCounters(); }
+
+	/// Saves the state along with its counters in a position-independent form,
+	/// which can be restored with LoadState() of any copy of the scanner.
+	void SaveState(yostream* s, const State& state) const
+	{
+		Impl::SaveStateHeader(s, DerivedScanner::StateIOType, Size());
+		SavePodType(s, StateIdx(state.m_state));
+		state.SaveCounters(s, RegexpsCount());
+	}
+
+	void LoadState(yistream* s, State& state) const
+	{
+		Impl::ValidateStateHeader(s, DerivedScanner::StateIOType, Size());
+		State st;
+		st.m_state = IndexToState(Impl::LoadStateIndex(s, Size()));
+		st.LoadCounters(s, RegexpsCount());
+		if (!*s)
+			throw Error("Serialized state does not belong to this scanner");
+		DoSwap(st, state);
+	}
+
 protected:
 	using LoadedScanner::Init;
 	using LoadedScanner::InternalState;
@@ -214,6 +272,27 @@ private:
 	ui32 m_total[MAX_RE_COUNT];
 	size_t m_updatedMask;
 
+	void ResetCounters()
+	{
+		memset(&m_current, 0, sizeof(m_current));
+		memset(&m_total, 0, sizeof(m_total));
+		m_updatedMask = 0;
+	}
+
+	void SaveCounters(yostream* s, size_t) const
+	{
+		SavePodArray(s, m_current, MAX_RE_COUNT);
+		SavePodArray(s, m_total, MAX_RE_COUNT);
+		SavePodType(s, m_updatedMask);
+	}
+
+	void LoadCounters(yistream* s, size_t)
+	{
+		LoadPodArray(s, m_current, MAX_RE_COUNT);
+		LoadPodArray(s, m_total, MAX_RE_COUNT);
+		LoadPodType(s, m_updatedMask);
+	}
+
 	template <class DerivedScanner, class State>
 	friend class BaseCountingScanner;
 
@@ -238,6 +317,7 @@ private:
 class CountingScanner : public BaseCountingScanner<CountingScanner, CountingState<LoadedScanner::MAX_RE_COUNT>> {
 public:
 	using State = CountingState<MAX_RE_COUNT>;
+	static const ui32 StateIOType = StateIOTypes::CountingScanner;
 	enum {
 		Matched = 2,
 	};
@@ -276,10 +356,15 @@ private:
 class AdvancedCountingScanner : public BaseCountingScanner<AdvancedCountingScanner, CountingState<LoadedScanner::MAX_RE_COUNT>> {
 public:
 	using State = CountingState<MAX_RE_COUNT>;
+	static const ui32 StateIOType = StateIOTypes::AdvancedCountingScanner;
 
 	AdvancedCountingScanner() {}
 	AdvancedCountingScanner(const Fsm& re, const Fsm& sep, bool* simple = nullptr);
 
+	/// Compiles the scanner within the budget, falling back to less precise
+	/// automata if necessary; throws if none of them fits.
+	AdvancedCountingScanner(const Fsm& re, const Fsm& sep, const CountingCompileBudget& budget, CountingCompileReport* report = nullptr);
+
 	static AdvancedCountingScanner Glue(const AdvancedCountingScanner& a, const AdvancedCountingScanner& b, size_t maxSize = 0);
 
 	template<size_t ActualReCount>
@@ -309,7 +394,7 @@ private:
 
 	friend class Impl::ScannerGlueCommon<AdvancedCountingScanner>;
 	friend class Impl::CountingScannerGlueTask<AdvancedCountingScanner>;
-	friend AdvancedCountingScanner Impl::MakeAdvancedCountingScanner<AdvancedCountingScanner>(const Fsm&, const Fsm&, bool*);
+	friend AdvancedCountingScanner Impl::MakeAdvancedCountingScanner<AdvancedCountingScanner>(const Fsm&, const Fsm&, bool*, const CountingCompileBudget&, CountingCompileReport*);
 };
 
 class NoGlueLimitCountingState {
@@ -341,6 +426,31 @@ private:
 	TVector<ui32> m_current;
 	TVector<ui32> m_total;
 
+	void ResetCounters()
+	{
+		std::fill(m_current.begin(), m_current.end(), 0);
+		std::fill(m_total.begin(), m_total.end(), 0);
+	}
+
+	void SaveCounters(yostream* s, size_t regexpsCount) const
+	{
+		Y_ASSERT(m_current.size() == regexpsCount && m_total.size() == regexpsCount);
+		if (regexpsCount) {
+			SavePodArray(s, &m_current[0], regexpsCount);
+			SavePodArray(s, &m_total[0], regexpsCount);
+		}
+	}
+
+	void LoadCounters(yistream* s, size_t regexpsCount)
+	{
+		m_current.resize(regexpsCount);
+		m_total.resize(regexpsCount);
+		if (regexpsCount) {
+			LoadPodArray(s, &m_current[0], regexpsCount);
+			LoadPodArray(s, &m_total[0], regexpsCount);
+		}
+	}
+
 	template <class DerivedScanner, class State>
 	friend class BaseCountingScanner;
 
@@ -359,6 +469,7 @@ private:
 class NoGlueLimitCountingScanner : public BaseCountingScanner<NoGlueLimitCountingScanner, NoGlueLimitCountingState> {
 public:
 	using State = NoGlueLimitCountingState;
+	static const ui32 StateIOType = StateIOTypes::NoGlueLimitCountingScanner;
 	using ActionIndex = ui32;
 	using TActionsBuffer = std::unique_ptr<ActionIndex[]>;
 
@@ -370,6 +481,8 @@ private:
 public:
 	NoGlueLimitCountingScanner() = default;
 	NoGlueLimitCountingScanner(const Fsm& re, const Fsm& sep, bool* simple = nullptr);
+	/// See the corresponding constructor of AdvancedCountingScanner
+	NoGlueLimitCountingScanner(const Fsm& re, const Fsm& sep, const CountingCompileBudget& budget, CountingCompileReport* report = nullptr);
 	NoGlueLimitCountingScanner(const NoGlueLimitCountingScanner& rhs)
 	    : BaseCountingScanner(rhs)
 	    , AdvancedScannerCompatibilityMode(rhs.AdvancedScannerCompatibilityMode)
@@ -496,7 +609,7 @@ private:
 	friend class Impl::ScannerGlueCommon<NoGlueLimitCountingScanner>;
 	friend class Impl::CountingScannerGlueTask<NoGlueLimitCountingScanner>;
 	friend class Impl::NoGlueLimitCountingScannerGlueTask;
-	friend NoGlueLimitCountingScanner Impl::MakeAdvancedCountingScanner<NoGlueLimitCountingScanner>(const Fsm&, const Fsm&, bool*);
+	friend NoGlueLimitCountingScanner Impl::MakeAdvancedCountingScanner<NoGlueLimitCountingScanner>(const Fsm&, const Fsm&, bool*, const CountingCompileBudget&, CountingCompileReport*);
 };
 
 }
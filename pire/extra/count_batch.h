@@ -0,0 +1,121 @@
+/*
+ * count_batch.h -- counting a batch of segments in a single pass
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_EXTRA_COUNT_BATCH_H
+#define PIRE_EXTRA_COUNT_BATCH_H
+
+#include <string.h>
+#include "count.h"
+#include "../run.h"
+#include "../stub/stl.h"
+
+namespace Pire {
+
+/**
+ * Counts of every regexp of a counting scanner in every segment of a buffer,
+ * gathered in a single pass with a single state.
+ *
+ * Windows() splits the buffer into fixed-size windows; the automaton runs through
+ * window boundaries and only the counters are zeroed there, so a match spanning
+ * a boundary is counted in the window where it ends (CountingScanner notices
+ * a match one character later, so it may count it in the next window).
+ * Documents() treats the buffer as a batch of documents separated by a delimiter
+ * character and counts each of them as if it was scanned alone. Unlike windows,
+ * documents cannot share the automaton state: a match must not span a delimiter,
+ * so each document restarts from a copy of the initial state (with BeginMark
+ * already consumed), which is computed once per batch.
+ */
+class CountBatch {
+public:
+	CountBatch(): m_segments(0), m_regexps(0) {}
+
+	template<class Scanner>
+	static CountBatch Windows(const Scanner& scanner, const char* begin, const char* end, size_t window)
+	{
+		Y_ASSERT(window);
+		CountBatch batch(scanner.RegexpsCount());
+		batch.m_counts.reserve(((end - begin) + window - 1) / window * batch.m_regexps);
+		typename Scanner::State state;
+		scanner.Initialize(state);
+		Step(scanner, state, BeginMark);
+		while (begin != end) {
+			const char* next = begin + ymin<size_t>(window, end - begin);
+			Run(scanner, state, begin, next);
+			if (next == end)
+				Step(scanner, state, EndMark);
+			batch.Append(state);
+			scanner.ResetCounters(state);
+			begin = next;
+		}
+		return batch;
+	}
+
+	template<class Scanner>
+	static CountBatch Documents(const Scanner& scanner, const char* begin, const char* end, char delimiter)
+	{
+		CountBatch batch(scanner.RegexpsCount());
+		typename Scanner::State start, state;
+		scanner.Initialize(start);
+		Step(scanner, start, BeginMark);
+		while (begin != end) {
+			const char* next = static_cast<const char*>(memchr(begin, delimiter, end - begin));
+			if (!next)
+				next = end;
+			state = start;
+			Run(scanner, state, begin, next);
+			Step(scanner, state, EndMark);
+			batch.Append(state);
+			begin = (next == end) ? end : next + 1;
+		}
+		return batch;
+	}
+
+	size_t Segments() const { return m_segments; }
+	size_t RegexpsCount() const { return m_regexps; }
+
+	/// Counts of all regexps in the given segment
+	const ui32* Row(size_t segment) const { Y_ASSERT(segment < m_segments); return m_counts.data() + segment * m_regexps; }
+	ui32 Count(size_t segment, size_t regexp) const { Y_ASSERT(regexp < m_regexps); return Row(segment)[regexp]; }
+
+	/// The whole matrix, segment by segment
+	const TVector<ui32>& Counts() const { return m_counts; }
+
+private:
+	explicit CountBatch(size_t regexps): m_segments(0), m_regexps(regexps) {}
+
+	template<class State>
+	void Append(const State& state)
+	{
+		for (size_t i = 0; i < m_regexps; ++i)
+			m_counts.push_back(static_cast<ui32>(state.Result(i)));
+		++m_segments;
+	}
+
+	TVector<ui32> m_counts;
+	size_t m_segments;
+	size_t m_regexps;
+};
+
+}
+
+#endif
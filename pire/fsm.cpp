@@ -28,6 +28,7 @@
 #include <iterator>
 #include <numeric>
 #include <queue>
+#include <unordered_set>
 #include <utility>
 #include "fsm.h"
 #include "vbitset.h"
@@ -207,6 +208,118 @@ Fsm Fsm::MakeFalse()
 	return f;
 }
 
+namespace {
+	/// A state of the trie being built by Fsm::FromStrings()
+	struct DafsaNode {
+		bool final;
+		TVector< ypair<unsigned char, ui32> > edges; ///< In ascending order of letters
+
+		DafsaNode(): final(false) {}
+
+		bool operator == (const DafsaNode& rhs) const { return final == rhs.final && edges == rhs.edges; }
+
+		size_t Hash() const
+		{
+			size_t hash = final;
+			for (auto&& edge : edges)
+				hash = (hash * 1000003 + edge.first) * 1000003 + edge.second;
+			return hash;
+		}
+	};
+
+	/// Compares nodes of a vector by their indices, for keeping them in a hash set
+	struct DafsaNodeIndex {
+		const TVector<DafsaNode>* nodes;
+
+		size_t operator()(ui32 node) const { return (*nodes)[node].Hash(); }
+		bool operator()(ui32 lhs, ui32 rhs) const { return (*nodes)[lhs] == (*nodes)[rhs]; }
+	};
+}
+
+Fsm Fsm::FromStrings(const TVector<ystring>& strings)
+{
+	// Daciuk et al., "Incremental construction of minimal acyclic finite-state
+	// automata". Strings are added in lexicographical order, so whenever a new
+	// string leaves the path of the previous one, the rest of that path will never
+	// change again, and each of its states is either replaced with an equivalent
+	// state seen before or remembered in the register.
+	TVector<ystring> sorted(strings);
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+	TVector<DafsaNode> nodes(1);
+	TVector<ui32> unused;
+	DafsaNodeIndex index = { &nodes };
+	std::unordered_set<ui32, DafsaNodeIndex, DafsaNodeIndex> reg(0, index, index);
+	TVector<ui32> path(1, 0);
+
+	auto freeze = [&](size_t depth) {
+		for (; path.size() > depth + 1; path.pop_back()) {
+			ui32 node = path.back();
+			auto ins = reg.insert(node);
+			if (!ins.second) {
+				nodes[path[path.size() - 2]].edges.back().second = *ins.first;
+				nodes[node] = DafsaNode();
+				unused.push_back(node);
+			}
+		}
+	};
+
+	const ystring* prev = 0;
+	for (auto&& str : sorted) {
+		size_t common = 0;
+		if (prev)
+			while (common < str.size() && common < prev->size() && str[common] == (*prev)[common])
+				++common;
+		freeze(common);
+		for (size_t i = common; i != str.size(); ++i) {
+			ui32 node;
+			if (!unused.empty()) {
+				node = unused.back();
+				unused.pop_back();
+			} else {
+				node = nodes.size();
+				nodes.push_back(DafsaNode());
+			}
+			nodes[path.back()].edges.push_back(ymake_pair(static_cast<unsigned char>(str[i]), node));
+			path.push_back(node);
+		}
+		nodes[path.back()].final = true;
+		prev = &str;
+	}
+	freeze(0);
+	reg.clear();
+
+	// Number reachable nodes in breadth-first order, the root becoming state 0
+	TVector<ui32> number(nodes.size(), 0);
+	TVector<ui32> order(1, 0);
+	TVector<bool> seen(nodes.size(), false);
+	seen[0] = true;
+	for (size_t i = 0; i != order.size(); ++i) {
+		number[order[i]] = i;
+		for (auto&& edge : nodes[order[i]].edges)
+			if (!seen[edge.second]) {
+				seen[edge.second] = true;
+				order.push_back(edge.second);
+			}
+	}
+
+	// Like the ones built by Append(), the FSM has no transitions to
+	// the dead state and is not marked as determined, so that combining
+	// it with other FSMs does not drag lots of useless transitions along
+	Fsm fsm;
+	fsm.Resize(order.size());
+	fsm.ClearFinal();
+	for (size_t state = 0; state != order.size(); ++state) {
+		const DafsaNode& node = nodes[order[state]];
+		for (auto&& edge : node.edges)
+			fsm.Connect(state, number[edge.second], edge.first);
+		if (node.final)
+			fsm.SetFinal(state, true);
+	}
+	return fsm;
+}
+
 Char Fsm::Translate(Char c) const
 {
 	if (!m_sparsed || c == Epsilon)
@@ -47,6 +47,12 @@ namespace Pire {
 
 		static Fsm MakeFalse();
 
+		/// Builds the minimal deterministic FSM matching exactly the given strings
+		/// (in any order, possibly repeated), without determining and minimizing
+		/// a union of them. The FSM has several final states, yet still can be
+		/// concatenated or united with other ones (e.g. parsed prefixes and suffixes).
+		static Fsm FromStrings(const TVector<ystring>& strings);
+
 		/// Current number of states
 		size_t Size() const { return m_transitions.size(); }
 
@@ -118,6 +124,11 @@ namespace Pire {
 		template<class Scanner>
 		Scanner Compile(size_t distance = 0);
 
+		/// Saves the whole FSM (transitions, letter classes, finals, tags and outputs),
+		/// so that a canonized one can later be glued or compiled without parsing
+		void Save(yostream* s) const;
+		void Load(yistream* s);
+
 		void DumpState(yostream& s, size_t state) const;
 		void DumpTo(yostream& s, const ystring& name = "") const;
 
@@ -0,0 +1,160 @@
+/*
+ * literals.cpp -- a hash table of patterns matching a single string
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "literals.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace Pire {
+
+namespace {
+	/// Characters a Lexer treats specially unless they are escaped
+	const char Specials[] = "|().*+?^$\\[{";
+
+	/// Characters standing for themselves when escaped
+	const char Escapable[] = "|().*+?^$\\[]{}";
+
+	inline ui64 Mix(ui64 hash)
+	{
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	/// Hashes eight bytes at a time; the values never leave the process
+	ui64 Hash(const char* begin, const char* end)
+	{
+		ui64 hash = static_cast<ui64>(end - begin);
+		for (; end - begin >= 8; begin += 8) {
+			ui64 word;
+			memcpy(&word, begin, sizeof(word));
+			hash = Mix(hash ^ word);
+		}
+		ui64 tail = 0;
+		if (begin != end)
+			memcpy(&tail, begin, end - begin);
+		return Mix(hash ^ tail ^ 0x9e3779b97f4a7c15ull);
+	}
+}
+
+bool AnchoredLiteral(const ystring& pattern, ystring& literal)
+{
+	if (pattern.size() < 2 || pattern[0] != '^' || pattern[pattern.size() - 1] != '$')
+		return false;
+	ystring str;
+	for (size_t i = 1, end = pattern.size() - 1; i != end; ++i) {
+		char ch = pattern[i];
+		if (ch == '\\') {
+			// An escaped final dollar is not an anchor
+			if (++i == end)
+				return false;
+			ch = pattern[i];
+			if (!ch || !strchr(Escapable, ch))
+				return false;
+		} else if (!ch || static_cast<unsigned char>(ch) >= 0x80 || strchr(Specials, ch))
+			return false;
+		str += ch;
+	}
+	literal.swap(str);
+	return true;
+}
+
+LiteralSet::LiteralSet(const TVector<ystring>& patterns, TVector<ystring>& regexps, const Recognizer& recognize)
+	: m_patterns(patterns.size())
+	, m_literals(0)
+	, m_mask(0)
+{
+	TVector< ypair<ystring, size_t> > literals;
+	ystring literal;
+	for (size_t i = 0; i != patterns.size(); ++i) {
+		if (recognize && recognize(patterns[i], literal))
+			literals.push_back(ymake_pair(literal, i));
+		else {
+			regexps.push_back(patterns[i]);
+			m_regexps.push_back(i);
+		}
+	}
+	m_literals = literals.size();
+	if (literals.empty())
+		return;
+
+	// Equal strings go together, in ascending order of their numbers
+	std::sort(literals.begin(), literals.end());
+	for (auto it = literals.begin(), ie = literals.end(); it != ie;) {
+		Entry entry;
+		entry.offset = m_chars.size();
+		entry.length = it->first.size();
+		entry.firstId = m_ids.size();
+		m_chars += it->first;
+		auto next = it;
+		for (; next != ie && next->first == it->first; ++next)
+			m_ids.push_back(next->second);
+		entry.idsCount = m_ids.size() - entry.firstId;
+		m_entries.push_back(entry);
+		it = next;
+	}
+	if (m_entries.size() >= static_cast<ui32>(-1))
+		throw Error("Pire::LiteralSet: too many literals");
+
+	// At most half of the slots are taken, keeping probe sequences short
+	size_t size = 2;
+	while (size < 2 * m_entries.size())
+		size *= 2;
+	Slot empty = { 0, 0 };
+	m_slots.assign(size, empty);
+	m_mask = size - 1;
+	for (size_t i = 0; i != m_entries.size(); ++i) {
+		const char* str = m_chars.data() + m_entries[i].offset;
+		ui64 hash = Hash(str, str + m_entries[i].length);
+		size_t slot = hash & m_mask;
+		while (m_slots[slot].entry)
+			slot = (slot + 1) & m_mask;
+		m_slots[slot].hash = static_cast<ui32>(hash >> 32);
+		m_slots[slot].entry = static_cast<ui32>(i + 1);
+	}
+}
+
+ypair<const size_t*, const size_t*> LiteralSet::Find(const char* begin, const char* end) const
+{
+	if (!m_slots.empty()) {
+		ui64 hash = Hash(begin, end);
+		ui32 tag = static_cast<ui32>(hash >> 32);
+		size_t length = end - begin;
+		for (size_t slot = hash & m_mask; m_slots[slot].entry; slot = (slot + 1) & m_mask) {
+			if (m_slots[slot].hash != tag)
+				continue;
+			const Entry& entry = m_entries[m_slots[slot].entry - 1];
+			if (entry.length == length && !memcmp(m_chars.data() + entry.offset, begin, length)) {
+				const size_t* ids = m_ids.data() + entry.firstId;
+				return ymake_pair(ids, ids + entry.idsCount);
+			}
+		}
+	}
+	return ymake_pair<const size_t*, const size_t*>(0, 0);
+}
+
+}
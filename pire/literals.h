@@ -0,0 +1,153 @@
+/*
+ * literals.h -- a hash table of patterns matching a single string
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_LITERALS_H
+#define PIRE_LITERALS_H
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include "run.h"
+#include "stub/stl.h"
+#include "stub/defaults.h"
+
+namespace Pire {
+
+/**
+ * If the pattern is fully anchored and has neither operators nor character
+ * classes (e.g. "^/index\.html$"), stores the only string it matches
+ * and returns true. Only ASCII patterns in the syntax of a Lexer without
+ * any features are recognized; other ones are left to the Lexer.
+ */
+bool AnchoredLiteral(const ystring& pattern, ystring& literal);
+
+/**
+ * Patterns matching a single string, kept in an open addressing hash
+ * table: looking a text up takes hashing it and, usually, reading
+ * a single slot and comparing a single string.
+ *
+ * The set is built out of a list of patterns, recognizing literals
+ * among them; the rest of the patterns are regexps, which should be
+ * compiled into a separate scanner. Both literals and regexps keep
+ * their numbers in the original list.
+ */
+class LiteralSet {
+public:
+	typedef std::function<bool(const ystring& pattern, ystring& literal)> Recognizer;
+
+	LiteralSet(): m_patterns(0), m_literals(0), m_mask(0) {}
+
+	/// Takes the patterns @p recognize accepts as literals, appending the rest to @p regexps
+	LiteralSet(const TVector<ystring>& patterns, TVector<ystring>& regexps, const Recognizer& recognize = &AnchoredLiteral);
+
+	/// Numbers of the patterns matching exactly the given text, in ascending order
+	ypair<const size_t*, const size_t*> Find(const char* begin, const char* end) const;
+
+	size_t PatternsCount() const { return m_patterns; }
+	size_t LiteralsCount() const { return m_literals; }
+
+	/// Number of the i-th regexp among all the patterns
+	size_t RegexpNumber(size_t i) const { return m_regexps[i]; }
+
+private:
+	/// A distinct string and the numbers of the patterns matching it
+	struct Entry {
+		size_t offset, length;
+		size_t firstId, idsCount;
+	};
+
+	/// A reference to an entry along with a part of its hash, in order not
+	/// to touch entries which cannot match
+	struct Slot {
+		ui32 hash;
+		ui32 entry; ///< One-based, zero for an empty slot
+	};
+
+	size_t m_patterns;
+	size_t m_literals;
+	ystring m_chars;
+	TVector<Entry> m_entries;
+	TVector<size_t> m_ids;
+	TVector<Slot> m_slots;
+	size_t m_mask;
+	TVector<size_t> m_regexps;
+};
+
+/**
+ * Matches texts against a set of patterns, looking up literal ones in
+ * a LiteralSet and running a scanner glued of the others, so that literals
+ * do not take any states of the scanner. Copies share the literal set.
+ *
+ * Texts are matched as a whole, as Runner(scanner).Begin().Run(text).End()
+ * would do. See CompileService::CompileHybrid().
+ */
+template<class Scanner>
+class HybridScanner {
+public:
+	HybridScanner(): m_literals(new LiteralSet) {}
+
+	/// The scanner should number the regexps in the order of the set
+	HybridScanner(const std::shared_ptr<const LiteralSet>& literals, const Scanner& regexps)
+		: m_literals(literals)
+		, m_regexps(regexps)
+	{
+	}
+
+	size_t RegexpsCount() const { return m_literals->PatternsCount(); }
+
+	const LiteralSet& Literals() const { return *m_literals; }
+	const Scanner& Regexps() const { return m_regexps; }
+
+	/// Stores numbers of all the patterns matching the text, in ascending order
+	void Match(const char* begin, const char* end, TVector<size_t>& ids) const
+	{
+		auto literals = m_literals->Find(begin, end);
+		ids.assign(literals.first, literals.second);
+		if (m_regexps.Empty())
+			return;
+		auto accepted = m_regexps.AcceptedRegexps(Run(begin, end));
+		for (; accepted.first != accepted.second; ++accepted.first)
+			ids.push_back(m_literals->RegexpNumber(*accepted.first));
+		std::sort(ids.begin(), ids.end());
+	}
+
+	/// Whether any of the patterns matches the text
+	bool Matches(const char* begin, const char* end) const
+	{
+		auto literals = m_literals->Find(begin, end);
+		return literals.first != literals.second || (!m_regexps.Empty() && m_regexps.Final(Run(begin, end)));
+	}
+
+private:
+	typename Scanner::State Run(const char* begin, const char* end) const
+	{
+		return Runner(m_regexps).Begin().Run(begin, end).End().State();
+	}
+
+	std::shared_ptr<const LiteralSet> m_literals;
+	Scanner m_regexps;
+};
+
+}
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * memory_policy.cpp -- placement of large scanner tables in memory
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "memory_policy.h"
+#include "align.h"
+#include "stub/stl.h"
+#include "stub/lexical_cast.h"
+
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <fstream>
+#include <sched.h>
+#endif
+
+namespace Pire {
+
+#ifndef _WIN32
+
+namespace {
+	const size_t HugePageSize = 2 << 20;
+	const size_t PageSize = 4096;
+
+	// Applies everything but explicit huge pages to a page-aligned range
+	unsigned Advise(void* ptr, size_t size, unsigned policy)
+	{
+		unsigned applied = 0;
+#ifdef MADV_HUGEPAGE
+		if ((policy & (MemoryPolicy::HugePages | MemoryPolicy::ExplicitHugePages)) && !madvise(ptr, size, MADV_HUGEPAGE))
+			applied |= MemoryPolicy::HugePages;
+#endif
+		if ((policy & MemoryPolicy::Prefault) && !madvise(ptr, size, MADV_WILLNEED))
+			applied |= MemoryPolicy::Prefault;
+		if ((policy & MemoryPolicy::Lock) && !mlock(ptr, size))
+			applied |= MemoryPolicy::Lock;
+		return applied;
+	}
+
+	// Anonymous memory is only faulted in by touching it
+	void TouchPages(void* ptr, size_t size)
+	{
+		for (size_t i = 0; i < size; i += PageSize)
+			static_cast<volatile char*>(ptr)[i] = 0;
+	}
+}
+
+unsigned AdviseMemory(const void* ptr, size_t size, unsigned policy)
+{
+	// madvise() and mlock() want whole pages
+	size_t begin = reinterpret_cast<size_t>(ptr) & ~(PageSize - 1);
+	size_t end = Impl::AlignUp(reinterpret_cast<size_t>(ptr) + size, PageSize);
+	return size ? Advise(reinterpret_cast<void*>(begin), end - begin, policy) : 0;
+}
+
+namespace Impl {
+
+char* AllocateMemory(size_t size, unsigned policy, size_t& allocated, unsigned& applied)
+{
+	applied = 0;
+	void* ptr = MAP_FAILED;
+	const bool huge = (policy & (MemoryPolicy::HugePages | MemoryPolicy::ExplicitHugePages)) != 0;
+	allocated = AlignUp(size ? size : 1, huge ? HugePageSize : PageSize);
+
+#ifdef MAP_HUGETLB
+	if (policy & MemoryPolicy::ExplicitHugePages) {
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+		bool populated = false;
+#ifdef MAP_POPULATE
+		if (policy & MemoryPolicy::Prefault) {
+			flags |= MAP_POPULATE;
+			populated = true;
+		}
+#endif
+		ptr = mmap(0, allocated, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (ptr != MAP_FAILED) {
+			applied = MemoryPolicy::ExplicitHugePages;
+			if (policy & MemoryPolicy::Prefault) {
+				if (!populated)
+					TouchPages(ptr, allocated);
+				applied |= MemoryPolicy::Prefault;
+			}
+			if ((policy & MemoryPolicy::Lock) && !mlock(ptr, allocated))
+				applied |= MemoryPolicy::Lock;
+			return static_cast<char*>(ptr);
+		}
+	}
+#endif
+
+	if (huge) {
+		// Huge pages can only back 2M-aligned ranges: map more and trim the edges
+		char* raw = static_cast<char*>(mmap(0, allocated + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (raw == MAP_FAILED)
+			throw std::bad_alloc();
+		char* aligned = AlignUp(raw, HugePageSize);
+		if (aligned != raw)
+			munmap(raw, aligned - raw);
+		if (aligned != raw + HugePageSize)
+			munmap(aligned + allocated, raw + HugePageSize - aligned);
+		ptr = aligned;
+	} else {
+		ptr = mmap(0, allocated, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			throw std::bad_alloc();
+	}
+	applied = Advise(ptr, allocated, policy);
+	if (policy & MemoryPolicy::Prefault) {
+		TouchPages(ptr, allocated);
+		applied |= MemoryPolicy::Prefault;
+	}
+	return static_cast<char*>(ptr);
+}
+
+void FreeMemory(char* ptr, size_t allocated)
+{
+	munmap(ptr, allocated);
+}
+
+}
+
+#else
+
+// None of the policies are supported here
+
+unsigned AdviseMemory(const void*, size_t, unsigned)
+{
+	return 0;
+}
+
+namespace Impl {
+
+char* AllocateMemory(size_t size, unsigned, size_t& allocated, unsigned& applied)
+{
+	allocated = 0;
+	applied = 0;
+	return new char[size];
+}
+
+void FreeMemory(char* ptr, size_t)
+{
+	delete [] ptr;
+}
+
+}
+
+#endif
+
+namespace Impl {
+
+#ifdef __linux__
+
+namespace {
+	// Calls f(n) for every number in a list like "0-3,8-11" (an empty list has none)
+	template<class F>
+	void ForEachInList(const std::string& list, F f)
+	{
+		size_t first = 0, num = 0;
+		bool range = false, digits = false;
+		for (size_t i = 0; i <= list.size(); ++i) {
+			char c = i < list.size() ? list[i] : ',';
+			if (c >= '0' && c <= '9') {
+				num = num * 10 + (c - '0');
+				digits = true;
+			} else if (c == '-') {
+				first = num;
+				num = 0;
+				range = true;
+			} else {
+				if (digits)
+					for (size_t n = range ? first : num; n <= num; ++n)
+						f(n);
+				num = 0;
+				range = false;
+				digits = false;
+			}
+		}
+	}
+
+	std::string ReadList(const std::string& filename)
+	{
+		std::ifstream file(filename.c_str());
+		std::string list;
+		file >> list;
+		return list;
+	}
+
+	// Which CPU belongs to which node, read from sysfs once.
+	// Only online nodes having CPUs count (memory-only and offline ones
+	// never run threads), and they are numbered densely from zero.
+	struct Topology {
+		size_t Nodes;
+		TVector<size_t> CpuNodes;
+
+		Topology(): Nodes(0)
+		{
+			ForEachInList(ReadList("/sys/devices/system/node/online"), [this](size_t node) {
+				bool cpus = false;
+				ForEachInList(ReadList("/sys/devices/system/node/node" + ToString(node) + "/cpulist"), [this, &cpus](size_t cpu) {
+					if (CpuNodes.size() <= cpu)
+						CpuNodes.resize(cpu + 1, 0);
+					CpuNodes[cpu] = Nodes;
+					cpus = true;
+				});
+				if (cpus)
+					++Nodes;
+			});
+			Nodes = ymax<size_t>(Nodes, 1);
+		}
+	};
+
+	const Topology& GetTopology()
+	{
+		static const Topology topology;
+		return topology;
+	}
+}
+
+size_t NumaNodesCount()
+{
+	return GetTopology().Nodes;
+}
+
+size_t CurrentNumaNode()
+{
+	// sched_getcpu() goes through the vDSO, unlike the getcpu system call
+	const Topology& topology = GetTopology();
+	int cpu = sched_getcpu();
+	return (cpu >= 0 && static_cast<size_t>(cpu) < topology.CpuNodes.size()) ? topology.CpuNodes[cpu] : 0;
+}
+
+#else
+
+size_t NumaNodesCount()
+{
+	return 1;
+}
+
+size_t CurrentNumaNode()
+{
+	return 0;
+}
+
+#endif
+
+}
+
+}
@@ -0,0 +1,89 @@
+/*
+ * memory_policy.h -- placement of large scanner tables in memory
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_MEMORY_POLICY_H
+#define PIRE_MEMORY_POLICY_H
+
+#include <memory>
+#include "stub/defaults.h"
+
+namespace Pire {
+
+/**
+ * Flags telling how memory holding large transition tables should be
+ * allocated and kept. Random accesses to rows of a table of hundreds of
+ * megabytes mostly miss the TLB, which huge pages largely cure.
+ *
+ * Every flag is a request: functions taking a policy return
+ * the subset of flags which actually took effect.
+ */
+namespace MemoryPolicy {
+	enum {
+		HugePages         = 1, ///< Transparent huge pages (MADV_HUGEPAGE)
+		ExplicitHugePages = 2, ///< Reserved huge pages (MAP_HUGETLB), falling back to HugePages
+		Prefault          = 4, ///< Bring all pages into memory at once (MAP_POPULATE, MADV_WILLNEED)
+		Lock              = 8  ///< Keep all pages resident (mlock)
+	};
+}
+
+/// Applies the policy to an existing range of memory (e.g. an mmap()-ed file).
+/// ExplicitHugePages cannot be applied this way and is treated as HugePages.
+unsigned AdviseMemory(const void* ptr, size_t size, unsigned policy);
+
+namespace Impl {
+	/// Allocates at least `size' bytes according to the policy, setting `allocated'
+	/// to the amount to be passed to FreeMemory() and `applied' to the flags in effect
+	char* AllocateMemory(size_t size, unsigned policy, size_t& allocated, unsigned& applied);
+	void FreeMemory(char* ptr, size_t allocated);
+
+	/// The number of online NUMA nodes having CPUs (1 where this is unknown)
+	size_t NumaNodesCount();
+	/// The NUMA node the calling thread is running on right now,
+	/// numbered among the nodes counted by NumaNodesCount()
+	size_t CurrentNumaNode();
+
+	/// A deleter for buffers which are either new[]-ed or allocated by AllocateMemory()
+	struct BufferDeleter {
+		size_t Allocated;
+
+		BufferDeleter(size_t allocated = 0): Allocated(allocated) {}
+
+		void operator()(char* ptr) const
+		{
+			if (Allocated)
+				FreeMemory(ptr, Allocated);
+			else
+				delete [] ptr;
+		}
+	};
+
+	/// Scanner tables, shared by all copies of a scanner and never modified
+	/// once the scanner is built
+	typedef std::shared_ptr<char> SharedBuffer;
+
+	inline SharedBuffer NewBuffer(size_t size) { return SharedBuffer(new char[size], BufferDeleter()); }
+}
+
+}
+
+#endif
@@ -75,7 +75,12 @@ namespace Pire {
 
 			TVector<size_t>& stateClass = task.GetStateClass();
 
+			// Where each state is in classStates of its class, so that splitting
+			// a few states off a large class does not take a pass over all of it
+			TVector<size_t> statePosition(task.Size());
+
 			for (size_t state = 0; state < task.Size(); ++state) {
+				statePosition[state] = classStates[stateClass[state]].size();
 				classStates[stateClass[state]].push_back(state);
 			}
 
@@ -117,19 +122,16 @@ namespace Pire {
 					const auto newClass = task.GetClassesNumber()++;
 					classChange[splittedClass] = newClass;
 					std::swap(classStates[newClass], removedStates[splittedClass]);
-					for (const auto& state : classStates[newClass]) {
+					auto& remainingStates = classStates[splittedClass];
+					for (size_t i = 0; i < classStates[newClass].size(); ++i) {
+						const auto state = classStates[newClass][i];
 						stateClass[state] = newClass;
+						statePosition[remainingStates.back()] = statePosition[state];
+						remainingStates[statePosition[state]] = remainingStates.back();
+						remainingStates.pop_back();
+						statePosition[state] = i;
 					}
 
-					auto iter = classStates[splittedClass].begin();
-					for (const auto state : classStates[splittedClass]) {
-						if (stateClass[state] == splittedClass) {
-							*iter = state;
-							++iter;
-						}
-					}
-					classStates[splittedClass].erase(iter, classStates[splittedClass].end());
-
 					for (size_t letter = 0; letter < task.LettersCount(); ++letter) {
 						if (queuedClasses[splittedClass][letter]
 							|| classStates[splittedClass].size() > classStates[newClass].size()) {
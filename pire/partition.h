@@ -51,6 +51,20 @@ public:
 		DoAppend(m_set, t);
 	}
 
+	/// Appends an item into the class of @p representative, bypassing the equivalence relation;
+	/// an item being its own representative starts a new class. Used to restore saved partitions.
+	void AppendTo(const T& representative, const T& t) {
+		if (representative == t) {
+			m_set.insert(ymake_pair(t, ymake_pair(m_maxidx++, TVector<T>(1, t))));
+		} else {
+			auto it = m_set.find(representative);
+			if (it == m_set.end())
+				throw Error("Partition::AppendTo(): attempted to append to a nonexistent class");
+			it->second.second.push_back(t);
+		}
+		m_inv[t] = representative;
+	}
+
 	typedef typename Set::const_iterator ConstIterator;
 
 	ConstIterator Begin() const {
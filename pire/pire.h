@@ -35,5 +35,15 @@
 #include "scanners/simple.h"
 #include "scanners/slow.h"
 #include "scanners/pair.h"
+#include "scanners/stride.h"
+#include "scanners/fixed.h"
+#include "scanners/replicated.h"
+
+#include "archive.h"
+#include "memory_policy.h"
+#include "registry.h"
+#include "literals.h"
+#include "compile_service.h"
+#include "scanner_cache.h"
 
 #endif
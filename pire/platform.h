@@ -126,12 +126,27 @@ struct BasicInstructionSet {
 	static inline Vector Or(Vector mask1, Vector mask2) { return (mask1 | mask2); }
 
 	static inline bool IsAnySet(Vector mask) { return (mask != 0); }
+
+	// Check whether any byte of the chunk belongs to the character class
+	// given by its low and high nibble tables (see IsAnyInClass() below)
+	template<class AnyVector>
+	static inline bool IsAnyInClass(const ui8* lo, const ui8* hi, AnyVector chunk)
+	{
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(&chunk);
+		for (size_t i = 0; i != sizeof(AnyVector); ++i)
+			if (lo[p[i] & 0x0F] & hi[p[i] >> 4])
+				return true;
+		return false;
+	}
 };
 
 }}
 
 #if defined(__SSE2__)
 #include <emmintrin.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 namespace Pire {
 namespace Impl {
@@ -154,6 +169,18 @@ struct AvailSSE2 {
 	{
 		return _mm_movemask_epi8(mask);
 	}
+
+	static inline bool IsAnyInClass(const ui8* lo, const ui8* hi, Vector chunk)
+	{
+#if defined(__SSSE3__)
+		const Vector nibble = _mm_set1_epi8(0x0F);
+		Vector l = _mm_shuffle_epi8(_mm_loadu_si128((const Vector*) lo), _mm_and_si128(chunk, nibble));
+		Vector h = _mm_shuffle_epi8(_mm_loadu_si128((const Vector*) hi), _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128())) != 0xFFFF;
+#else
+		return BasicInstructionSet::IsAnyInClass(lo, hi, chunk);
+#endif
+	}
 };
 
 typedef AvailSSE2 AvailInstructionSet;
@@ -191,6 +218,11 @@ struct AvailMMX {
 		mmxMask = mask;
 		return ui64Mask;
 	}
+
+	static inline bool IsAnyInClass(const ui8* lo, const ui8* hi, Vector chunk)
+	{
+		return BasicInstructionSet::IsAnyInClass(lo, hi, chunk);
+	}
 };
 
 typedef AvailMMX AvailInstructionSet;
@@ -221,6 +253,12 @@ inline Word Or(Word mask1, Word mask2) { return AvailInstructionSet::Or(mask1, m
 
 inline bool IsAnySet(Word mask) { return AvailInstructionSet::IsAnySet(mask); }
 
+// Checks whether any byte of the chunk belongs to a character class given by two
+// 16-entry tables indexed by the low and the high nibble of a byte: the byte c
+// belongs to the class iff (lo[c & 0x0F] & hi[c >> 4]) != 0.
+// Uses a pair of byte shuffles when SSSE3 is available, and a byte loop otherwise.
+inline bool IsAnyInClass(const ui8* lo, const ui8* hi, Word chunk) { return AvailInstructionSet::IsAnyInClass(lo, hi, chunk); }
+
 // MaxSizeWord type is largest integer type supported by the plaform including
 // all possible SSE extensions that are are known for this platform (even if these
 // extensions are not available at compile time)
@@ -252,6 +290,31 @@ inline size_t FillSizeT(char c)
 	return w;
 }
 
+// Returns the index of the lowest set bit in a non-zero word
+inline size_t LowestSetBit(ui64 w)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(w);
+#else
+	size_t i = 0;
+	for (; !(w & 1); w >>= 1)
+		++i;
+	return i;
+#endif
+}
+
+inline size_t PopCount(ui64 w)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(w);
+#else
+	size_t n = 0;
+	for (; w; w &= w - 1)
+		++n;
+	return n;
+#endif
+}
+
 }}
 
 #endif
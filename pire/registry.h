@@ -0,0 +1,209 @@
+/*
+ * registry.h -- a registry of scanners replaceable while in use
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_REGISTRY_H
+#define PIRE_REGISTRY_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "stub/stl.h"
+#include "stub/defaults.h"
+#include "stub/noncopyable.h"
+
+namespace Pire {
+
+namespace Impl {
+	/// A small number identifying the calling thread, assigned on first use
+	size_t RegistryReaderSlot();
+}
+
+/**
+ * Holds the current version of a scanner, which can be replaced
+ * at any time while other threads keep running the previous ones.
+ *
+ * Writers compile (or Mmap()) a new scanner and Publish() it. Readers
+ * Acquire() a Snapshot, which pins the version current at that moment:
+ * its scanner (and the storage it may have been mapped from) stays valid
+ * until the snapshot is destroyed, however many versions are published
+ * meanwhile.
+ *
+ * Acquiring and releasing a snapshot takes no locks: it increments and
+ * decrements a reader counter in a slot of the calling thread (slots are
+ * shared by threads only when there are more threads than slots) and
+ * loads the current version. Writers are serialized and never wait for
+ * readers: replaced versions are destroyed by later Publish() or Reclaim()
+ * calls, once a grace period has passed and no reader can hold them.
+ */
+template<class Scanner>
+class ScannerRegistry: public NonCopyable {
+private:
+	struct Entry {
+		Scanner scanner;
+		size_t number;
+		std::shared_ptr<const void> storage;
+		size_t retiredAt; ///< The phase the entry was replaced in
+
+		Entry(const Scanner& sc, size_t num, const std::shared_ptr<const void>& st)
+			: scanner(sc), number(num), storage(st), retiredAt(0) {}
+	};
+
+	enum { SlotsCount = 64 };
+
+	/// Reader counters for the two phases, one cache line per slot
+	struct Slot {
+		std::atomic<size_t> readers[2];
+		char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+	};
+
+public:
+	/// A pinned version of the scanner
+	class Snapshot {
+	public:
+		Snapshot(Snapshot&& s): m_entry(s.m_entry), m_counter(s.m_counter)
+		{
+			s.m_counter = 0;
+		}
+
+		~Snapshot()
+		{
+			if (m_counter)
+				m_counter->fetch_sub(1, std::memory_order_release);
+		}
+
+		const Scanner& GetScanner() const { return m_entry->scanner; }
+		const Scanner& operator * () const { return m_entry->scanner; }
+		const Scanner* operator -> () const { return &m_entry->scanner; }
+
+		/// The number Publish() returned for this version (0 for the initial empty one)
+		size_t Version() const { return m_entry->number; }
+
+	private:
+		Snapshot(const Entry* entry, std::atomic<size_t>* counter): m_entry(entry), m_counter(counter) {}
+
+		Snapshot(const Snapshot&);
+		Snapshot& operator = (const Snapshot&);
+
+		const Entry* m_entry;
+		std::atomic<size_t>* m_counter;
+
+		friend class ScannerRegistry;
+	};
+
+	/// Starts with an empty scanner as version 0
+	ScannerRegistry()
+		: m_phase(0)
+		, m_slots(new Slot[SlotsCount])
+		, m_number(0)
+	{
+		for (size_t i = 0; i != SlotsCount; ++i)
+			for (size_t p = 0; p != 2; ++p)
+				m_slots[i].readers[p].store(0, std::memory_order_relaxed);
+		m_current.store(new Entry(Scanner(), 0, std::shared_ptr<const void>()), std::memory_order_release);
+	}
+
+	/// All snapshots must be destroyed by now
+	~ScannerRegistry()
+	{
+		for (auto&& entry : m_retired)
+			delete entry;
+		delete m_current.load(std::memory_order_relaxed);
+	}
+
+	Snapshot Acquire() const
+	{
+		Slot& slot = m_slots[Impl::RegistryReaderSlot() % SlotsCount];
+		std::atomic<size_t>* counter = &slot.readers[m_phase.load(std::memory_order_acquire) & 1];
+		counter->fetch_add(1, std::memory_order_seq_cst);
+		return Snapshot(m_current.load(std::memory_order_seq_cst), counter);
+	}
+
+	/**
+	 * Makes the scanner current and returns the number of its version.
+	 * The storage is kept until the version is destroyed; pass the memory
+	 * an Mmap()-ed scanner is built on here (with a deleter releasing it).
+	 */
+	size_t Publish(const Scanner& scanner, std::shared_ptr<const void> storage = std::shared_ptr<const void>())
+	{
+		std::lock_guard<std::mutex> lock(m_writer);
+		std::unique_ptr<Entry> entry(new Entry(scanner, m_number + 1, storage));
+		m_retired.reserve(m_retired.size() + 1);
+		Entry* old = m_current.exchange(entry.release(), std::memory_order_seq_cst);
+		old->retiredAt = m_phase.load(std::memory_order_relaxed);
+		m_retired.push_back(old);
+		DoReclaim();
+		return ++m_number;
+	}
+
+	/// Destroys the replaced versions no reader holds any more,
+	/// returning the number of those still waiting
+	size_t Reclaim()
+	{
+		std::lock_guard<std::mutex> lock(m_writer);
+		return DoReclaim();
+	}
+
+	/// The number of the current version
+	size_t CurrentVersion() const { return m_current.load(std::memory_order_acquire)->number; }
+
+private:
+	/// Readers count themselves in the current phase. Once the counters of
+	/// the other phase drop to zero, the phase is advanced, so they are never
+	/// waiting for newcomers. A reader holding an entry has incremented its
+	/// counter before the entry was replaced, so after two advances following
+	/// the replacement (each seeing one of the counters drained) it is gone.
+	bool TryAdvance()
+	{
+		size_t phase = m_phase.load(std::memory_order_relaxed);
+		size_t other = (phase + 1) & 1;
+		for (size_t s = 0; s != SlotsCount; ++s)
+			if (m_slots[s].readers[other].load(std::memory_order_seq_cst))
+				return false;
+		m_phase.store(phase + 1, std::memory_order_seq_cst);
+		return true;
+	}
+
+	size_t DoReclaim()
+	{
+		for (size_t i = 0; i != 2 && !m_retired.empty() && m_phase.load(std::memory_order_relaxed) < m_retired.back()->retiredAt + 2; ++i)
+			if (!TryAdvance())
+				break;
+		size_t phase = m_phase.load(std::memory_order_relaxed);
+		auto end = m_retired.begin();
+		for (; end != m_retired.end() && phase >= (*end)->retiredAt + 2; ++end)
+			delete *end;
+		m_retired.erase(m_retired.begin(), end);
+		return m_retired.size();
+	}
+
+	std::atomic<Entry*> m_current;
+	std::atomic<size_t> m_phase;
+	std::unique_ptr<Slot[]> m_slots;
+	std::mutex m_writer;
+	size_t m_number;
+	TVector<Entry*> m_retired; ///< In the order of replacement
+};
+
+}
+
+#endif
@@ -29,6 +29,7 @@
 #include "stub/memstreams.h"
 #include "scanners/pair.h"
 #include "platform.h"
+#include "align.h"
 
 namespace Pire {
 
@@ -150,6 +151,51 @@ namespace Impl {
 		return Continue;
 	}
 	
+	/// The same as SafeRunChunk(), but processes the bytes from the highest address to the lowest one.
+	/// The predicate is given a pointer to the byte preceding the one just consumed.
+	template<class Scanner, class Pred>
+	PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action SafeRunChunkReverse(const Scanner& scanner, typename Scanner::State& state, const size_t* p, size_t pos, size_t size, Pred pred)
+	{
+		Y_ASSERT(pos <= sizeof(size_t));
+		Y_ASSERT(size <= sizeof(size_t));
+		Y_ASSERT(pos + size <= sizeof(size_t));
+
+		const char* ptr = (const char*) p + pos + size;
+		for (; size--;) {
+			--ptr;
+			Step(scanner, state, (unsigned char) *ptr);
+			if (pred(scanner, state, ptr - 1) == Stop)
+				return Stop;
+		}
+		return Continue;
+	}
+
+	/// The same as RunChunk(), but processes the bytes from the highest address to the lowest one.
+	template<class Scanner, class Pred>
+	PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action RunChunkReverse(const Scanner& scanner, typename Scanner::State& state, const size_t* p, size_t pos, size_t size, Pred pred)
+	{
+		Y_ASSERT(pos <= sizeof(size_t));
+		Y_ASSERT(size <= sizeof(size_t));
+		Y_ASSERT(pos + size <= sizeof(size_t));
+
+		if (PIRE_UNLIKELY(size == 0))
+			return Continue;
+
+		size_t chunk = Impl::ToLittleEndian(*p) << 8*(sizeof(size_t) - pos - size);
+		const char* ptr = (const char*) p + pos - 1;
+
+		for (size_t i = size; i != 0; --i) {
+			Step(scanner, state, chunk >> 8*(sizeof(size_t) - 1));
+			if (pred(scanner, state, ptr + i - 1) == Stop)
+				return Stop;
+			chunk <<= 8;
+		}
+
+		return Continue;
+	}
+
 	template<class Scanner>
 	struct AlignedRunner {
 
@@ -166,6 +212,19 @@ namespace Impl {
 			return ret;
 		}
 
+		// Runs through the words in [begin, end) from the last one to the first one
+		template<class Pred>
+		static inline PIRE_HOT_FUNCTION
+		Action RunAlignedReverse(const Scanner& scanner, typename Scanner::State& state, const size_t* begin, const size_t* end, Pred stop)
+		{
+			typename Scanner::State st = state;
+			Action ret = Continue;
+			for (; end != begin && (ret = RunChunkReverse(scanner, st, end - 1, 0, sizeof(void*), stop)) == Continue; --end)
+				;
+			state = st;
+			return ret;
+		}
+
 		// A special version for Run() impelementation that skips predicate checks
 		static inline PIRE_HOT_FUNCTION
 		Action RunAligned(const Scanner& scanner, typename Scanner::State& state, const size_t* begin, const size_t* end, RunPred<Scanner>)
@@ -185,7 +244,7 @@ namespace Impl {
 
 	/// The main function: runs a scanner through given memory range.
 	template<class Scanner, class Pred>
-	inline void DoRun(const Scanner& scanner, typename Scanner::State& st, const char* begin, const char* end, Pred pred)
+	inline Action DoRun(const Scanner& scanner, typename Scanner::State& st, const char* begin, const char* end, Pred pred)
 	{
 		const size_t* head = reinterpret_cast<const size_t*>((reinterpret_cast<uintptr_t>(begin)) & ~(sizeof(size_t)-1));
 		const size_t* tail = reinterpret_cast<const size_t*>((reinterpret_cast<uintptr_t>(end)) & ~(sizeof(size_t)-1));
@@ -196,10 +255,8 @@ namespace Impl {
 		Y_ASSERT(headSize >= 1 && headSize <= sizeof(size_t));
 		Y_ASSERT(tailSize < sizeof(size_t));
 
-		if (head == tail) {
-			Impl::SafeRunChunk(scanner, st, head, sizeof(size_t) - headSize, end - begin, pred);
-			return;
-		}
+		if (head == tail)
+			return Impl::SafeRunChunk(scanner, st, head, sizeof(size_t) - headSize, end - begin, pred);
 
 		// st is passed by reference to this function. If we use it directly on each step the compiler will have to
 		// update it in memory because of pointer aliasing assumptions. Copying it into a local var allows the
@@ -209,22 +266,66 @@ namespace Impl {
 		if (begin != (const char*) head) {
 			if (Impl::RunChunk(scanner, state, head, sizeof(size_t) - headSize, headSize, pred) == Stop) {
 				st = state;
-				return;
+				return Stop;
 			}
 			++head;
 		}
 
 		if (Impl::AlignedRunner<Scanner>::RunAligned(scanner, state, head, tail, pred) == Stop) {
 			st = state;
-			return;
+			return Stop;
 		}
 
+		Action ret = Continue;
 		if (tailSize)
-			Impl::SafeRunChunk(scanner, state, tail, 0, tailSize, pred);
+			ret = Impl::SafeRunChunk(scanner, state, tail, 0, tailSize, pred);
 
 		st = state;
+		return ret;
 	}
 
+
+	/// Runs a scanner backwards through the bytes in (rend, rbegin], starting from @p rbegin.
+	/// The predicate is given a pointer to the byte right before the one just consumed,
+	/// which is the convention of LongestSuffix() and ShortestSuffix().
+	template<class Scanner, class Pred>
+	inline Action DoRunReverse(const Scanner& scanner, typename Scanner::State& st, const char* rbegin, const char* rend, Pred pred)
+	{
+		const char* begin = rend + 1;
+		const char* end = rbegin + 1;
+		if (begin >= end)
+			return Continue;
+
+		const size_t* head = reinterpret_cast<const size_t*>((reinterpret_cast<uintptr_t>(begin)) & ~(sizeof(size_t)-1));
+		const size_t* tail = reinterpret_cast<const size_t*>((reinterpret_cast<uintptr_t>(end)) & ~(sizeof(size_t)-1));
+
+		size_t headSize = ((const char*) head + sizeof(size_t) - begin); // The distance from @p begin to the end of the word containing @p begin
+		size_t tailSize = end - (const char*) tail; // The distance from the beginning of the word containing @p end to the @p end
+
+		if (head == tail)
+			return Impl::SafeRunChunkReverse(scanner, st, head, sizeof(size_t) - headSize, end - begin, pred);
+
+		typename Scanner::State state = st;
+
+		if (tailSize && Impl::SafeRunChunkReverse(scanner, state, tail, 0, tailSize, pred) == Stop) {
+			st = state;
+			return Stop;
+		}
+
+		if (begin != (const char*) head)
+			++head;
+		if (Impl::AlignedRunner<Scanner>::RunAlignedReverse(scanner, state, head, tail, pred) == Stop) {
+			st = state;
+			return Stop;
+		}
+
+		Action ret = Continue;
+		if (begin != (const char*) head)
+			ret = Impl::SafeRunChunkReverse(scanner, state, head - 1, sizeof(size_t) - headSize, headSize, pred);
+
+		st = state;
+		return ret;
+	}
 }
 
 /// Runs two scanners through given memory range simultaneously.
@@ -245,14 +346,14 @@ inline void Run(const Scanner1& scanner1, const Scanner2& scanner2, typename Sca
 namespace Impl {
 	/// A debug version of all Run() methods.
 	template<class Scanner, class Pred>
-	inline void DoRun(const Scanner& scanner, typename Scanner::State& state, const char* begin, const char* end, Pred pred)
+	inline Action DoRun(const Scanner& scanner, typename Scanner::State& state, const char* begin, const char* end, Pred pred)
 	{
 		Cdbg << "Running regexp on string " << ystring(begin, ymin(end - begin, static_cast<ptrdiff_t>(100u))) << Endl;
 		Cdbg << "Initial state " << StDump(scanner, state) << Endl;
 
 		if (pred(scanner, state, begin) == Stop) {
 			Cdbg << " exiting" << Endl;
-			return;
+			return Stop;
 		}
 
 		for (; begin != end; ++begin) {
@@ -260,9 +361,28 @@ namespace Impl {
 			Cdbg << *begin << " => state " << StDump(scanner, state) << Endl;
 			if (pred(scanner, state, begin + 1) == Stop) {
 				Cdbg << " exiting" << Endl;
-				return;
+				return Stop;
 			}
 		}
+		return Continue;
+	}
+
+	/// A debug version of DoRunReverse().
+	template<class Scanner, class Pred>
+	inline Action DoRunReverse(const Scanner& scanner, typename Scanner::State& state, const char* rbegin, const char* rend, Pred pred)
+	{
+		Cdbg << "Running regexp backwards on string " << ystring(rbegin - ymin(rbegin - rend, static_cast<ptrdiff_t>(100u)) + 1, rbegin + 1) << Endl;
+		Cdbg << "Initial state " << StDump(scanner, state) << Endl;
+
+		for (; rbegin > rend; --rbegin) {
+			Step(scanner, state, (unsigned char)*rbegin);
+			Cdbg << *rbegin << " => state " << StDump(scanner, state) << Endl;
+			if (pred(scanner, state, rbegin - 1) == Stop) {
+				Cdbg << " exiting" << Endl;
+				return Stop;
+			}
+		}
+		return Continue;
 	}
 }
 
@@ -310,6 +430,177 @@ const char* ShortestPrefix(const Scanner& sc, const char* begin, const char* end
 	return pos;
 }
 
+
+/// A piece of non-contiguous input. The layout matches POSIX struct iovec,
+/// so an array of iovecs can be passed in via reinterpret_cast.
+struct IoVec {
+	const void* iov_base;
+	size_t iov_len;
+};
+
+namespace Impl {
+
+	/// Runs a scanner through a chain of fragments as if they were one contiguous string.
+	/// Fragments long enough to benefit from the word-at-a-time loop are scanned in place;
+	/// short ones are gathered into an aligned staging buffer first, so a chain of tiny
+	/// pieces is still scanned in whole words. Positions reported by the predicate
+	/// while scanning the staging buffer are translated back into the original fragments.
+	template<class Scanner, class Pred>
+	class FragmentRunner {
+	public:
+		FragmentRunner(const Scanner& scanner, typename Scanner::State& state, Pred pred, const char** pos = 0)
+			: m_scanner(&scanner)
+			, m_state(&state)
+			, m_pred(pred)
+			, m_pos(pos)
+			, m_stage(AlignUp(m_buf, sizeof(MaxSizeWord)))
+			, m_size(0)
+			, m_segments(0)
+		{}
+
+		Action Run(const IoVec* begin, const IoVec* end)
+		{
+			for (; begin != end; ++begin) {
+				const char* ptr = static_cast<const char*>(begin->iov_base);
+				if (Feed(ptr, ptr + begin->iov_len) == Stop)
+					return Stop;
+			}
+			return Flush();
+		}
+
+	private:
+		enum {
+			StageSize = 256,
+			InPlaceThreshold = StageSize / 4
+		};
+
+		struct Segment {
+			size_t Offset;
+			const char* Origin;
+		};
+
+		const Scanner* m_scanner;
+		typename Scanner::State* m_state;
+		Pred m_pred;
+		const char** m_pos;
+		char m_buf[StageSize + sizeof(MaxSizeWord)];
+		char* m_stage;
+		size_t m_size;
+		Segment m_segs[StageSize];
+		size_t m_segments;
+
+		Action Feed(const char* begin, const char* end)
+		{
+			size_t size = end - begin;
+			if (!size)
+				return Continue;
+			if (size >= InPlaceThreshold) {
+				if (Flush() == Stop)
+					return Stop;
+				return DoRun(*m_scanner, *m_state, begin, end, m_pred);
+			}
+			if (m_size + size > StageSize && Flush() == Stop)
+				return Stop;
+			m_segs[m_segments].Offset = m_size;
+			m_segs[m_segments].Origin = begin;
+			++m_segments;
+			memcpy(m_stage + m_size, begin, size);
+			m_size += size;
+			return Continue;
+		}
+
+		Action Flush()
+		{
+			if (!m_size)
+				return Continue;
+			Action ret = DoRun(*m_scanner, *m_state, m_stage, m_stage + m_size, m_pred);
+			if (m_pos && *m_pos >= m_stage && *m_pos <= m_stage + m_size)
+				*m_pos = Translate(*m_pos - m_stage);
+			m_size = 0;
+			m_segments = 0;
+			return ret;
+		}
+
+		/// Maps an offset within the staging buffer to the fragment it came from.
+		/// An offset on the boundary of two fragments maps to the end of the former one.
+		const char* Translate(size_t offset) const
+		{
+			size_t i = m_segments - 1;
+			while (i && m_segs[i].Offset >= offset)
+				--i;
+			return m_segs[i].Origin + (offset - m_segs[i].Offset);
+		}
+	};
+
+	/// Returns the position of the first byte of the fragment chain
+	inline const char* FragmentsBegin(const IoVec* begin, const IoVec* end)
+	{
+		for (const IoVec* i = begin; i != end; ++i)
+			if (i->iov_len)
+				return static_cast<const char*>(i->iov_base);
+		return begin != end ? static_cast<const char*>(begin->iov_base) : 0;
+	}
+
+	/// Returns the position right after the last byte of the fragment chain
+	inline const char* FragmentsEnd(const IoVec* begin, const IoVec* end)
+	{
+		for (const IoVec* i = end; i != begin; --i)
+			if (i[-1].iov_len)
+				return static_cast<const char*>(i[-1].iov_base) + i[-1].iov_len;
+		return FragmentsBegin(begin, end);
+	}
+}
+
+/// Runs a scanner through a chain of non-contiguous fragments.
+/// The result is the same as if the fragments were concatenated and passed to Run().
+template<class Scanner>
+void Run(const Scanner& sc, typename Scanner::State& st, const IoVec* begin, const IoVec* end)
+{
+	typedef Impl::RunPred<Scanner> Pred;
+	Impl::FragmentRunner<Scanner, Pred>(sc, st, Pred()).Run(begin, end);
+}
+
+/// LongestPrefix() over a chain of fragments. The returned pointer
+/// points into the fragment where the longest match ends.
+template<class Scanner>
+const char* LongestPrefix(const Scanner& sc, const IoVec* begin, const IoVec* end, bool throughBeginMark = false, bool throughEndMark = false)
+{
+	typedef Impl::LongestPrefixPred<Scanner> Pred;
+	typename Scanner::State st;
+	sc.Initialize(st);
+	if (throughBeginMark)
+		Pire::Step(sc, st, BeginMark);
+	const char* pos = (sc.Final(st) ? Impl::FragmentsBegin(begin, end) : 0);
+	Impl::FragmentRunner<Scanner, Pred>(sc, st, Pred(pos), &pos).Run(begin, end);
+	if (throughEndMark) {
+		Pire::Step(sc, st, EndMark);
+		if (sc.Final(st))
+			pos = Impl::FragmentsEnd(begin, end);
+	}
+	return pos;
+}
+
+/// ShortestPrefix() over a chain of fragments. The returned pointer
+/// points into the fragment where the shortest match ends.
+template<class Scanner>
+const char* ShortestPrefix(const Scanner& sc, const IoVec* begin, const IoVec* end, bool throughBeginMark = false, bool throughEndMark = false)
+{
+	typedef Impl::ShortestPrefixPred<Scanner> Pred;
+	typename Scanner::State st;
+	sc.Initialize(st);
+	if (throughBeginMark)
+		Pire::Step(sc, st, BeginMark);
+	if (sc.Final(st))
+		return Impl::FragmentsBegin(begin, end);
+	const char* pos = 0;
+	Impl::FragmentRunner<Scanner, Pred>(sc, st, Pred(pos), &pos).Run(begin, end);
+	if (throughEndMark) {
+		Pire::Step(sc, st, EndMark);
+		if (sc.Final(st) && pos == 0)
+			pos = Impl::FragmentsEnd(begin, end);
+	}
+	return pos;
+}
 	
 /// The same as above, but scans string in reverse direction
 /// (consider using Fsm::Reverse() for using in this function).
@@ -320,23 +611,12 @@ inline const char* LongestSuffix(const Scanner& scanner, const char* rbegin, con
 	scanner.Initialize(state);
 	if (throughEndMark)
 		Step(scanner, state, EndMark);
-	PIRE_IFDEBUG(Cdbg << "Running LongestSuffix on string " << ystring(rbegin - ymin(rbegin - rend, static_cast<ptrdiff_t>(100u)) + 1, rbegin + 1) << Endl);
-	PIRE_IFDEBUG(Cdbg << "Initial state " << StDump(scanner, state) << Endl);
-
-	const char* pos = 0;
-	while (rbegin != rend && !scanner.Dead(state)) {
-		if (scanner.Final(state))
-			pos = rbegin;
-		Step(scanner, state, (unsigned char)*rbegin);
-		PIRE_IFDEBUG(Cdbg << *rbegin << " => state " << StDump(scanner, state) << Endl);
-		--rbegin;
-	}
-	if (scanner.Final(state))
-		pos = rbegin;
+	const char* pos = (scanner.Final(state) ? rbegin : 0);
+	Impl::DoRunReverse(scanner, state, rbegin, rend, Impl::LongestPrefixPred<Scanner>(pos));
 	if (throughBeginMark) {
 		Step(scanner, state, BeginMark);
 		if (scanner.Final(state))
-			pos = rbegin;
+			pos = rend;
 	}
 	return pos;
 }
@@ -349,16 +629,14 @@ inline const char* ShortestSuffix(const Scanner& scanner, const char* rbegin, co
 	scanner.Initialize(state);
 	if (throughEndMark)
 		Step(scanner, state, EndMark);
-	PIRE_IFDEBUG(Cdbg << "Running ShortestSuffix on string " << ystring(rbegin - ymin(rbegin - rend, static_cast<ptrdiff_t>(100u)) + 1, rbegin + 1) << Endl);
-	PIRE_IFDEBUG(Cdbg << "Initial state " << StDump(scanner, state) << Endl);
-
-	for (; rbegin != rend && !scanner.Final(state) && !scanner.Dead(state); --rbegin) {
-		scanner.Next(state, (unsigned char)*rbegin);
-		PIRE_IFDEBUG(Cdbg << *rbegin << " => state " << StDump(scanner, state) << Endl);
-	}
+	const char* pos = 0;
+	if (scanner.Final(state))
+		pos = rbegin;
+	else if (Impl::DoRunReverse(scanner, state, rbegin, rend, Impl::ShortestPrefixPred<Scanner>(pos)) == Impl::Continue)
+		pos = rend;
 	if (throughBeginMark)
 		Step(scanner, state, BeginMark);
-	return scanner.Final(state) ? rbegin : 0;
+	return scanner.Final(state) ? pos : 0;
 }
 
 
@@ -372,6 +650,7 @@ public:
 	RunHelper<Scanner>& Run(const char* begin, const char* end) { Pire::Run(*Sc, St, begin, end); return *this; }
 	RunHelper<Scanner>& Run(const char* str, size_t size) { return Run(str, str + size); }
 	RunHelper<Scanner>& Run(const ystring& str) { return Run(str.c_str(), str.c_str() + str.size()); }
+	RunHelper<Scanner>& Run(const IoVec* begin, const IoVec* end) { Pire::Run(*Sc, St, begin, end); return *this; }
 	RunHelper<Scanner>& Begin() { return Step(BeginMark); }
 	RunHelper<Scanner>& End() { return Step(EndMark); }
 
@@ -0,0 +1,219 @@
+/*
+ * scanner_cache.cpp -- storing and evicting cached scanners
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+
+#include "scanner_cache.h"
+#include "scanners/fixed.h"
+#include "stub/lexical_cast.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#else
+#include <direct.h>
+#include <process.h>
+#endif
+
+namespace Pire {
+
+namespace {
+	const char Suffix[] = ".pire";
+	const char TempSuffix[] = ".tmp";
+
+	/// Temporary files older than that belong to crashed writers
+	const time_t TempLifetime = 3600;
+
+	const char KeyEntry[] = "key";
+	const char ScannerEntry[] = "scanner";
+
+	bool EndsWith(const ystring& str, const char* suffix)
+	{
+		size_t len = strlen(suffix);
+		return str.size() > len && str.compare(str.size() - len, len, suffix) == 0;
+	}
+
+	ystring Hex(ui64 value, size_t digits)
+	{
+		static const char Digits[] = "0123456789abcdef";
+		ystring str(digits, '0');
+		for (size_t i = digits; i != 0; --i, value >>= 4)
+			str[i - 1] = Digits[value & 0xF];
+		return str;
+	}
+}
+
+CacheKey& CacheKey::Add(const ystring& str)
+{
+	Add(static_cast<ui64>(str.size()));
+	m_data += str;
+	return *this;
+}
+
+CacheKey& CacheKey::Add(ui64 number)
+{
+	for (size_t i = 0; i != sizeof(number); ++i, number >>= 8)
+		m_data += static_cast<char>(number & 0xFF);
+	return *this;
+}
+
+ystring CacheKey::Digest() const
+{
+	// FNV-1a and CRC32C together; a collision is harmless anyway,
+	// since files are checked against the full key
+	ui64 fnv = 14695981039346656037ULL;
+	for (auto&& c : m_data)
+		fnv = (fnv ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+	return Hex(fnv, 16) + Hex(Impl::Crc32c(m_data.data(), m_data.size()), 8);
+}
+
+ScannerCache::ScannerCache(const ystring& directory, size_t maxBytes, bool verify)
+	: m_directory(directory)
+	, m_maxBytes(maxBytes)
+	, m_verify(verify)
+{
+#ifndef _WIN32
+	if (mkdir(directory.c_str(), 0777) == -1 && errno != EEXIST)
+#else
+	if (_mkdir(directory.c_str()) == -1 && errno != EEXIST)
+#endif
+		throw Error("Pire::ScannerCache: cannot create " + directory + ": " + strerror(errno));
+}
+
+ystring ScannerCache::Path(const CacheKey& key) const
+{
+	return m_directory + "/" + key.Digest() + Suffix;
+}
+
+std::shared_ptr<const void> ScannerCache::Load(const CacheKey& key, ypair<const void*, size_t>& image) const
+{
+	ystring path = Path(key);
+	std::shared_ptr<MappedArchive> archive;
+	try {
+		archive.reset(new MappedArchive(path.c_str()));
+		ypair<const void*, size_t> stored = archive->Get(KeyEntry, true);
+		if (stored.second != key.Data().size() || memcmp(stored.first, key.Data().data(), stored.second))
+			return std::shared_ptr<const void>();
+		image = archive->Get(ScannerEntry, m_verify);
+	}
+	catch (Error&) {
+		return std::shared_ptr<const void>();
+	}
+#ifndef _WIN32
+	// Marks the file as recently used
+	utimensat(AT_FDCWD, path.c_str(), 0, 0);
+#endif
+	return archive;
+}
+
+void ScannerCache::Store(const CacheKey& key, const void* image, size_t size)
+{
+	static std::atomic<size_t> counter(0);
+#ifndef _WIN32
+	ystring temp = Path(key) + "." + ToString(getpid());
+#else
+	ystring temp = Path(key) + "." + ToString(_getpid());
+#endif
+	temp += "." + ToString(counter.fetch_add(1)) + TempSuffix;
+
+	ArchiveWriter writer;
+	writer.AddData(KeyEntry, key.Data().data(), key.Data().size());
+	writer.AddData(ScannerEntry, image, size);
+	{
+		std::ofstream file(temp.c_str(), std::ios::binary);
+		writer.Save(&file);
+		file.flush();
+		if (!file) {
+			file.close();
+			remove(temp.c_str());
+			return;
+		}
+	}
+	ystring path = Path(key);
+#ifdef _WIN32
+	// rename() does not replace existing files here
+	remove(path.c_str());
+#endif
+	if (rename(temp.c_str(), path.c_str()) != 0) {
+		remove(temp.c_str());
+		return;
+	}
+	if (m_maxBytes)
+		Evict();
+}
+
+#ifndef _WIN32
+
+size_t ScannerCache::Evict()
+{
+	DIR* dir = opendir(m_directory.c_str());
+	if (!dir)
+		return 0;
+	// Modification times with nanoseconds, paths and sizes
+	TVector< ypair< ypair<time_t, long>, ypair<ystring, size_t> > > files;
+	size_t total = 0;
+	time_t now = time(0);
+	while (struct dirent* entry = readdir(dir)) {
+		ystring path = m_directory + "/" + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if (EndsWith(entry->d_name, TempSuffix)) {
+			if (now - st.st_mtime > TempLifetime)
+				unlink(path.c_str());
+		} else if (EndsWith(entry->d_name, Suffix)) {
+			files.push_back(ymake_pair(ymake_pair(st.st_mtim.tv_sec, st.st_mtim.tv_nsec), ymake_pair(path, static_cast<size_t>(st.st_size))));
+			total += st.st_size;
+		}
+	}
+	closedir(dir);
+
+	if (m_maxBytes && total > m_maxBytes) {
+		std::sort(files.begin(), files.end());
+		for (auto i = files.begin(); i != files.end() && total > m_maxBytes; ++i)
+			if (unlink(i->second.first.c_str()) == 0)
+				total -= i->second.second;
+	}
+	return total;
+}
+
+#else
+
+// No directory scans here, so the size is not bounded
+size_t ScannerCache::Evict()
+{
+	return 0;
+}
+
+#endif
+
+}
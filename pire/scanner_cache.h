@@ -0,0 +1,164 @@
+/*
+ * scanner_cache.h -- an on-disk cache of compiled scanners
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNER_CACHE_H
+#define PIRE_SCANNER_CACHE_H
+
+#include <memory>
+#include <typeinfo>
+#include "archive.h"
+#include "stub/stl.h"
+#include "stub/defaults.h"
+#include "stub/saveload.h"
+#include "stub/memstreams.h"
+#include "stub/noncopyable.h"
+
+namespace Pire {
+
+/**
+ * Everything a scanner is compiled from: patterns, encoding, features,
+ * glue limits and so on, in a form which does not change between runs.
+ * Each value is stored with its length, so ("ab", "c") and ("a", "bc")
+ * make different keys.
+ */
+class CacheKey {
+public:
+	CacheKey& Add(const ystring& str);
+	CacheKey& Add(ui64 number);
+
+	template<class Iter>
+	CacheKey& Add(Iter begin, Iter end)
+	{
+		Add(static_cast<ui64>(std::distance(begin, end)));
+		for (; begin != end; ++begin)
+			Add(*begin);
+		return *this;
+	}
+
+	const ystring& Data() const { return m_data; }
+
+	/// A hash of the data, in hex
+	ystring Digest() const;
+
+private:
+	ystring m_data;
+};
+
+/// A scanner taken from a ScannerCache
+template<class Scanner>
+struct CachedScanner {
+	Scanner scanner;
+
+	/// The file the scanner is mmap()-ed from; keep it while the scanner
+	/// is in use (e.g. pass it to ScannerRegistry::Publish()).
+	/// Empty if the scanner has just been compiled.
+	std::shared_ptr<const void> storage;
+
+	bool hit;
+
+	CachedScanner(): hit(false) {}
+};
+
+/**
+ * Keeps compiled scanners in a directory, one file per key,
+ * so that processes compiling the same patterns again
+ * can mmap() the result instead.
+ *
+ * Any number of processes can share the directory. Files are written
+ * under temporary names and renamed into place, so readers never see
+ * a partial one; processes missing the same key at once compile it
+ * independently, and the last one wins. Files are checked against the
+ * full key, and unreadable ones count as misses.
+ *
+ * Scanner images are stored with checksums, but a hit only verifies them
+ * if asked to: that reads the whole file, while a hit otherwise faults in
+ * just the pages the scanner touches.
+ *
+ * When the directory grows beyond the size limit, least recently used
+ * files are removed (a hit updates the modification time of its file).
+ * Mappings of removed files stay valid in processes using them.
+ *
+ * Only scanners supporting Mmap() can be cached.
+ */
+class ScannerCache: public NonCopyable {
+public:
+	/// Creates the directory if needed. Zero size means no limit.
+	/// With verify set, hits check the checksum of the scanner image.
+	explicit ScannerCache(const ystring& directory, size_t maxBytes = 0, bool verify = false);
+
+	/**
+	 * Returns the scanner stored under the key, or calls compile()
+	 * and stores the scanner it returns. The type of the scanner is
+	 * added to the key. Failures to store the scanner are ignored.
+	 */
+	template<class Scanner, class Compile>
+	CachedScanner<Scanner> Get(const CacheKey& key, Compile compile);
+
+	/// Removes least recently used files until the total size fits the limit,
+	/// along with temporary files left by crashed writers. Returns the size.
+	size_t Evict();
+
+	const ystring& Directory() const { return m_directory; }
+
+private:
+	/// Maps the file stored under the key, returning the scanner image in it
+	std::shared_ptr<const void> Load(const CacheKey& key, ypair<const void*, size_t>& image) const;
+
+	void Store(const CacheKey& key, const void* image, size_t size);
+
+	ystring Path(const CacheKey& key) const;
+
+	ystring m_directory;
+	size_t m_maxBytes;
+	bool m_verify;
+};
+
+template<class Scanner, class Compile>
+CachedScanner<Scanner> ScannerCache::Get(const CacheKey& key, Compile compile)
+{
+	CacheKey fullKey(key);
+	fullKey.Add(ystring(typeid(Scanner).name()));
+
+	CachedScanner<Scanner> result;
+	ypair<const void*, size_t> image;
+	if ((result.storage = Load(fullKey, image))) {
+		try {
+			result.scanner.Mmap(image.first, image.second);
+			result.hit = true;
+			return result;
+		}
+		catch (Error&) {
+			result.storage.reset();
+		}
+	}
+
+	result.scanner = compile();
+	BufferOutput buf;
+	Pire::Save(&buf, result.scanner);
+	Store(fullKey, buf.Buffer().Data(), buf.Buffer().Size());
+	return result;
+}
+
+}
+
+#endif
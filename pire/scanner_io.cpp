@@ -29,6 +29,7 @@
 #include "scanners/loaded.h"
 #include "align.h"
 #include "scanners/loaded.h"
+#include "fsm.h"
 
 namespace Pire {
 	
@@ -60,7 +61,7 @@ void SimpleScanner::Load(yistream* s)
 	if (empty) {
 		sc.Alias(Null());
 	} else {
-		sc.m_buffer = BufferType(new char[sc.BufSize()]);
+		sc.m_buffer = Impl::NewBuffer(sc.BufSize());
 		Impl::AlignedLoadArray(s, sc.m_buffer.get(), sc.BufSize());
 		sc.Markup(sc.m_buffer.get());
 		sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
@@ -169,6 +170,33 @@ void SlowScanner::Load(yistream* s)
 	Swap(sc);
 }
 
+void SlowScanner::SaveState(yostream* s, const State& state) const
+{
+	Impl::SaveStateHeader(s, StateIOTypes::SlowScanner, m.statesCount);
+	SavePodType(s, state.states.size());
+	if (!state.states.empty())
+		SavePodArray(s, &state.states[0], state.states.size());
+}
+
+void SlowScanner::LoadState(yistream* s, State& state) const
+{
+	Impl::ValidateStateHeader(s, StateIOTypes::SlowScanner, m.statesCount);
+	size_t count;
+	LoadPodType(s, count);
+	if (!*s || count > m.statesCount)
+		throw Error("Serialized state does not belong to this scanner");
+	State st(m.statesCount);
+	st.states.resize(count);
+	if (count)
+		LoadPodArray(s, &st.states[0], count);
+	for (auto&& i : st.states) {
+		if (i >= m.statesCount || st.flags.Test(i))
+			throw Error("Serialized state does not belong to this scanner");
+		st.flags.Set(i);
+	}
+	state.Swap(st);
+}
+
 void LoadedScanner::Save(yostream* s) const {
 	Save(s, ScannerIOTypes::LoadedScanner);
 }
@@ -201,7 +229,7 @@ void LoadedScanner::Load(yistream* s, ui32* type)
 	}
 	LoadPodType(s, sc.m);
 	Impl::AlignLoad(s, sizeof(sc.m));
-	sc.m_buffer = BufferType(new char[sc.BufSize()]);
+	sc.m_buffer = Impl::NewBuffer(sc.BufSize());
 	sc.Markup(sc.m_buffer.get());
 	Impl::AlignedLoadArray(s, sc.m_letters, MaxChar);
 	Impl::AlignedLoadArray(s, sc.m_jumps, sc.m.statesCount * sc.m.lettersCount);
@@ -214,4 +242,189 @@ void LoadedScanner::Load(yistream* s, ui32* type)
 	Swap(sc);
 }
 
+namespace {
+	// Fsm is saved as a single array of 32-bit words
+	enum {
+		FsmDetermined = 1,
+		FsmSparsed = 2,
+		FsmAlternative = 4
+	};
+
+	void PutLong(TVector<ui32>& words, unsigned long value)
+	{
+		words.push_back(static_cast<ui32>(value));
+		words.push_back(static_cast<ui32>(static_cast<ui64>(value) >> 32));
+	}
+
+	class FsmReader {
+	public:
+		FsmReader(const TVector<ui32>& words): m_words(words), m_pos(0) {}
+
+		ui32 Get()
+		{
+			if (m_pos == m_words.size())
+				throw Error("Pire::Fsm::Load(): unexpected end of data");
+			return m_words[m_pos++];
+		}
+
+		/// A word which must be less than the bound
+		ui32 Get(size_t bound)
+		{
+			ui32 word = Get();
+			if (word >= bound)
+				throw Error("Pire::Fsm::Load(): corrupted data");
+			return word;
+		}
+
+		unsigned long GetLong()
+		{
+			ui64 lo = Get();
+			ui64 hi = Get();
+			return static_cast<unsigned long>(lo | (hi << 32));
+		}
+
+		bool AtEnd() const { return m_pos == m_words.size(); }
+
+	private:
+		const TVector<ui32>& m_words;
+		size_t m_pos;
+	};
+}
+
+void Fsm::Save(yostream* s) const
+{
+	TVector<ui32> words;
+	words.push_back((determined ? FsmDetermined : 0) | (m_sparsed ? FsmSparsed : 0) | (isAlternative ? FsmAlternative : 0));
+	words.push_back(static_cast<ui32>(Size()));
+	words.push_back(static_cast<ui32>(initial));
+
+	// Letter classes in the order of their indices, representatives first
+	TVector<const TVector<Char>*> classes(letters.Size());
+	for (auto&& klass : letters)
+		classes[klass.second.first] = &klass.second.second;
+	words.push_back(static_cast<ui32>(classes.size()));
+	for (auto&& klass : classes) {
+		words.push_back(static_cast<ui32>(klass->size()));
+		words.insert(words.end(), klass->begin(), klass->end());
+	}
+
+	for (auto&& row : m_transitions) {
+		words.push_back(static_cast<ui32>(row.size()));
+		for (auto&& dests : row) {
+			words.push_back(dests.first);
+			words.push_back(static_cast<ui32>(dests.second.size()));
+			words.insert(words.end(), dests.second.begin(), dests.second.end());
+		}
+	}
+
+	words.push_back(static_cast<ui32>(m_final.size()));
+	words.insert(words.end(), m_final.begin(), m_final.end());
+
+	words.push_back(static_cast<ui32>(tags.size()));
+	for (auto&& tag : tags) {
+		words.push_back(static_cast<ui32>(tag.first));
+		PutLong(words, tag.second);
+	}
+
+	size_t outputsCount = 0;
+	for (auto&& row : outputs)
+		outputsCount += row.second.size();
+	words.push_back(static_cast<ui32>(outputsCount));
+	for (auto&& row : outputs)
+		for (auto&& output : row.second) {
+			words.push_back(static_cast<ui32>(row.first));
+			words.push_back(static_cast<ui32>(output.first));
+			PutLong(words, output.second);
+		}
+
+	SavePodType(s, Header(ScannerIOTypes::Fsm, sizeof(size_t)));
+	Impl::AlignSave(s, sizeof(Header));
+	SavePodType(s, words.size());
+	Impl::AlignSave(s, sizeof(size_t));
+	Impl::AlignedSaveArray(s, words.data(), words.size());
+}
+
+void Fsm::Load(yistream* s)
+{
+	Impl::ValidateHeader(s, ScannerIOTypes::Fsm, sizeof(size_t));
+	size_t count;
+	LoadPodType(s, count);
+	Impl::AlignLoad(s, sizeof(count));
+	// The count is not trusted with memory: words are read in chunks,
+	// so a corrupted one runs into the end of data rather than allocating it
+	static const size_t ChunkSize = 1 << 16;
+	TVector<ui32> words;
+	while (words.size() != count) {
+		size_t pos = words.size();
+		words.resize(pos + ymin(ChunkSize, count - pos));
+		LoadPodArray(s, words.data() + pos, words.size() - pos);
+		if (!*s)
+			throw Error("Pire::Fsm::Load(): unexpected end of data");
+	}
+	Impl::AlignLoad(s, sizeof(ui32) * count);
+	if (!*s)
+		throw Error("Pire::Fsm::Load(): unexpected end of data");
+
+	FsmReader reader(words);
+	ui32 flags = reader.Get();
+	size_t size = reader.Get();
+	// Each state takes at least a word for its transitions
+	if (!size || size > count)
+		throw Error("Pire::Fsm::Load(): corrupted data");
+
+	Fsm fsm;
+	fsm.Resize(size);
+	fsm.ClearFinal();
+	fsm.initial = reader.Get(size);
+	fsm.determined = (flags & FsmDetermined) != 0;
+	fsm.isAlternative = (flags & FsmAlternative) != 0;
+
+	// A letter belongs to a single class: Partition::AppendTo() would
+	// silently move it from one class to another
+	TVector< TVector<Char> > classes(reader.Get(MaxChar + 1));
+	TVector<bool> classified(MaxChar, false);
+	for (auto&& klass : classes) {
+		klass.resize(reader.Get(MaxChar + 1));
+		if (klass.empty())
+			throw Error("Pire::Fsm::Load(): corrupted data");
+		for (auto&& letter : klass) {
+			letter = reader.Get(MaxChar);
+			if (classified[letter])
+				throw Error("Pire::Fsm::Load(): corrupted data");
+			classified[letter] = true;
+		}
+	}
+
+	for (auto&& row : fsm.m_transitions)
+		for (size_t letters = reader.Get(MaxChar + 1); letters; --letters) {
+			StatesSet& dests = row[reader.Get(MaxChar)];
+			for (size_t n = reader.Get(size + 1); n; --n)
+				dests.insert(reader.Get(size));
+		}
+
+	for (size_t n = reader.Get(size + 1); n; --n)
+		fsm.m_final.insert(reader.Get(size));
+
+	for (size_t n = reader.Get(size + 1); n; --n) {
+		size_t state = reader.Get(size);
+		fsm.tags[state] = reader.GetLong();
+	}
+
+	for (size_t n = reader.Get(); n; --n) {
+		size_t from = reader.Get(size);
+		size_t to = reader.Get(size);
+		fsm.outputs[from][to] = reader.GetLong();
+	}
+
+	if (!reader.AtEnd())
+		throw Error("Pire::Fsm::Load(): corrupted data");
+
+	Swap(fsm);
+	letters = LettersTbl(LettersEquality(m_transitions));
+	for (auto&& klass : classes)
+		for (auto&& letter : klass)
+			letters.AppendTo(klass.front(), letter);
+	m_sparsed = (flags & FsmSparsed) != 0;
+}
+
 }
@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include "../align.h"
+#include "../memory_policy.h"
 #include "../stub/defaults.h"
 #include "../defs.h"
 #include "../platform.h"
@@ -38,6 +39,10 @@ namespace Pire {
 			SlowScanner = 3,
 			LoadedScanner = 4,
 			NoGlueLimitCountingScanner = 5,
+			ScannerState = 6,
+			FixedScanner = 7,
+			Archive = 8,
+			Fsm = 9,
 		};
 	}
 
@@ -118,6 +123,64 @@ namespace Pire {
 			return hdr;
 		}
 	}
+
+	/**
+	 * Precedes a serialized scanner state (see SaveState() and LoadState() in scanners).
+	 * States are saved as state indices rather than pointers, so they can be loaded
+	 * into any copy of the same scanner, be it loaded, mmap()-ed or rebuilt.
+	 */
+	struct StateHeader {
+		ui32 StateType; ///< One of StateIOTypes
+		ui32 StatesCount;
+	};
+
+	/**
+	 * Tells serialized states of different layouts apart, so that a state
+	 * cannot be loaded into a scanner of another kind having as many states.
+	 */
+	namespace StateIOTypes {
+		enum {
+			Scanner = 1,
+			SimpleScanner = 2,
+			SlowScanner = 3,
+			CountingScanner = 4,
+			NoGlueLimitCountingScanner = 5,
+			AdvancedCountingScanner = 6,
+			CapturingScanner = 7,
+			SlowCapturingScanner = 8,
+			HalfFinalScanner = 9,
+		};
+	}
+
+	namespace Impl {
+		inline void SaveStateHeader(yostream* s, ui32 stateType, size_t statesCount)
+		{
+			SavePodType(s, Header(ScannerIOTypes::ScannerState, sizeof(StateHeader)));
+			AlignSave(s, sizeof(Header));
+			StateHeader hdr = { stateType, static_cast<ui32>(statesCount) };
+			SavePodType(s, hdr);
+			AlignSave(s, sizeof(hdr));
+		}
+
+		inline void ValidateStateHeader(yistream* s, ui32 stateType, size_t statesCount)
+		{
+			ValidateHeader(s, ScannerIOTypes::ScannerState, sizeof(StateHeader));
+			StateHeader hdr;
+			LoadPodType(s, hdr);
+			AlignLoad(s, sizeof(hdr));
+			if (hdr.StateType != stateType || hdr.StatesCount != statesCount)
+				throw Error("Serialized state does not belong to this scanner");
+		}
+
+		inline size_t LoadStateIndex(yistream* s, size_t statesCount)
+		{
+			size_t idx;
+			LoadPodType(s, idx);
+			if (!*s || idx >= statesCount)
+				throw Error("Serialized state does not belong to this scanner");
+			return idx;
+		}
+	}
 }
 
 #endif
@@ -0,0 +1,164 @@
+/*
+ * fixed.cpp -- mapping scanner images at fixed addresses
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include "fixed.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace Pire {
+namespace Impl {
+
+namespace {
+	// The part of the image telling where it wants to be placed
+	struct FixedPreamble {
+		Pire::Header Hdr;
+		size_t Base;
+
+		FixedPreamble(): Hdr(ScannerIOTypes::NoScanner, 0), Base(0) {}
+	};
+
+	ystring Describe(const char* what, const char* filename)
+	{
+		return ystring(what) + " failed for " + filename + ": " + strerror(errno);
+	}
+}
+
+#ifndef _WIN32
+
+const void* MapFile(const char* filename, size_t& size)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		throw Error(Describe("open", filename));
+	struct stat st;
+	void* addr = MAP_FAILED;
+	if (fstat(fd, &st) != -1) {
+		size = st.st_size;
+		addr = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	ystring msg = Describe("mmap", filename);
+	close(fd);
+	if (addr == MAP_FAILED)
+		throw Error(msg);
+	return addr;
+}
+
+const void* MapFixedFile(const char* filename, size_t& size, bool& atBase)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		throw Error(Describe("open", filename));
+
+	struct stat st;
+	FixedPreamble pre;
+	if (fstat(fd, &st) == -1 || pread(fd, &pre, sizeof(pre), 0) != (ssize_t) sizeof(pre)) {
+		ystring msg = Describe("reading", filename);
+		close(fd);
+		throw Error(msg);
+	}
+	size = st.st_size;
+	try {
+		pre.Hdr.Validate(ScannerIOTypes::FixedScanner, 0);
+	}
+	catch (...) {
+		close(fd);
+		throw;
+	}
+
+	// A file can only be mapped at a page boundary; images saved
+	// for any other address are always relocated
+	void* addr = MAP_FAILED;
+	if (pre.Base % sysconf(_SC_PAGESIZE) == 0) {
+#ifdef MAP_FIXED_NOREPLACE
+		addr = mmap(reinterpret_cast<void*>(pre.Base), size, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+#else
+		addr = mmap(reinterpret_cast<void*>(pre.Base), size, PROT_READ, MAP_SHARED, fd, 0);
+#endif
+	}
+	// Kernels not knowing MAP_FIXED_NOREPLACE take the address as a mere hint
+	if (addr != MAP_FAILED && reinterpret_cast<size_t>(addr) != pre.Base) {
+		munmap(addr, size);
+		addr = MAP_FAILED;
+	}
+	atBase = (addr != MAP_FAILED);
+	if (!atBase)
+		addr = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		throw Error(Describe("mmap", filename));
+	return addr;
+}
+
+void UnmapFile(const void* addr, size_t size)
+{
+	munmap(const_cast<void*>(addr), size);
+}
+
+#else
+
+// No mapping here: files are read into memory,
+// and fixed-address scanners are always relocated
+
+const void* MapFile(const char* filename, size_t& size)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		throw Error(Describe("open", filename));
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	size_t* buf = new size_t[size / sizeof(size_t) + 1];
+	bool ok = fread(buf, 1, size, f) == size;
+	fclose(f);
+	if (!ok) {
+		delete[] buf;
+		throw Error(Describe("reading", filename));
+	}
+	return buf;
+}
+
+const void* MapFixedFile(const char* filename, size_t& size, bool& atBase)
+{
+	atBase = false;
+	return MapFile(filename, size);
+}
+
+void UnmapFile(const void* addr, size_t)
+{
+	delete[] static_cast<const size_t*>(addr);
+}
+
+#endif
+
+}
+}
@@ -0,0 +1,95 @@
+/*
+ * fixed.h -- scanners mapped from files at fixed addresses
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_FIXED_H
+#define PIRE_SCANNERS_FIXED_H
+
+#include "multi.h"
+#include "../stub/noncopyable.h"
+
+namespace Pire {
+
+namespace Impl {
+	/// Maps the whole file read-only (just reads it on Windows),
+	/// setting `size' to the file size
+	const void* MapFile(const char* filename, size_t& size);
+
+	/// The same as MapFile(), but at the address recorded in the scanner image
+	/// the file starts with, if that range is free (and anywhere otherwise).
+	/// Sets `atBase' to whether the wish came true.
+	const void* MapFixedFile(const char* filename, size_t& size, bool& atBase);
+
+	/// Releases memory obtained from MapFile() or MapFixedFile()
+	void UnmapFile(const void* addr, size_t size);
+}
+
+/**
+ * A scanner loaded from a file saved by Scanner::SaveFixed().
+ *
+ * The file is mapped with MAP_FIXED_NOREPLACE at the address it was saved for,
+ * and the scanner (which stores absolute addresses, as NonrelocScanner does)
+ * runs right over the mapped pages, so all processes loading the file share
+ * them. If the address is taken (or is not page-aligned), the scanner is
+ * relocated into private memory and the file is unmapped at once.
+ */
+template<class Scanner>
+class FixedMappedScanner: public NonCopyable {
+public:
+	explicit FixedMappedScanner(const char* filename)
+		: m_addr(Impl::MapFixedFile(filename, m_size, m_shared))
+	{
+		try {
+			m_scanner.MmapFixed(m_addr, m_size);
+		}
+		catch (...) {
+			Impl::UnmapFile(m_addr, m_size);
+			throw;
+		}
+		if (!m_shared) {
+			Impl::UnmapFile(m_addr, m_size);
+			m_addr = 0;
+		}
+	}
+
+	~FixedMappedScanner()
+	{
+		if (m_addr)
+			Impl::UnmapFile(m_addr, m_size);
+	}
+
+	const Scanner& GetScanner() const { return m_scanner; }
+
+	/// Tells whether the scanner runs over the shared pages of the file
+	/// (rather than over a private relocated copy)
+	bool Shared() const { return m_shared; }
+
+private:
+	size_t m_size;
+	bool m_shared;
+	const void* m_addr;
+	Scanner m_scanner;
+};
+
+}
+
+#endif
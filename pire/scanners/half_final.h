@@ -28,8 +28,12 @@ namespace Impl {
  * does not work properly if the matching text does not end with EndMark.
  *
  * For count to work correctly, the fsm should not be determined.
+ *
+ * The state keeps the counters of up to MaxRegexps regexps inline; scanners
+ * counting more regexps keep them on the heap instead, allocated on the first
+ * Initialize() of each state.
  */
-template<typename Relocation, typename Shortcutting>
+template<typename Relocation, typename Shortcutting, size_t MaxRegexps = 64>
 class HalfFinalScanner : public Scanner<Relocation, Shortcutting> {
 public:
 	typedef typename Impl::Scanner<Relocation, Shortcutting> Scanner;
@@ -55,50 +59,137 @@ public:
 	typedef typename Scanner::ScannerRowHeader ScannerRowHeader;
 	typedef typename Scanner::Action Action;
 
+	/// Number of regexps a state counts without touching the heap
+	static const size_t MAX_RE_COUNT = MaxRegexps;
+	PIRE_STATIC_ASSERT(MAX_RE_COUNT > 0);
+
+private:
+	static const size_t MaskBits = sizeof(ui64) * 8;
+	static const size_t MaskWords = (MAX_RE_COUNT + MaskBits - 1) / MaskBits;
+
+public:
+
+	/**
+	 * The state carries per-regexp counters and a mask of matched regexps,
+	 * inline unless there are more than MAX_RE_COUNT regexps, so initializing
+	 * and copying it never touches the heap for most scanners.
+	 */
 	class State {
 	public:
-		typedef TVector<size_t>::const_iterator IdsIterator;
+		/// Iterates over ids of matched regexps in ascending order
+		class IdsIterator {
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef size_t value_type;
+			typedef ptrdiff_t difference_type;
+			typedef const size_t* pointer;
+			typedef const size_t& reference;
+
+			IdsIterator(): m_words(0), m_word(0), m_id(0) { memset(m_mask, 0, sizeof(m_mask)); }
+
+			/// Copies the mask, so that the iterator outlives the state
+			IdsIterator(const ui64* mask, size_t words): m_words(words), m_word(0)
+			{
+				memset(m_mask, 0, sizeof(m_mask));
+				if (words > MaskWords)
+					m_wide.assign(mask, mask + words);
+				else
+					memcpy(m_mask, mask, words * sizeof(*mask));
+				Seek();
+			}
 
-		State() : ScannerState(0) {}
+			const size_t& operator * () const { return m_id; }
+			IdsIterator& operator ++ ()
+			{
+				ui64* mask = Mask();
+				mask[m_word] &= mask[m_word] - 1;
+				Seek();
+				return *this;
+			}
+			IdsIterator operator ++ (int) { IdsIterator it = *this; ++*this; return it; }
 
-		State(const typename Scanner::State& otherState) : ScannerState(otherState) {}
+			/// Both iterators must come from the same state
+			difference_type operator - (const IdsIterator& it) const { return it.Remaining() - Remaining(); }
+			size_t operator [] (size_t n) const { IdsIterator it = *this; while (n--) ++it; return *it; }
 
-		void GetMatchedRegexpsIds() {
-			MatchedRegexpsIds.clear();
-			for (size_t i = 0; i < MatchedRegexps.size(); i++) {
-				if (MatchedRegexps[i]) {
-					MatchedRegexpsIds.push_back(i);
-				}
+			bool operator == (const IdsIterator& it) const
+			{
+				if (AtEnd() || it.AtEnd())
+					return AtEnd() == it.AtEnd();
+				return m_word == it.m_word && Mask()[m_word] == it.Mask()[m_word];
+			}
+			bool operator != (const IdsIterator& it) const { return !(*this == it); }
+
+		private:
+			ui64* Mask() { return m_wide.empty() ? m_mask : m_wide.data(); }
+			const ui64* Mask() const { return m_wide.empty() ? m_mask : m_wide.data(); }
+
+			bool AtEnd() const { return m_word == m_words; }
+
+			/// Skips to the lowest id left, or to the end
+			void Seek()
+			{
+				const ui64* mask = Mask();
+				while (m_word != m_words && !mask[m_word])
+					++m_word;
+				m_id = !AtEnd() ? m_word * MaskBits + LowestSetBit(mask[m_word]) : 0;
 			}
-		}
+
+			difference_type Remaining() const
+			{
+				difference_type n = 0;
+				for (size_t i = m_word; i != m_words; ++i)
+					n += PopCount(Mask()[i]);
+				return n;
+			}
+
+			ui64 m_mask[MaskWords];
+			TVector<ui64> m_wide;
+			size_t m_words;
+			size_t m_word;
+			size_t m_id;
+		};
+
+		State() : ScannerState(0), RegexpsCount(0) { memset(MatchedMask, 0, sizeof(MatchedMask)); }
+
+		State(const typename Scanner::State& otherState) : ScannerState(otherState), RegexpsCount(0) { memset(MatchedMask, 0, sizeof(MatchedMask)); }
+
+		/// Kept for compatibility; matched ids are iterated directly over the mask.
+		void GetMatchedRegexpsIds() {}
 
 		IdsIterator IdsBegin() const {
-			return MatchedRegexpsIds.cbegin();
+			return IdsIterator(Mask(), MaskSize());
 		}
 
 		IdsIterator IdsEnd() const {
-			return MatchedRegexpsIds.cend();
+			return IdsIterator();
 		}
 
 		bool operator==(const State& other) const {
-			return ScannerState == other.ScannerState && MatchedRegexps == other.MatchedRegexps;
+			return ScannerState == other.ScannerState && RegexpsCount == other.RegexpsCount
+				&& !memcmp(Mask(), other.Mask(), MaskSize() * sizeof(ui64))
+				&& !memcmp(Counters(), other.Counters(), RegexpsCount * sizeof(ui32));
 		}
 
 		bool operator!=(const State& other) const {
-			return ScannerState != other.ScannerState || MatchedRegexps != other.MatchedRegexps;
+			return !(*this == other);
 		}
 
 		size_t Result(size_t regexp_id) const {
-			return MatchedRegexps[regexp_id];
+			return Counters()[regexp_id];
 		}
 
+		/**
+		 * Deprecated, kept for compatibility: saves the raw state, which is only
+		 * valid for the very same scanner, and the number of regexps, but no counters
+		 * (Load() zeroes them). Use SaveState() and LoadState() of the scanner instead.
+		 */
 		void Save(yostream* s) const {
 			SavePodType(s, Pire::Header(5, sizeof(size_t)));
 			Impl::AlignSave(s, sizeof(Pire::Header));
-			auto stateSizePair = ymake_pair(ScannerState, MatchedRegexps.size());
+			auto stateSizePair = ymake_pair(static_cast<size_t>(ScannerState), RegexpsCount);
 			SavePodType(s, stateSizePair);
 			Impl::AlignSave(s, sizeof(ypair<size_t, size_t>));
-			Y_ASSERT(0);
 		}
 
 		void Load(yistream* s) {
@@ -107,16 +198,39 @@ public:
 			LoadPodType(s, stateSizePair);
 			Impl::AlignLoad(s, sizeof(ypair<size_t, size_t>));
 			ScannerState = stateSizePair.first;
-			MatchedRegexps.clear();
-			MatchedRegexps.resize(stateSizePair.second);
+			Reset(stateSizePair.second);
 		}
 
 	private:
-		TVector<size_t> MatchedRegexpsIds;
 		typename Scanner::State ScannerState;
-		TVector<size_t> MatchedRegexps;
+		size_t RegexpsCount;
+		ui64 MatchedMask[MaskWords];
+		ui32 MatchedRegexps[MAX_RE_COUNT];
+		/// Used instead of the arrays above if there are more than MAX_RE_COUNT regexps
+		TVector<ui64> WideMask;
+		TVector<ui32> WideRegexps;
+
+		bool Wide() const { return RegexpsCount > MAX_RE_COUNT; }
+		size_t MaskSize() const { return Wide() ? WideMask.size() : MaskWords; }
+		ui64* Mask() { return Wide() ? WideMask.data() : MatchedMask; }
+		const ui64* Mask() const { return Wide() ? WideMask.data() : MatchedMask; }
+		ui32* Counters() { return Wide() ? WideRegexps.data() : MatchedRegexps; }
+		const ui32* Counters() const { return Wide() ? WideRegexps.data() : MatchedRegexps; }
+
+		/// Zeroes the counters and the mask for the given number of regexps
+		void Reset(size_t count)
+		{
+			RegexpsCount = count;
+			if (Wide()) {
+				WideMask.assign((count + MaskBits - 1) / MaskBits, 0);
+				WideRegexps.assign(count, 0);
+			} else {
+				memset(MatchedMask, 0, sizeof(MatchedMask));
+				memset(MatchedRegexps, 0, count * sizeof(*MatchedRegexps));
+			}
+		}
 
-		friend class HalfFinalScanner<Relocation, Shortcutting>;
+		friend class HalfFinalScanner<Relocation, Shortcutting, MaxRegexps>;
 	};
 
 
@@ -129,16 +243,14 @@ public:
 
 	typedef ypair<typename State::IdsIterator, typename State::IdsIterator> AcceptedRegexpsType;
 
-	AcceptedRegexpsType AcceptedRegexps(State& state) const {
-		state.GetMatchedRegexpsIds();
+	AcceptedRegexpsType AcceptedRegexps(const State& state) const {
 		return ymake_pair(state.IdsBegin(), state.IdsEnd());
 	}
 
 	/// Returns an initial state for this scanner
 	void Initialize(State& state) const {
 		state.ScannerState = Scanner::m.initial;
-		state.MatchedRegexps.clear();
-		state.MatchedRegexps.resize(Scanner::m.regexpsCount);
+		state.Reset(Scanner::m.regexpsCount);
 		TakeAction(state, 0);
 	}
 
@@ -155,8 +267,12 @@ public:
 		if (Final(state)) {
 			size_t idx = StateIndex(state);
 			const size_t *it = Scanner::m_final + Scanner::m_finalIndex[idx];
+			ui32* counters = state.Counters();
+			ui64* mask = state.Mask();
 			while (*it != Scanner::End) {
-				state.MatchedRegexps[*it]++;
+				Y_ASSERT(*it < state.RegexpsCount);
+				counters[*it]++;
+				mask[*it / MaskBits] |= ui64(1) << (*it % MaskBits);
 				++it;
 			}
 		}
@@ -170,13 +286,18 @@ public:
 
 	HalfFinalScanner(Scanner&& s) : Scanner(s) {}
 
-	template<class AnotherRelocation>
-	HalfFinalScanner(const HalfFinalScanner<AnotherRelocation, Shortcutting>& s)
+	template<class AnotherRelocation, size_t AnotherMaxRegexps>
+	HalfFinalScanner(const HalfFinalScanner<AnotherRelocation, Shortcutting, AnotherMaxRegexps>& s)
 			: Scanner(s) {}
 
 	template<class AnotherRelocation>
 	HalfFinalScanner(const Impl::Scanner<AnotherRelocation, Shortcutting>& s) : Scanner(s) {}
 
+	/// Returns a copy having its own tables (see Scanner::Clone())
+	HalfFinalScanner Clone() const {
+		return HalfFinalScanner(Scanner::Clone());
+	}
+
 	void Swap(HalfFinalScanner& s) {
 		Scanner::Swap(s);
 	}
@@ -190,6 +311,35 @@ public:
 		return Scanner::StateIndex(s.ScannerState);
 	}
 
+	/// Saves the state along with the matched regexps counters in a position-independent
+	/// form, which can be restored with LoadState() of any copy of the scanner.
+	void SaveState(yostream* s, const State& state) const {
+		Impl::SaveStateHeader(s, StateIOTypes::HalfFinalScanner, Scanner::Size());
+		SavePodType(s, StateIndex(state));
+		SavePodType(s, state.RegexpsCount);
+		SavePodArray(s, state.Counters(), state.RegexpsCount);
+	}
+
+	void LoadState(yistream* s, State& state) const {
+		Impl::ValidateStateHeader(s, StateIOTypes::HalfFinalScanner, Scanner::Size());
+		State st;
+		st.ScannerState = Scanner::TagState(Scanner::IndexToState(Impl::LoadStateIndex(s, Scanner::Size())));
+		size_t count;
+		LoadPodType(s, count);
+		if (!*s || count != Scanner::m.regexpsCount)
+			throw Error("Serialized state does not belong to this scanner");
+		st.Reset(count);
+		ui32* counters = st.Counters();
+		LoadPodArray(s, counters, count);
+		if (!*s)
+			throw Error("Serialized state does not belong to this scanner");
+		ui64* mask = st.Mask();
+		for (size_t i = 0; i < count; ++i)
+			if (counters[i])
+				mask[i / MaskBits] |= ui64(1) << (i % MaskBits);
+		state = st;
+	}
+
 	/**
 	 * Agglutinates two scanners together, producing a larger scanner.
 	 * Checking a string against that scanner effectively checks them against both agglutinated regexps
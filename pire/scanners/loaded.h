@@ -76,16 +76,27 @@ public:
 protected:
 	LoadedScanner() { Alias(Null()); }
 
+	/// Copies share the tables (if any; mmap()-ed scanners just copy pointers)
 	LoadedScanner(const LoadedScanner& s): m(s.m)
 	{
-		if (s.m_buffer) {
-			m_buffer = BufferType(new char [BufSize()]);
-			memcpy(m_buffer.get(), s.m_buffer.get(), BufSize());
-			Markup(m_buffer.get());
-			m.initial = (InternalState)m_jumps + (s.m.initial - (InternalState)s.m_jumps);
-		} else {
-			Alias(s);
-		}
+		Alias(s);
+		m_buffer = s.m_buffer;
+	}
+
+	/// Replaces shared or mmap()-ed tables with a private copy
+	/// (subclasses implement Clone() with it)
+	void Detach()
+	{
+		BufferType buffer = Impl::NewBuffer(BufSize());
+		const Letter* letters = m_letters;
+		const Transition* jumps = m_jumps;
+		const Tag* tags = m_tags;
+		Markup(buffer.get());
+		memcpy(m_letters, letters, MaxChar * sizeof(*m_letters));
+		memcpy(m_jumps, jumps, m.statesCount * StateSize());
+		memcpy(m_tags, tags, m.statesCount * sizeof(*m_tags));
+		m.initial = (InternalState)m_jumps + (m.initial - (InternalState)jumps);
+		m_buffer.swap(buffer);
 	}
 
 	void Swap(LoadedScanner& s)
@@ -161,7 +172,7 @@ public:
 		m.statesCount = states;
 		m.lettersCount = letters.Size();
 		m.regexpsCount = regexpsCount;
-		m_buffer = BufferType(new char[BufSize()]);
+		m_buffer = Impl::NewBuffer(BufSize());
 		memset(m_buffer.get(), 0, BufSize());
 		Markup(m_buffer.get());
 
@@ -208,6 +219,11 @@ public:
 		return (reinterpret_cast<Transition*>(s) - m_jumps) / m.lettersCount;
 	}
 
+	InternalState IndexToState(size_t idx) const
+	{
+		return reinterpret_cast<InternalState>(m_jumps + idx * m.lettersCount);
+	}
+
 	i64 SignExtend(i32 i) const { return i; }
 
 	size_t BufSize() const
@@ -233,7 +249,7 @@ protected:
 		size_t initial;
 	} m;
 
-	using BufferType = std::unique_ptr<char[]>;
+	using BufferType = Impl::SharedBuffer;
 	BufferType m_buffer;
 
 	Letter* m_letters;
@@ -274,7 +290,7 @@ private:
 	void Alias(const LoadedScanner& s)
 	{
 		memcpy(&m, &s.m, sizeof(m));
-		m_buffer = 0;
+		m_buffer.reset();
 		m_letters = s.m_letters;
 		m_jumps = s.m_jumps;
 		m_tags = s.m_tags;
@@ -34,6 +34,7 @@
 #include "../run.h"
 #include "../static_assert.h"
 #include "../stub/saveload.h"
+#include "../memory_policy.h"
 #include "../stub/lexical_cast.h"
 #include "../platform.h"
 #include "../glue.h"
@@ -50,6 +51,63 @@ namespace Impl {
 	template<class T>
 	class ScannerGlueTask;
 
+	// Row headers lie at the start of their rows, so a state is the address of its header
+	struct InlineHeaders {
+		template<class Transition>
+		void MarkupHeaders(Transition*, size_t /*rowSize*/, size_t /*statesCount*/) {}
+
+		template<class Transition>
+		size_t RowHeader(size_t row, const Transition*, size_t /*stride*/) const { return row; }
+
+		template<class Transition>
+		size_t HeadersBase(const Transition* transitions) const { return reinterpret_cast<size_t>(transitions); }
+
+		void SwapHeaders(InlineHeaders&) {}
+	};
+
+	// Row headers are kept in a separate array right after the transition table
+	class SeparateHeaders {
+	public:
+		SeparateHeaders(): m_headers(0), m_rowShift(0), m_rowInverse(0) {}
+
+		template<class Transition>
+		void MarkupHeaders(Transition* transitions, size_t rowSize, size_t statesCount)
+		{
+			m_headers = reinterpret_cast<size_t>(transitions + rowSize * statesCount);
+			m_rowShift = 0;
+			size_t rowBytes = rowSize * sizeof(Transition);
+			for (; rowBytes && !(rowBytes & 1); rowBytes >>= 1)
+				++m_rowShift;
+			// Newton's iteration doubles the number of correct low bits each time
+			m_rowInverse = rowBytes;
+			for (size_t i = 0; i != 6; ++i)
+				m_rowInverse *= 2 - rowBytes * m_rowInverse;
+		}
+
+		/// Rows are not padded, so the offset is divided by the row size exactly:
+		/// its power of two is shifted out and the rest is multiplied by the inverse of the odd part
+		template<class Transition>
+		size_t RowHeader(size_t row, const Transition* transitions, size_t stride) const
+		{
+			return m_headers + ((row - reinterpret_cast<size_t>(transitions)) >> m_rowShift) * m_rowInverse * stride;
+		}
+
+		template<class Transition>
+		size_t HeadersBase(const Transition*) const { return m_headers; }
+
+		void SwapHeaders(SeparateHeaders& s)
+		{
+			DoSwap(m_headers, s.m_headers);
+			DoSwap(m_rowShift, s.m_rowShift);
+			DoSwap(m_rowInverse, s.m_rowInverse);
+		}
+
+	private:
+		size_t m_headers;
+		size_t m_rowShift;
+		size_t m_rowInverse;
+	};
+
 	// This strategy allows to mmap() saved representation of a scanner. This is achieved by
 	// storing shifts instead of addresses in the transition table.
 	struct Relocatable {
@@ -61,6 +119,14 @@ namespace Impl {
 		typedef ui32 Transition;
 
 		typedef const void* RetvalForMmap;
+		// Transitions hold no addresses, so plain Mmap() is enough
+		typedef struct {} RetvalForMmapFixed;
+
+		// States are plain row addresses
+		static const size_t TagMask = 0;
+		// Each row starts with its header
+		static const bool SplitHeaders = false;
+		typedef InlineHeaders RowLayout;
 
 		static size_t Go(size_t state, Transition shift) { return state + SignExtend(shift); }
 		static Transition Diff(size_t from, size_t to) { return static_cast<Transition>(to - from); }
@@ -75,6 +141,51 @@ namespace Impl {
 		// Generates a compile-time error if Scanner<Nonrelocatable>::Mmap()
 		// (which is unsupported) is mistakenly called
 		typedef struct {} RetvalForMmap;
+		// ...but an image saved with SaveFixed() can be mapped with MmapFixed()
+		typedef const void* RetvalForMmapFixed;
+
+		static const size_t TagMask = 0;
+		static const bool SplitHeaders = false;
+		typedef InlineHeaders RowLayout;
+
+		static size_t Go(size_t /*state*/, Transition shift) { return shift; }
+		static Transition Diff(size_t /*from*/, size_t to) { return to; }
+	};
+
+	// The same as Nonrelocatable, but each transition also carries Final and Dead
+	// flags of its destination in the lowest bits (which are always zero otherwise,
+	// since rows are aligned at sizeof(MaxSizeWord)). States become tagged addresses,
+	// so Final() and Dead() test the state value itself instead of loading
+	// a row header, which usually lies in another cache line.
+	struct NonrelocatableTagged {
+		static const size_t Signature = 3;
+		typedef size_t Transition;
+
+		typedef struct {} RetvalForMmap;
+		typedef const void* RetvalForMmapFixed;
+
+		static const size_t TagMask = 3;
+		static const bool SplitHeaders = false;
+		typedef InlineHeaders RowLayout;
+
+		static size_t Go(size_t /*state*/, Transition shift) { return shift; }
+		static Transition Diff(size_t /*from*/, size_t to) { return to; }
+	};
+
+	// The same as NonrelocatableTagged, but row headers (exit masks and flags) are kept
+	// in a separate per-state array, so rows hold transitions only. For scanners with
+	// a few dozen letter classes the headers are as large as the transitions, so the
+	// transition table shrinks severalfold and a run touches far fewer cache lines.
+	struct NonrelocatableSplit {
+		static const size_t Signature = 4;
+		typedef size_t Transition;
+
+		typedef struct {} RetvalForMmap;
+		typedef const void* RetvalForMmapFixed;
+
+		static const size_t TagMask = 3;
+		static const bool SplitHeaders = true;
+		typedef SeparateHeaders RowLayout;
 
 		static size_t Go(size_t /*state*/, Transition shift) { return shift; }
 		static Transition Diff(size_t /*from*/, size_t to) { return to; }
@@ -85,7 +196,7 @@ namespace Impl {
 //      - transition table representation strategy
 //      - strategy for fast forwarding through memory ranges
 template<class Relocation, class Shortcutting>
-class Scanner {
+class Scanner: private Relocation::RowLayout {
 protected:
 	enum {
 		 FinalFlag = 1,
@@ -140,17 +251,15 @@ public:
 	size_t LettersCount() const { return m.lettersCount; }
 
 	/// Checks whether specified state is in any of the final sets
-	bool Final(const State& state) const { return (Header(state).Common.Flags & FinalFlag) != 0; }
+	bool Final(const State& state) const { return (StateFlags(state) & FinalFlag) != 0; }
 
 	/// Checks whether specified state is 'dead' (i.e. scanner will never
 	/// reach any final state from current one)
-	bool Dead(const State& state) const { return (Header(state).Common.Flags & DeadFlag) != 0; }
+	bool Dead(const State& state) const { return (StateFlags(state) & DeadFlag) != 0; }
 
 	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& state) const
 	{
-		size_t idx = (state - reinterpret_cast<size_t>(m_transitions)) /
-			(RowSize() * sizeof(Transition));
-		const size_t* b = m_final + m_finalIndex[idx];
+		const size_t* b = m_final + m_finalIndex[StateIndex(state)];
 		const size_t* e = b;
 		while (*e != End)
 			++e;
@@ -169,17 +278,18 @@ public:
 	Action NextTranslated(State& state, Char letter) const
 	{
 		PIRE_IFDEBUG(
-			Y_ASSERT(state >= (size_t)m_transitions);
-			Y_ASSERT(state < (size_t)(m_transitions + RowSize()*Size()));
-			Y_ASSERT((state - (size_t)m_transitions) % (RowSize()*sizeof(Transition)) == 0);
+			Y_ASSERT(Row(state) >= (size_t)m_transitions);
+			Y_ASSERT(Row(state) < (size_t)(m_transitions + RowSize()*Size()));
+			Y_ASSERT((Row(state) - (size_t)m_transitions) % (RowSize()*sizeof(Transition)) == 0);
 		);
 
-		state = Relocation::Go(state, reinterpret_cast<const Transition*>(state)[letter]);
+		size_t row = Row(state);
+		state = Relocation::Go(row, reinterpret_cast<const Transition*>(row)[letter]);
 
 		PIRE_IFDEBUG(
-			Y_ASSERT(state >= (size_t)m_transitions);
-			Y_ASSERT(state < (size_t)(m_transitions + RowSize()*Size()));
-			Y_ASSERT((state - (size_t)m_transitions) % (RowSize()*sizeof(Transition)) == 0);
+			Y_ASSERT(Row(state) >= (size_t)m_transitions);
+			Y_ASSERT(Row(state) < (size_t)(m_transitions + RowSize()*Size()));
+			Y_ASSERT((Row(state) - (size_t)m_transitions) % (RowSize()*sizeof(Transition)) == 0);
 		);
 
 		return 0;
@@ -193,15 +303,22 @@ public:
 
 	void TakeAction(State&, Action) const {}
 
+	/// Copies share the tables (which are immutable), so copying is cheap
+	/// and reading them from many threads involves no contention
 	Scanner(const Scanner& s): m(s.m)
 	{
-		if (!s.m_buffer) {
-			// Empty or mmap()-ed scanner
-			Alias(s);
-		} else {
-			// In-memory scanner
-			DeepCopy(s);
-		}
+		Alias(s);
+		m_buffer = s.m_buffer;
+	}
+
+	/// Returns a copy having its own tables, e.g. to be modified
+	/// or to stay valid after the memory an Mmap()-ed scanner was built on is gone
+	Scanner Clone() const
+	{
+		Scanner s;
+		if (!Empty())
+			s.DeepCopy(*this);
+		return s;
 	}
 
 	Scanner(Scanner&& s)
@@ -233,6 +350,7 @@ public:
 		DoSwap(m_final, s.m_final);
 		DoSwap(m_finalIndex, s.m_finalIndex);
 		DoSwap(m_transitions, s.m_transitions);
+		RowLayout::SwapHeaders(s);
 	}
 
 	Scanner& operator = (const Scanner& s) { Scanner(s).Swap(*this); return *this; }
@@ -278,9 +396,60 @@ public:
 		return Impl::AlignPtr(p, size);
 	}
 
+	/// Saves the scanner as an image for MmapFixed(), with addresses
+	/// in the transition table valid if the image is placed at `base'.
+	/// The base needs only be word-aligned, but FixedMappedScanner can
+	/// share the file only if it is page-aligned, too.
+	void SaveFixed(yostream* s, size_t base) const;
+
+	/*
+	 * Constructs the scanner from an image saved by SaveFixed(), returning
+	 * a pointer to unconsumed part of the buffer. If the image lies at
+	 * the address it was saved for, the scanner uses it in place (so all
+	 * processes mapping a file there share its pages); otherwise the image
+	 * is copied to private memory and relocated in a single pass.
+	 */
+	typename Relocation::RetvalForMmapFixed MmapFixed(const void* ptr, size_t size);
+
+	/**
+	 * Moves the tables into memory allocated according to the policy
+	 * (a combination of MemoryPolicy flags), e.g. backed by huge pages.
+	 * Mmap()-ed scanners get a private copy. Returns the flags which took
+	 * effect. States obtained before the call become invalid.
+	 */
+	unsigned ApplyMemoryPolicy(unsigned policy)
+	{
+		if (Empty())
+			return 0;
+		size_t allocated;
+		unsigned applied;
+		char* ptr = Impl::AllocateMemory(BufSize(), policy, allocated, applied);
+		BufferType buffer(ptr, Impl::BufferDeleter(allocated));
+		memcpy(buffer.get(), m_letters, BufSize());
+		size_t delta = reinterpret_cast<size_t>(buffer.get()) - reinterpret_cast<size_t>(m_letters);
+		Markup(buffer.get());
+		Relocate(delta);
+		m_buffer.swap(buffer);
+		return applied;
+	}
+
 	size_t StateIndex(State s) const
 	{
-		return (s - reinterpret_cast<size_t>(m_transitions)) / (RowSize() * sizeof(Transition));
+		return (Row(s) - reinterpret_cast<size_t>(m_transitions)) / (RowSize() * sizeof(Transition));
+	}
+
+	/// Saves the state in a position-independent form,
+	/// which can be restored with LoadState() of any copy of the scanner.
+	void SaveState(yostream* s, const State& state) const
+	{
+		Impl::SaveStateHeader(s, StateIOTypes::Scanner, Size());
+		SavePodType(s, StateIndex(state));
+	}
+
+	void LoadState(yistream* s, State& state) const
+	{
+		Impl::ValidateStateHeader(s, StateIOTypes::Scanner, Size());
+		state = TagState(IndexToState(Impl::LoadStateIndex(s, Size())));
 	}
 
 	/**
@@ -300,18 +469,77 @@ public:
 			MaxChar * sizeof(Letter)                           // Letters translation table
 			+ m.finalTableSize * sizeof(size_t)                // Final table
 			+ m.statesCount * sizeof(size_t)                   // Final index
-			+ RowSize() * m.statesCount * sizeof(Transition),  // Transitions table
+			+ RowSize() * m.statesCount * sizeof(Transition)   // Transitions table
+			+ (Relocation::SplitHeaders ? m.statesCount * HeaderStride() : 0), // Row headers
 		sizeof(size_t));
 	}
 
 	void Save(yostream*) const;
 	void Load(yistream*);
 
-	ScannerRowHeader& Header(State s) { return *(ScannerRowHeader*) s; }
-	const ScannerRowHeader& Header(State s) const { return *(const ScannerRowHeader*) s; }
+	ScannerRowHeader& Header(State s) { return *(ScannerRowHeader*) HeaderAddr(s); }
+	const ScannerRowHeader& Header(State s) const { return *(const ScannerRowHeader*) HeaderAddr(s); }
 
 protected:
 
+	/// Strips Final and Dead flags off a tagged state, yielding its row address
+	static size_t Row(State s) { return s & ~Relocation::TagMask; }
+
+	size_t HeaderAddr(State s) const { return RowLayout::RowHeader(Row(s), m_transitions, HeaderStride()); }
+
+	/// Distance between headers of adjacent states in bytes;
+	/// must be a multiple of sizeof(MaxSizeWord) for exit masks to be read aligned
+	size_t HeaderStride() const
+	{
+		if (Relocation::SplitHeaders)
+			return AlignUp(sizeof(ScannerRowHeader), sizeof(MaxSizeWord));
+		else
+			return RowSize() * sizeof(Transition);
+	}
+
+	size_t StateFlags(State s) const
+	{
+		if (Relocation::TagMask)
+			return s & Relocation::TagMask;
+		else
+			return Header(s).Common.Flags;
+	}
+
+	/// Turns a row address into a state value, as the transition table would do
+	size_t TagState(size_t row) const
+	{
+		return row | (Header(row).Common.Flags & Relocation::TagMask);
+	}
+
+	/// Puts flags of destination states into all transitions and the initial state.
+	/// Must be called after all flags are set; does nothing for untagged relocations.
+	void TagTransitions()
+	{
+		PIRE_STATIC_ASSERT(Relocation::TagMask == 0 || Relocation::TagMask == Flags);
+		if (!Relocation::TagMask)
+			return;
+		for (size_t i = 0; i != Size(); ++i) {
+			size_t row = IndexToState(i);
+			Transition* tr = reinterpret_cast<Transition*>(row) + HEADER_SIZE;
+			for (size_t let = 0; let != LettersCount(); ++let)
+				tr[let] = Relocation::Diff(row, TagState(Row(Relocation::Go(row, tr[let]))));
+		}
+		m.initial = TagState(Row(m.initial));
+	}
+
+	/// Fixes transitions and the initial state after the table has been moved
+	/// by delta bytes (does nothing to transitions not holding addresses)
+	void Relocate(size_t delta)
+	{
+		for (size_t i = 0; i != Size(); ++i) {
+			size_t row = IndexToState(i);
+			Transition* tr = reinterpret_cast<Transition*>(row) + HEADER_SIZE;
+			for (size_t let = 0; let != LettersCount(); ++let)
+				tr[let] = Relocation::Diff(row, Relocation::Go(row - delta, tr[let]) + delta);
+		}
+		m.initial += delta;
+	}
+
 	struct Locals {
 		ui32 statesCount;
 		ui32 lettersCount;
@@ -322,7 +550,7 @@ protected:
 		size_t shortcuttingSignature;
 	} m;
 
-	using BufferType = std::unique_ptr<char[]>;
+	using BufferType = Impl::SharedBuffer;
 	BufferType m_buffer;
 	Letter* m_letters;
 
@@ -331,6 +559,9 @@ protected:
 
 	Transition* m_transitions;
 
+	// Locates row headers (keeps no data unless they are split off the rows)
+	typedef typename Relocation::RowLayout RowLayout;
+
 	// Only used to force Null() call during static initialization, when Null()::n can be
 	// initialized safely by compilers that don't support thread safe static local vars
 	// initialization
@@ -343,10 +574,17 @@ protected:
 		return (m_null == &n ? *m_null : n);
 	}
 
-	// Returns transition row size in Transition's. Row size_in bytes should be a multiple of sizeof(MaxSizeWord)
-	size_t RowSize() const { return AlignUp(m.lettersCount + HEADER_SIZE, sizeof(MaxSizeWord)/sizeof(Transition)); }
+	// Returns transition row size in Transition's. Row size_in bytes should be a multiple of sizeof(MaxSizeWord),
+	// unless headers are split off the rows
+	size_t RowSize() const
+	{
+		if (Relocation::SplitHeaders)
+			return m.lettersCount;
+		else
+			return AlignUp(m.lettersCount + HEADER_SIZE, sizeof(MaxSizeWord)/sizeof(Transition));
+	}
 
-	static const size_t HEADER_SIZE = sizeof(ScannerRowHeader) / sizeof(Transition);
+	static const size_t HEADER_SIZE = Relocation::SplitHeaders ? 0 : sizeof(ScannerRowHeader) / sizeof(Transition);
 	PIRE_STATIC_ASSERT(sizeof(ScannerRowHeader) % sizeof(Transition) == 0);
 
 	template<class Eq>
@@ -360,7 +598,7 @@ protected:
 		m.regexpsCount = regexpsCount;
 		m.finalTableSize = finalStatesCount + states;
 
-		m_buffer = BufferType(new char[BufSize() + sizeof(size_t)]);
+		m_buffer = Impl::NewBuffer(BufSize() + sizeof(size_t));
 		memset(m_buffer.get(), 0, BufSize() + sizeof(size_t));
 		Markup(AlignUp(m_buffer.get(), sizeof(size_t)));
 
@@ -385,6 +623,7 @@ protected:
 		m_final	      = reinterpret_cast<size_t*>(m_letters + MaxChar);
 		m_finalIndex  = reinterpret_cast<size_t*>(m_final + m.finalTableSize);
 		m_transitions = reinterpret_cast<Transition*>(m_finalIndex + m.statesCount);
+		RowLayout::MarkupHeaders(m_transitions, RowSize(), m.statesCount);
 	}
 
 	// Makes a shallow ("weak") copy of the given scanner.
@@ -397,6 +636,7 @@ protected:
 		m_final = s.m_final;
 		m_finalIndex = s.m_finalIndex;
 		m_transitions = s.m_transitions;
+		static_cast<RowLayout&>(*this) = s;
 	}
 	
 	template<class AnotherRelocation>
@@ -410,7 +650,7 @@ protected:
 		memcpy(&m, &s.m, sizeof(s.m));
 		m.relocationSignature = Relocation::Signature;
 		m.shortcuttingSignature = Shortcutting::Signature;
-		m_buffer = BufferType(new char[BufSize() + sizeof(size_t)]);
+		m_buffer = Impl::NewBuffer(BufSize() + sizeof(size_t));
 		std::memset(m_buffer.get(), 0, BufSize() + sizeof(size_t));
 		Markup(AlignUp(m_buffer.get(), sizeof(size_t)));
 
@@ -441,6 +681,7 @@ protected:
 				Y_ASSERT(Relocation::Go(newstate, tr) < (size_t)(m_transitions + RowSize()*Size()));
 			}
 		}
+		TagTransitions();
 	}
 
 
@@ -485,31 +726,28 @@ protected:
 
 		// Loop through all states in the transition table and
 		// check if it is possible to setup shortcuts
+		TVector<char> exits;
 		for (size_t i = 0; i != Size(); ++i) {
 			State st = IndexToState(i);
 			ScannerRowHeader& header = Header(st);
-			Shortcutting::SetNoExit(header);
-			size_t ind = 0;
-			size_t let = HEADER_SIZE;
-			for (; let != LettersCount() + HEADER_SIZE; ++let) {
-				// Check if the transition is not the same state
-				if (Relocation::Go(st, reinterpret_cast<const Transition*>(st)[let]) != st) {
-					if (ind + letters[let].size() > Shortcutting::ExitMaskCount)
-						break;
-					// For each character setup a mask
-					for (auto&& character : letters[let]) {
-						Shortcutting::SetMask(header, ind, character);
-						++ind;
-					}
-				}
-			}
-
-			if (let != LettersCount() + HEADER_SIZE) {
-				// Not enough space in ExitMasks, so reset all masks (which leads to bypassing the optimization)
-				Shortcutting::SetNoShortcut(header);
+			// Collect all characters leading out of the state
+			exits.clear();
+			for (size_t let = HEADER_SIZE; let != LettersCount() + HEADER_SIZE; ++let)
+				if (Row(Relocation::Go(st, reinterpret_cast<const Transition*>(st)[let])) != st)
+					exits.insert(exits.end(), letters[let].begin(), letters[let].end());
+
+			if (exits.size() > Shortcutting::ExitMaskCount) {
+				// Not enough space in ExitMasks, so let the policy decide
+				// whether the exit set can be checked some other way
+				Shortcutting::SetExitClass(header, exits);
+				continue;
 			}
+			Shortcutting::SetNoExit(header);
+			// For each character setup a mask
+			for (size_t ind = 0; ind != exits.size(); ++ind)
+				Shortcutting::SetMask(header, ind, exits[ind]);
 			// Fill the rest of the shortcut masks with the last used mask
-			Shortcutting::FinishMasks(header, ind);
+			Shortcutting::FinishMasks(header, exits.size());
 		}
 	}
 
@@ -525,6 +763,7 @@ protected:
 			*finalWriter++ = static_cast<size_t>(-1);
 		}
 		BuildShortcuts();
+		TagTransitions();
 	}
 
 	size_t AcceptedRegexpsCount(size_t idx) const
@@ -590,7 +829,7 @@ struct ScannerSaver {
 		if (empty) {
 			sc.Alias(ScannerType::Null());
 		} else {
-			sc.m_buffer = std::unique_ptr<char[]>(new char[sc.BufSize()]);
+			sc.m_buffer = Impl::NewBuffer(sc.BufSize());
 			Impl::AlignedLoadArray(s, sc.m_buffer.get(), sc.BufSize());
 			sc.Markup(sc.m_buffer.get());
 			sc.m.initial += reinterpret_cast<size_t>(sc.m_transitions);
@@ -598,21 +837,195 @@ struct ScannerSaver {
 		scanner.Swap(sc);
 	}
 
-	// TODO: implement more effective serialization
-	// of nonrelocatable scanner if necessary
-	
-	template<class Shortcutting>
-	static void SaveScanner(const Scanner<Nonrelocatable, Shortcutting>& scanner, yostream* s)
+	// Other scanners are saved in the format of Scanner<Relocatable>, converting
+	// rows on the fly, so neither saving nor loading ever holds a second table
+
+	template<class Relocation, class Shortcutting>
+	static void SaveScanner(const Scanner<Relocation, Shortcutting>& scanner, yostream* s)
 	{
-		Scanner<Relocatable, Shortcutting>(scanner).Save(s);
+		typedef typename Scanner<Relocation, Shortcutting>::Transition Transition;
+		typedef Scanner<Relocatable, Shortcutting> Saved;
+		typedef typename Saved::Transition SavedTransition;
+
+		// Only used to compute the layout of the saved table
+		Saved layout;
+		memcpy(&layout.m, &scanner.m, sizeof(layout.m));
+		layout.m.relocationSignature = Relocatable::Signature;
+		const size_t rowBytes = layout.RowSize() * sizeof(SavedTransition);
+
+		typename Saved::Locals mc = layout.m;
+		mc.initial = scanner.StateIndex(scanner.m.initial) * rowBytes;
+		SavePodType(s, Pire::Header(ScannerIOTypes::Scanner, sizeof(mc)));
+		Impl::AlignSave(s, sizeof(Pire::Header));
+		SavePodType(s, mc);
+		Impl::AlignSave(s, sizeof(mc));
+		SavePodType(s, scanner.Empty());
+		Impl::AlignSave(s, sizeof(scanner.Empty()));
+		if (scanner.Empty())
+			return;
+
+		TVector<typename Saved::Letter> letters(MaxChar);
+		for (size_t c = 0; c != MaxChar; ++c)
+			letters[c] = scanner.m_letters[c] - scanner.HEADER_SIZE + Saved::HEADER_SIZE;
+		SavePodArray(s, letters.data(), MaxChar);
+		SavePodArray(s, scanner.m_final, scanner.m.finalTableSize);
+		SavePodArray(s, scanner.m_finalIndex, scanner.m.statesCount);
+
+		TVector<SavedTransition> row(layout.RowSize());
+		for (size_t i = 0; i != scanner.Size(); ++i) {
+			size_t state = scanner.IndexToState(i);
+			Fill(row.begin(), row.end(), 0);
+			*reinterpret_cast<typename Saved::ScannerRowHeader*>(row.data()) = scanner.Header(state);
+			const Transition* tr = reinterpret_cast<const Transition*>(state) + scanner.HEADER_SIZE;
+			for (size_t let = 0; let != scanner.LettersCount(); ++let) {
+				size_t dest = scanner.StateIndex(Relocation::Go(state, tr[let]));
+				row[Saved::HEADER_SIZE + let] = Relocatable::Diff(i * rowBytes, dest * rowBytes);
+			}
+			SavePodArray(s, row.data(), row.size());
+		}
+
+		size_t written = MaxChar * sizeof(typename Saved::Letter)
+			+ (scanner.m.finalTableSize + scanner.m.statesCount) * sizeof(size_t)
+			+ scanner.Size() * rowBytes;
+		Impl::AlignSave(s, written);
+		Y_ASSERT(AlignUp(written, sizeof(size_t)) == layout.BufSize());
 	}
-	
-	template<class Shortcutting>
-	static void LoadScanner(Scanner<Nonrelocatable, Shortcutting>& scanner, yistream* s)
+
+	template<class Relocation, class Shortcutting>
+	static void LoadScanner(Scanner<Relocation, Shortcutting>& scanner, yistream* s)
 	{
-		Scanner<Relocatable, Shortcutting> rs;
-		rs.Load(s);
-		Scanner<Nonrelocatable, Shortcutting>(rs).Swap(scanner);
+		typedef Scanner<Relocation, Shortcutting> ScannerType;
+		typedef typename ScannerType::Transition Transition;
+		typedef Scanner<Relocatable, Shortcutting> Saved;
+		typedef typename Saved::Transition SavedTransition;
+
+		Saved layout;
+		Impl::ValidateHeader(s, ScannerIOTypes::Scanner, sizeof(layout.m));
+		LoadPodType(s, layout.m);
+		Impl::AlignLoad(s, sizeof(layout.m));
+		if (layout.m.relocationSignature != Relocatable::Signature)
+			throw Error("Type mismatch while loading Pire::Scanner");
+		if (Shortcutting::Signature != layout.m.shortcuttingSignature)
+			throw Error("This scanner has different shortcutting type");
+		bool empty;
+		LoadPodType(s, empty);
+		Impl::AlignLoad(s, sizeof(empty));
+
+		ScannerType sc;
+		if (empty) {
+			sc.Alias(ScannerType::Null());
+			scanner.Swap(sc);
+			return;
+		}
+
+		const size_t rowBytes = layout.RowSize() * sizeof(SavedTransition);
+		memcpy(&sc.m, &layout.m, sizeof(sc.m));
+		sc.m.relocationSignature = Relocation::Signature;
+		sc.m_buffer = Impl::NewBuffer(sc.BufSize() + sizeof(size_t));
+		std::memset(sc.m_buffer.get(), 0, sc.BufSize() + sizeof(size_t));
+		sc.Markup(AlignUp(sc.m_buffer.get(), sizeof(size_t)));
+
+		LoadPodArray(s, sc.m_letters, MaxChar);
+		for (size_t c = 0; c != MaxChar; ++c)
+			sc.m_letters[c] = sc.m_letters[c] - Saved::HEADER_SIZE + ScannerType::HEADER_SIZE;
+		LoadPodArray(s, sc.m_final, sc.m.finalTableSize);
+		LoadPodArray(s, sc.m_finalIndex, sc.m.statesCount);
+
+		TVector<SavedTransition> row(layout.RowSize());
+		for (size_t i = 0; i != sc.Size(); ++i) {
+			LoadPodArray(s, row.data(), row.size());
+			size_t state = sc.IndexToState(i);
+			sc.Header(state) = *reinterpret_cast<const typename Saved::ScannerRowHeader*>(row.data());
+			Transition* tr = reinterpret_cast<Transition*>(state) + ScannerType::HEADER_SIZE;
+			for (size_t let = 0; let != sc.LettersCount(); ++let) {
+				size_t dest = Relocatable::Go(i * rowBytes, row[Saved::HEADER_SIZE + let]) / rowBytes;
+				if (dest >= sc.Size())
+					throw Error("Pire::Scanner: corrupted transition table");
+				tr[let] = Relocation::Diff(state, sc.IndexToState(dest));
+			}
+		}
+		if (layout.m.initial % rowBytes || layout.m.initial / rowBytes >= sc.Size())
+			throw Error("Pire::Scanner: corrupted initial state");
+		sc.m.initial = sc.IndexToState(layout.m.initial / rowBytes);
+		sc.TagTransitions();
+
+		Impl::AlignLoad(s, MaxChar * sizeof(typename Saved::Letter)
+			+ (sc.m.finalTableSize + sc.m.statesCount) * sizeof(size_t)
+			+ sc.Size() * rowBytes);
+		scanner.Swap(sc);
+	}
+
+	// The image written by SaveFixed() is laid out just like the one of Save(),
+	// but has its own type and records the address it is meant to be placed at
+	template<class Relocation, class Shortcutting>
+	static void SaveFixedScanner(const Scanner<Relocation, Shortcutting>& scanner, yostream* s, size_t base)
+	{
+		typedef Scanner<Relocation, Shortcutting> ScannerType;
+
+		if (!Impl::IsAligned(base, sizeof(size_t)))
+			throw Error("Pire::Scanner::SaveFixed(): misaligned base address");
+		// A private copy (even of a mapped scanner), whose addresses
+		// are moved to where they will be mapped
+		ScannerType sc;
+		if (!scanner.Empty()) {
+			sc.DeepCopy(scanner);
+			size_t offset = AlignUp(sizeof(Pire::Header), sizeof(size_t)) + sizeof(base)
+				+ AlignUp(sizeof(sc.m), sizeof(size_t)) + AlignUp(sizeof(bool), sizeof(size_t));
+			sc.Relocate(base + offset - reinterpret_cast<size_t>(sc.m_letters));
+		}
+
+		SavePodType(s, Pire::Header(ScannerIOTypes::FixedScanner, sizeof(sc.m)));
+		Impl::AlignSave(s, sizeof(Pire::Header));
+		SavePodType(s, base);
+		SavePodType(s, sc.m);
+		Impl::AlignSave(s, sizeof(sc.m));
+		SavePodType(s, sc.Empty());
+		Impl::AlignSave(s, sizeof(sc.Empty()));
+		if (!sc.Empty())
+			Impl::AlignedSaveArray(s, reinterpret_cast<const char*>(sc.m_letters), sc.BufSize());
+	}
+
+	template<class Relocation, class Shortcutting>
+	static const void* MmapFixedScanner(Scanner<Relocation, Shortcutting>& scanner, const void* ptr, size_t size)
+	{
+		typedef Scanner<Relocation, Shortcutting> ScannerType;
+
+		Impl::CheckAlign(ptr, sizeof(size_t));
+		ScannerType sc;
+		const size_t* p = reinterpret_cast<const size_t*>(ptr);
+		Impl::ValidateHeader(p, size, ScannerIOTypes::FixedScanner, sizeof(sc.m));
+		const size_t* base;
+		Impl::MapPtr(base, 1, p, size);
+		const typename ScannerType::Locals* locals;
+		Impl::MapPtr(locals, 1, p, size);
+		memcpy(&sc.m, locals, sizeof(sc.m));
+		if (sc.m.relocationSignature != Relocation::Signature)
+			throw Error("Type mismatch while mmapping Pire::Scanner");
+		if (Shortcutting::Signature != sc.m.shortcuttingSignature)
+			throw Error("This scanner has different shortcutting type");
+		const bool* empty;
+		Impl::MapPtr(empty, 1, p, size);
+
+		if (*empty)
+			sc.Alias(ScannerType::Null());
+		else {
+			if (size < sc.BufSize())
+				throw Error("EOF reached while mapping Pire::Scanner");
+			if (reinterpret_cast<size_t>(ptr) == *base)
+				sc.Markup(const_cast<size_t*>(p));
+			else {
+				sc.m_buffer = Impl::NewBuffer(sc.BufSize() + sizeof(size_t));
+				char* data = AlignUp(sc.m_buffer.get(), sizeof(size_t));
+				memcpy(data, p, sc.BufSize());
+				sc.Markup(data);
+				// The image expected the table at (p - ptr) bytes past the base
+				sc.Relocate(reinterpret_cast<size_t>(data) - reinterpret_cast<size_t>(p)
+					+ reinterpret_cast<size_t>(ptr) - *base);
+			}
+			Impl::AdvancePtr(p, size, sc.BufSize());
+		}
+		scanner.Swap(sc);
+		return Impl::AlignPtr(p, size);
 	}
 };
 
@@ -629,13 +1042,25 @@ void Scanner<Relocation, Shortcutting>::Load(yistream* s)
 	ScannerSaver::LoadScanner(*this, s);
 }
 
+template<class Relocation, class Shortcutting>
+void Scanner<Relocation, Shortcutting>::SaveFixed(yostream* s, size_t base) const
+{
+	ScannerSaver::SaveFixedScanner(*this, s, base);
+}
+
+template<class Relocation, class Shortcutting>
+typename Relocation::RetvalForMmapFixed Scanner<Relocation, Shortcutting>::MmapFixed(const void* ptr, size_t size)
+{
+	return ScannerSaver::MmapFixedScanner(*this, ptr, size);
+}
+
 template<class Relocation, class Shortcutting>
 const Scanner<Relocation, Shortcutting>* Scanner<Relocation, Shortcutting>::m_null = &Null();
 
 // Shortcutting policy that checks state exit masks
 template <size_t MaskCount>
 class ExitMasks {
-private:
+protected:
 	enum {
 		NO_SHORTCUT_MASK = 1, // the state doesn't have shortcuts
 		NO_EXIT_MASK  =    2  // the state has only transtions to itself (we can stop the scan)
@@ -659,6 +1084,13 @@ private:
 			for (; begin != end && Check(hdr, alignOffset, ToLittleEndian(*begin)); ++begin) {}
 			return begin;
 		}
+
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		const Word* DoRunReverse(const ScannerRowHeader& hdr, size_t alignOffset, const Word* begin, const Word* end)
+		{
+			for (; end != begin && Check(hdr, alignOffset, ToLittleEndian(end[-1])); --end) {}
+			return end;
+		}
 	};
 	
 	template<class ScannerRowHeader, unsigned N, unsigned Nmax>
@@ -674,6 +1106,15 @@ private:
 			else
 				return Next::Run(hdr, alignOffset, begin, end);
 		}
+
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		const Word* RunReverse(const ScannerRowHeader& hdr, size_t alignOffset, const Word* begin, const Word* end)
+		{
+			if (hdr.Mask(N) == hdr.Mask(N + 1))
+				return Base::DoRunReverse(hdr, alignOffset, begin, end);
+			else
+				return Next::RunReverse(hdr, alignOffset, begin, end);
+		}
 	};
 	
 	template<class ScannerRowHeader, unsigned N>
@@ -685,6 +1126,12 @@ private:
 		{
 			return Base::DoRun(hdr, alignOffset, begin, end);
 		}
+
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		const Word* RunReverse(const ScannerRowHeader& hdr, size_t alignOffset, const Word* begin, const Word* end)
+		{
+			return Base::DoRunReverse(hdr, alignOffset, begin, end);
+		}
 	};	
 
 	// Compares the ExitMask[0] value without SSE reads which seems to be more optimal
@@ -797,6 +1244,15 @@ public:
 		}
 	}
 
+	/// Called for states having more exit characters than there are masks
+	template <class Header>
+	static void SetExitClass(Header& header, const TVector<char>&)
+	{
+		// Reset all masks (which leads to bypassing the optimization)
+		SetNoShortcut(header);
+		FinishMasks(header, 1);
+	}
+
 	template <class Relocation>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
 	bool NoExit(const Scanner<Relocation, ExitMasks<MaskCount> >& scanner, typename Scanner<Relocation, ExitMasks<MaskCount> >::State state)
@@ -818,6 +1274,156 @@ public:
 		return MaskChecker<typename Scanner<Relocation, ExitMasks<MaskCount> >::ScannerRowHeader, 0, MaskCount - 1>::Run(scanner.Header(state), alignOffset, begin, end);
 	}
 
+	/// Returns the lowest position such that the whole [result, end) range can be skipped
+	template <class Relocation>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	const Word* RunReverse(const Scanner<Relocation, ExitMasks<MaskCount> >& scanner, typename Scanner<Relocation, ExitMasks<MaskCount> >::State state, size_t alignOffset, const Word* begin, const Word* end)
+	{
+		return MaskChecker<typename Scanner<Relocation, ExitMasks<MaskCount> >::ScannerRowHeader, 0, MaskCount - 1>::RunReverse(scanner.Header(state), alignOffset, begin, end);
+	}
+
+};
+
+
+// Shortcutting policy that uses exit masks for states with few exit characters
+// (just like ExitMasks does) and a nibble-table character class for states
+// with larger exit sets (e.g. /[^"\\]*/ or /[^ \t\r\n]*/), so that the scanner
+// can fast forward through them as well.
+//
+// The class is encoded as two 16-entry tables indexed by the low and the high
+// nibble of a byte; each entry is a bitset of up to eight buckets, and a byte
+// belongs to the class iff its two entries share a bucket. High nibbles
+// combined with the same set of low nibbles share a bucket, which makes the
+// encoding exact for most real-life sets; if there are more than eight
+// such groups, the last bucket takes the union of the rest, so the class
+// may contain extra characters (stopping the fast forward early, which
+// is harmless) but never misses an exit character.
+template <size_t MaskCount>
+class ExitClasses: public ExitMasks<MaskCount> {
+private:
+	typedef ExitMasks<MaskCount> Base;
+
+	enum {
+		CLASS_MASK = 3 // the state is checked against its exit class
+	};
+
+	template <class ScannerRowHeader>
+	struct ClassChecker {
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		const Word* Run(const ScannerRowHeader& hdr, const Word* begin, const Word* end)
+		{
+			for (; begin != end && !IsAnyInClass(hdr.LowNibbles, hdr.HighNibbles, *begin); ++begin) {}
+			return begin;
+		}
+
+		static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+		const Word* RunReverse(const ScannerRowHeader& hdr, const Word* begin, const Word* end)
+		{
+			for (; end != begin && !IsAnyInClass(hdr.LowNibbles, hdr.HighNibbles, end[-1]); --end) {}
+			return end;
+		}
+	};
+
+public:
+
+	static const size_t Signature = 0x3000 + MaskCount;
+
+	template <class Scanner>
+	struct ExtendedRowHeader: public Base::template ExtendedRowHeader<Scanner> {
+		typedef typename Base::template ExtendedRowHeader<Scanner> MasksHeader;
+
+		ExtendedRowHeader()
+		{
+			memset(LowNibbles, 0, sizeof(LowNibbles));
+			memset(HighNibbles, 0, sizeof(HighNibbles));
+		}
+
+		template <class OtherScanner>
+		ExtendedRowHeader& operator =(const ExtendedRowHeader<OtherScanner>& other)
+		{
+			MasksHeader::operator =(other);
+			memcpy(LowNibbles, other.LowNibbles, sizeof(LowNibbles));
+			memcpy(HighNibbles, other.HighNibbles, sizeof(HighNibbles));
+			return *this;
+		}
+
+		/// Bucket bitsets for each low and high nibble of a character
+		ui8 LowNibbles[16];
+		ui8 HighNibbles[16];
+	};
+
+	template <class Header>
+	static void SetExitClass(Header& header, const TVector<char>& exits)
+	{
+		// Sets of low nibbles each high nibble is combined with
+		ui16 lows[16] = {0};
+		for (auto&& c : exits)
+			lows[static_cast<unsigned char>(c) >> 4] |= 1 << (c & 0x0F);
+
+		ui16 buckets[8];
+		size_t count = 0;
+		for (size_t hi = 0; hi != 16; ++hi) {
+			if (!lows[hi])
+				continue;
+			size_t bucket = 0;
+			while (bucket != count && buckets[bucket] != lows[hi])
+				++bucket;
+			if (bucket == count) {
+				if (count != 8)
+					buckets[count++] = 0;
+				else
+					--bucket;
+				buckets[bucket] |= lows[hi];
+			}
+			header.HighNibbles[hi] |= 1 << bucket;
+		}
+		for (size_t bucket = 0; bucket != count; ++bucket)
+			for (size_t lo = 0; lo != 16; ++lo)
+				if (buckets[bucket] & (1 << lo))
+					header.LowNibbles[lo] |= 1 << bucket;
+
+		header.SetMask(0, CLASS_MASK);
+		Base::FinishMasks(header, 1);
+	}
+
+	template <class Relocation>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	bool NoExit(const Scanner<Relocation, ExitClasses<MaskCount> >& scanner, typename Scanner<Relocation, ExitClasses<MaskCount> >::State state)
+	{
+		return scanner.Header(state).Mask(0) == Base::NO_EXIT_MASK;
+	}
+
+	template <class Relocation>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	bool NoShortcut(const Scanner<Relocation, ExitClasses<MaskCount> >& scanner, typename Scanner<Relocation, ExitClasses<MaskCount> >::State state)
+	{
+		return scanner.Header(state).Mask(0) == Base::NO_SHORTCUT_MASK;
+	}
+
+	template <class Relocation>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	const Word* Run(const Scanner<Relocation, ExitClasses<MaskCount> >& scanner, typename Scanner<Relocation, ExitClasses<MaskCount> >::State state, size_t alignOffset, const Word* begin, const Word* end)
+	{
+		typedef typename Scanner<Relocation, ExitClasses<MaskCount> >::ScannerRowHeader ScannerRowHeader;
+		const ScannerRowHeader& hdr = scanner.Header(state);
+		if (hdr.Mask(0) == CLASS_MASK)
+			return ClassChecker<ScannerRowHeader>::Run(hdr, begin, end);
+		else
+			return Base::template MaskChecker<ScannerRowHeader, 0, MaskCount - 1>::Run(hdr, alignOffset, begin, end);
+	}
+
+	/// Returns the lowest position such that the whole [result, end) range can be skipped
+	template <class Relocation>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	const Word* RunReverse(const Scanner<Relocation, ExitClasses<MaskCount> >& scanner, typename Scanner<Relocation, ExitClasses<MaskCount> >::State state, size_t alignOffset, const Word* begin, const Word* end)
+	{
+		typedef typename Scanner<Relocation, ExitClasses<MaskCount> >::ScannerRowHeader ScannerRowHeader;
+		const ScannerRowHeader& hdr = scanner.Header(state);
+		if (hdr.Mask(0) == CLASS_MASK)
+			return ClassChecker<ScannerRowHeader>::RunReverse(hdr, begin, end);
+		else
+			return Base::template MaskChecker<ScannerRowHeader, 0, MaskCount - 1>::RunReverse(hdr, alignOffset, begin, end);
+	}
 };
 
 
@@ -852,6 +1458,9 @@ struct NoShortcuts {
 	template <class Header>
 	static void FinishMasks(Header&, size_t) {}
 
+	template <class Header>
+	static void SetExitClass(Header&, const TVector<char>&) {}
+
 	template <class Relocation>
 	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
 	bool NoExit(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State)
@@ -875,6 +1484,13 @@ struct NoShortcuts {
 		// Stop shortcutting right at the beginning
 		return begin;
 	}
+
+	template <class Relocation>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	const Word* RunReverse(const Scanner<Relocation, NoShortcuts>&, typename Scanner<Relocation, NoShortcuts>::State, size_t, const Word*, const Word* end)
+	{
+		return end;
+	}
 };
 
 #ifndef PIRE_DEBUG
@@ -894,6 +1510,17 @@ struct MultiChunk {
 		else
 			return Stop;
 	}
+
+	// The same in reverse direction: size_t-sized chunks are processed from the last one
+	template<class Pred>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action ProcessReverse(const Scanner& scanner, typename Scanner::State& state, const size_t* p, Pred pred)
+	{
+		if (RunChunkReverse(scanner, state, p + Count - 1, 0, sizeof(void*), pred) == Continue)
+			return MultiChunk<Scanner, Count-1>::ProcessReverse(scanner, state, p, pred);
+		else
+			return Stop;
+	}
 };
 
 template <class Scanner>
@@ -905,6 +1532,13 @@ struct MultiChunk<Scanner, 0> {
 	{
 		return Continue;
 	}
+
+	template<class Pred>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action ProcessReverse(const Scanner&, typename Scanner::State&, const size_t*, Pred)
+	{
+		return Continue;
+	}
 };
 
 // Efficiently runs a scanner through size_t-aligned memory range
@@ -922,6 +1556,13 @@ private:
 		return MultiChunk<ScannerType, sizeof(Word)/sizeof(size_t)>::Process(scanner, st, begin, pred);
 	}
 
+	template <class Pred>
+	static PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action RunMultiChunkReverse(const ScannerType& scanner, typename ScannerType::State& st, const size_t* begin, Pred pred)
+	{
+		return MultiChunk<ScannerType, sizeof(Word)/sizeof(size_t)>::ProcessReverse(scanner, st, begin, pred);
+	}
+
 	// Asserts if the scanner changes state while processing the byte range that is
 	// supposed to be skipped by a shortcut
 	static void ValidateSkip(const ScannerType& scanner, typename ScannerType::State st, const char* begin, const char* end)
@@ -957,9 +1598,10 @@ public:
 			return pred(scanner, state, ((const char*) end));
 		}
 		
-		// Row size should be a multiple of MaxSizeWord size. Then alignOffset is the same for any state
-		Y_ASSERT((scanner.RowSize()*sizeof(typename ScannerType::Transition)) % sizeof(MaxSizeWord) == 0);
-		size_t alignOffset = (AlignUp((size_t)scanner.m_transitions, sizeof(Word)) - (size_t)scanner.m_transitions) / sizeof(size_t);
+		// Header stride should be a multiple of MaxSizeWord size. Then alignOffset is the same for any state
+		Y_ASSERT(scanner.HeaderStride() % sizeof(MaxSizeWord) == 0);
+		size_t headers = scanner.HeadersBase(scanner.m_transitions);
+		size_t alignOffset = (AlignUp(headers, sizeof(Word)) - headers) / sizeof(size_t);
 
 		bool noShortcut = Shortcutting::NoShortcut(scanner, state);
 
@@ -998,6 +1640,70 @@ public:
 		st = state;
 		return Continue;
 	}
+
+	// The same as RunAligned(), but runs through [begin, end) from the last word to the first one,
+	// fast forwarding (backwards) through words that cannot make the scanner leave its state.
+	template<class Pred>
+	static inline PIRE_HOT_FUNCTION
+	Action RunAlignedReverse(const ScannerType& scanner, typename ScannerType::State& st, const size_t* begin, const size_t* end, Pred pred)
+	{
+		typename ScannerType::State state = st;
+		const Word* head = AlignUp((const Word*) begin, sizeof(Word));
+		const Word* tail = AlignDown((const Word*) end, sizeof(Word));
+		for (; end != (const size_t*) tail && end != begin; --end)
+			if (RunChunkReverse(scanner, state, end - 1, 0, sizeof(void*), pred) == Stop) {
+				st = state;
+				return Stop;
+			}
+
+		if (begin == end) {
+			st = state;
+			return Continue;
+		}
+		if (Shortcutting::NoExit(scanner, state)) {
+			st = state;
+			return pred(scanner, state, ((const char*) begin) - 1);
+		}
+
+		Y_ASSERT(scanner.HeaderStride() % sizeof(MaxSizeWord) == 0);
+		size_t headers = scanner.HeadersBase(scanner.m_transitions);
+		size_t alignOffset = (AlignUp(headers, sizeof(Word)) - headers) / sizeof(size_t);
+
+		bool noShortcut = Shortcutting::NoShortcut(scanner, state);
+
+		while (true) {
+			while (noShortcut && tail != head) {
+				if (RunMultiChunkReverse(scanner, state, (const size_t*)(tail - 1), pred) == Stop) {
+					st = state;
+					return Stop;
+				}
+				--tail;
+				noShortcut = Shortcutting::NoShortcut(scanner, state);
+			}
+			if (tail == head)
+				break;
+
+			if (Shortcutting::NoExit(scanner, state)) {
+				st = state;
+				return pred(scanner, state, ((const char*) begin) - 1);
+			}
+
+			const Word* skipBegin = Shortcutting::RunReverse(scanner, state, alignOffset, head, tail);
+			PIRE_IF_CHECKED(ValidateSkip(scanner, state, (const char*)skipBegin, (const char*)tail));
+			tail = skipBegin;
+			noShortcut = true;
+		}
+
+		for (const size_t* p = (const size_t*) head; p != begin; --p) {
+			if (RunChunkReverse(scanner, state, p - 1, 0, sizeof(void*), pred) == Stop) {
+				st = state;
+				return Stop;
+			}
+		}
+
+		st = state;
+		return Continue;
+	}
 };
 
 #endif
@@ -1046,6 +1752,7 @@ public:
 	const Scanner& Success()
 	{
 		Sc().BuildShortcuts();
+		Sc().TagTransitions();
 		return Sc();
 	}
 	
@@ -1122,6 +1829,32 @@ typedef Impl::Scanner<Impl::Relocatable, Impl::NoShortcuts> ScannerNoMask;
 typedef Impl::Scanner<Impl::Nonrelocatable, Impl::ExitMasks<2> > NonrelocScanner;
 typedef Impl::Scanner<Impl::Nonrelocatable, Impl::NoShortcuts> NonrelocScannerNoMask;
 
+/**
+ * Same as NonrelocScanner, but keeps Final and Dead flags right in state values,
+ * so Final() and Dead() need no load of the row header. In exchange every step
+ * masks the flags off the state, which makes plain runs of small scanners about
+ * 15% slower. It pays off for prefix searches with large scanners, whose row
+ * headers miss the cache: with a few thousand words (run_large in run-bench)
+ * LongestPrefix() gets about 12% faster than with NonrelocScanner.
+ */
+typedef Impl::Scanner<Impl::NonrelocatableTagged, Impl::ExitMasks<2> > NonrelocTaggedScanner;
+typedef Impl::Scanner<Impl::NonrelocatableTagged, Impl::NoShortcuts> NonrelocTaggedScannerNoMask;
+
+/**
+ * Same as NonrelocTaggedScanner, but keeps row headers apart from transitions,
+ * which makes the transition table much denser.
+ */
+typedef Impl::Scanner<Impl::NonrelocatableSplit, Impl::ExitMasks<2> > NonrelocSplitScanner;
+typedef Impl::Scanner<Impl::NonrelocatableSplit, Impl::NoShortcuts> NonrelocSplitScannerNoMask;
+
+/**
+ * Same as Scanner and NonrelocScanner, but also fast forward through states
+ * with large exit sets (such as the inside of a quoted string),
+ * checking a whole word of input against a character class at once.
+ */
+typedef Impl::Scanner<Impl::Relocatable, Impl::ExitClasses<2> > ClassMaskScanner;
+typedef Impl::Scanner<Impl::Nonrelocatable, Impl::ExitClasses<2> > NonrelocClassMaskScanner;
+
 }
 
 namespace std {
@@ -1132,6 +1865,22 @@ namespace std {
 	inline void swap(Pire::NonrelocScanner& a, Pire::NonrelocScanner& b) {
 		a.Swap(b);
 	}
+
+	inline void swap(Pire::NonrelocTaggedScanner& a, Pire::NonrelocTaggedScanner& b) {
+		a.Swap(b);
+	}
+
+	inline void swap(Pire::NonrelocSplitScanner& a, Pire::NonrelocSplitScanner& b) {
+		a.Swap(b);
+	}
+
+	inline void swap(Pire::ClassMaskScanner& a, Pire::ClassMaskScanner& b) {
+		a.Swap(b);
+	}
+
+	inline void swap(Pire::NonrelocClassMaskScanner& a, Pire::NonrelocClassMaskScanner& b) {
+		a.Swap(b);
+	}
 }
 
 
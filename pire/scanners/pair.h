@@ -82,6 +82,18 @@ namespace Pire {
 			return ymake_pair(m_scanner1->StateIndex(state.first), m_scanner2->StateIndex(state.second));
 		}
 
+		void SaveState(yostream* s, const State& state) const
+		{
+			m_scanner1->SaveState(s, state.first);
+			m_scanner2->SaveState(s, state.second);
+		}
+
+		void LoadState(yistream* s, State& state) const
+		{
+			m_scanner1->LoadState(s, state.first);
+			m_scanner2->LoadState(s, state.second);
+		}
+
 		Scanner1& First() { return *m_scanner1; }
 		Scanner2& Second() { return *m_scanner2; }
 
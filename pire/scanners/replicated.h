@@ -0,0 +1,106 @@
+/*
+ * replicated.h -- per-NUMA-node replicas of a scanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_REPLICATED_H
+#define PIRE_SCANNERS_REPLICATED_H
+
+#include <atomic>
+#include <memory>
+#include "multi.h"
+#include "../memory_policy.h"
+#include "../stub/noncopyable.h"
+
+namespace Pire {
+
+/**
+ * Keeps a private copy of a scanner's tables on each NUMA node, so that
+ * threads never pay remote memory latency on transitions.
+ *
+ * A replica is made the first time a thread on its node asks for it.
+ * It is copied by that thread into memory allocated with the given
+ * MemoryPolicy, so under the default first-touch policy its pages land on
+ * that node. After that, GetScanner() costs one sched_getcpu() call and one
+ * atomic load, and takes no locks. On a single-node machine no copies are
+ * made at all and the original scanner is used.
+ *
+ * The original scanner (either owning its tables or Mmap()-ed) must outlive
+ * the replicas. Works for any scanner from multi.h.
+ */
+template<class Scanner>
+class ReplicatedScanner: public NonCopyable {
+public:
+	explicit ReplicatedScanner(const Scanner& scanner, unsigned policy = 0, size_t nodes = Impl::NumaNodesCount())
+		: m_scanner(scanner)
+		, m_policy(policy)
+		, m_nodes(nodes ? nodes : 1)
+	{
+		if (m_nodes > 1) {
+			m_replicas.reset(new std::atomic<const Scanner*>[m_nodes]);
+			for (size_t i = 0; i != m_nodes; ++i)
+				m_replicas[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	~ReplicatedScanner()
+	{
+		if (m_replicas)
+			for (size_t i = 0; i != m_nodes; ++i)
+				delete m_replicas[i].load(std::memory_order_relaxed);
+	}
+
+	/// The replica for the node the calling thread is running on
+	const Scanner& GetScanner() const { return m_replicas ? Replica(Impl::CurrentNumaNode()) : m_scanner; }
+
+	/// The replica for the given node, made on the first request
+	const Scanner& Replica(size_t node) const
+	{
+		if (!m_replicas)
+			return m_scanner;
+		std::atomic<const Scanner*>& slot = m_replicas[node % m_nodes];
+		const Scanner* replica = slot.load(std::memory_order_acquire);
+		return replica ? *replica : MakeReplica(slot);
+	}
+
+	size_t NodesCount() const { return m_nodes; }
+
+private:
+	const Scanner& MakeReplica(std::atomic<const Scanner*>& slot) const
+	{
+		std::unique_ptr<Scanner> replica(new Scanner(m_scanner));
+		replica->ApplyMemoryPolicy(m_policy);
+		// Threads racing for the same node keep whichever copy came first
+		const Scanner* existing = 0;
+		if (slot.compare_exchange_strong(existing, replica.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+			return *replica.release();
+		return *existing;
+	}
+
+	const Scanner& m_scanner;
+	unsigned m_policy;
+	size_t m_nodes;
+	std::unique_ptr<std::atomic<const Scanner*>[]> m_replicas;
+};
+
+}
+
+#endif
@@ -80,20 +80,16 @@ public:
 
 	bool TakeAction(State&, Action) const { return false; }
 
-	SimpleScanner(const SimpleScanner& s): m(s.m)
+	/// Copies share the tables (if any; mmap()-ed scanners just copy pointers)
+	SimpleScanner(const SimpleScanner& s): m(s.m), m_buffer(s.m_buffer), m_transitions(s.m_transitions) {}
+
+	/// Returns a copy having its own tables
+	SimpleScanner Clone() const
 	{
-		if (!s.m_buffer) {
-			// Empty or mmap()-ed scanner, just copy pointers
-			m_buffer = 0;
-			m_transitions = s.m_transitions;
-		} else {
-			// In-memory scanner, perform deep copy
-			m_buffer = BufferType(new char[BufSize()]);
-			memcpy(m_buffer.get(), s.m_buffer.get(), BufSize());
-			Markup(m_buffer.get());
-
-			m.initial += (m_transitions - s.m_transitions) * sizeof(Transition);
-		}
+		SimpleScanner s(*this);
+		if (!Empty())
+			s.Detach();
+		return s;
 	}
 	
 	// Makes a shallow ("weak") copy of the given scanner.
@@ -156,6 +152,20 @@ public:
 		return (s - reinterpret_cast<size_t>(m_transitions)) / (STATE_ROW_SIZE * sizeof(Transition));
 	}
 
+	/// Saves the state in a position-independent form,
+	/// which can be restored with LoadState() of any copy of the scanner.
+	void SaveState(yostream* s, const State& state) const
+	{
+		Impl::SaveStateHeader(s, StateIOTypes::SimpleScanner, Size());
+		SavePodType(s, StateIndex(state));
+	}
+
+	void LoadState(yistream* s, State& state) const
+	{
+		Impl::ValidateStateHeader(s, StateIOTypes::SimpleScanner, Size());
+		state = reinterpret_cast<size_t>(m_transitions + Impl::LoadStateIndex(s, Size()) * STATE_ROW_SIZE + 1);
+	}
+
 	// Returns the size of the memory buffer used (or required) by scanner.
 	size_t BufSize() const
 	{
@@ -171,7 +181,7 @@ protected:
 		size_t initial;
 	} m;
 
-	using BufferType = std::unique_ptr<char[]>;
+	using BufferType = Impl::SharedBuffer;
 	BufferType m_buffer;
 
 	Transition* m_transitions;
@@ -207,6 +217,17 @@ protected:
 		m_transitions = reinterpret_cast<Transition*>(ptr);
 	}
 
+	/// Replaces shared or mmap()-ed tables with a private copy
+	void Detach()
+	{
+		BufferType buffer = Impl::NewBuffer(BufSize());
+		memcpy(buffer.get(), m_transitions, BufSize());
+		const Transition* old = m_transitions;
+		Markup(buffer.get());
+		m.initial += (m_transitions - old) * sizeof(Transition);
+		m_buffer.swap(buffer);
+	}
+
 	void SetJump(size_t oldState, Char c, size_t newState)
 	{
 		Y_ASSERT(m_buffer);
@@ -239,7 +260,7 @@ inline SimpleScanner::SimpleScanner(Fsm& fsm, size_t distance)
 	fsm.Canonize();
 	
 	m.statesCount = fsm.Size();
-	m_buffer = BufferType(new char[BufSize()]);
+	m_buffer = Impl::NewBuffer(BufSize());
 	memset(m_buffer.get(), 0, BufSize());
 	Markup(m_buffer.get());
 	m.initial = reinterpret_cast<size_t>(m_transitions + fsm.Initial() * STATE_ROW_SIZE + 1);
@@ -293,6 +293,11 @@ public:
 	void Save(yostream*) const;
 	void Load(yistream*);
 
+	/// Saves the state (a set of NFA state indices),
+	/// which can be restored with LoadState() of any copy of the scanner.
+	void SaveState(yostream* s, const State& state) const;
+	void LoadState(yistream* s, State& state) const;
+
 	const State& StateIndex(const State& s) const { return s; }
 
 protected:
@@ -311,6 +316,16 @@ protected:
 		return m_actions[pos];
 	}
 
+	const unsigned* GetJumps() const
+	{
+		return m_jumps;
+	}
+
+	const Action* GetActions() const
+	{
+		return m_actions;
+	}
+
 	const TVector<Action>& GetActionsVec(size_t from) const
 	{
 		return m_actionsvec[from];
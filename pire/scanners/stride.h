@@ -0,0 +1,288 @@
+/*
+ * stride.h -- the definition of the Stride2Scanner
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#ifndef PIRE_SCANNERS_STRIDE_H
+#define PIRE_SCANNERS_STRIDE_H
+
+#include "common.h"
+#include "../run.h"
+#include "../platform.h"
+#include "../static_assert.h"
+#include "../stub/stl.h"
+#include "../stub/defaults.h"
+
+namespace Pire {
+
+/**
+ * A scanner which consumes two characters per transition in Run().
+ *
+ * It is built from any table-driven scanner with a small number of letter
+ * classes. Each state has a transition for every pair of letters, so Run()
+ * makes one dependent memory access per two characters instead of one
+ * per character. The table takes about LettersCount()^2 transitions per state,
+ * so the scanner only pays off for small automata.
+ *
+ * Functions checking the state after every character (LongestPrefix(),
+ * ShortestPrefix() and the like) and odd-sized leftovers of the input
+ * are handled one character at a time, so all of them return exactly
+ * what the original scanner would.
+ *
+ * Just like the SimpleScanner, it only knows whether a state is final,
+ * but not which of the regexps it accepts.
+ */
+class Stride2Scanner {
+public:
+	typedef ui32        Transition;
+	typedef ui8         Letter;
+	typedef ui32        Action;
+	typedef size_t      State;
+
+	/// Scanners having more letter classes are rejected, since the table
+	/// grows quadratically with their number
+	static const size_t MaxLettersCount = 32;
+
+	Stride2Scanner() { Build(TVector<TVector<size_t> >(1, TVector<size_t>(MaxCharUnaligned, 0)), TVector<ui8>(1, Dead_)); }
+
+	template<class Scanner>
+	explicit Stride2Scanner(const Scanner& scanner);
+
+	size_t Size() const { return m_table.size() / RowSize(); }
+	bool Empty() const { return Size() == 1 && !Final(0) && Dead(0); }
+
+	size_t RegexpsCount() const { return Empty() ? 0 : 1; }
+	size_t LettersCount() const { return m_lettersCount; }
+
+	/// Checks whether specified state is in any of the final sets
+	bool Final(const State& state) const { return (Flags(state) & Final_) != 0; }
+
+	bool Dead(const State& state) const { return (Flags(state) & Dead_) != 0; }
+
+	ypair<const size_t*, const size_t*> AcceptedRegexps(const State& s) const
+	{
+		static const size_t v[1] = { 0 };
+		return Final(s) ? ymake_pair(v, v + 1) : ymake_pair(v, v);
+	}
+
+	/// returns an initial state for this scanner
+	void Initialize(State& state) const { state = 0; }
+
+	/// Handles one character
+	PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	Action Next(State& state, Char c) const
+	{
+		state = Transitions(state)[m_single[c]];
+		return 0;
+	}
+
+	/// Handles two characters at once
+	PIRE_FORCED_INLINE PIRE_HOT_FUNCTION
+	void NextPair(State& state, unsigned char first, unsigned char second) const
+	{
+		state = Transitions(state)[m_first[first] + m_second[second]];
+	}
+
+	bool TakeAction(State&, Action) const { return false; }
+
+	size_t StateIndex(State s) const { return s / (RowSize() * sizeof(Transition)); }
+
+	void Swap(Stride2Scanner& s)
+	{
+		DoSwap(m_lettersCount, s.m_lettersCount);
+		m_table.swap(s.m_table);
+		for (size_t i = 0; i != MaxChar; ++i) {
+			DoSwap(m_single[i], s.m_single[i]);
+			DoSwap(m_first[i], s.m_first[i]);
+			DoSwap(m_second[i], s.m_second[i]);
+		}
+	}
+
+	// Returns the size of the memory used by the transition table
+	size_t BufSize() const { return m_table.size() * sizeof(Transition); }
+
+private:
+	enum {
+		Final_ = 1,
+		Dead_ = 2
+	};
+
+	/// Each row holds the state flags followed by LettersCount() * (LettersCount() + 1)
+	/// transitions: the (a, b) one leads to the state reached by a pair of letters,
+	/// and the (a, LettersCount()) one to the state reached by the single letter a.
+	/// Transitions hold byte offsets of rows in the table, which are also used as states.
+	size_t RowSize() const { return 1 + m_lettersCount * (m_lettersCount + 1); }
+
+	const Transition* Transitions(State state) const
+	{
+		return reinterpret_cast<const Transition*>(reinterpret_cast<const char*>(m_table.data()) + state) + 1;
+	}
+
+	ui8 Flags(State state) const { return static_cast<ui8>(Transitions(state)[-1]); }
+
+	void Build(const TVector<TVector<size_t> >& next, const TVector<ui8>& flags);
+
+	size_t m_lettersCount;
+	TVector<Transition> m_table;
+	/// Offsets of transitions in a row for the single character,
+	/// and for the first and the second characters of a pair
+	Transition m_single[MaxChar];
+	Transition m_first[MaxChar];
+	Transition m_second[MaxChar];
+};
+
+template<class Scanner>
+inline Stride2Scanner::Stride2Scanner(const Scanner& scanner)
+{
+	// Enumerate all states reachable from the initial one
+	TVector<typename Scanner::State> states;
+	TMap<size_t, size_t> indices;
+	TVector< TVector<size_t> > next;
+	TVector<ui8> flags;
+
+	typename Scanner::State st;
+	scanner.Initialize(st);
+	states.push_back(st);
+	indices[scanner.StateIndex(st)] = 0;
+	for (size_t i = 0; i != states.size(); ++i) {
+		flags.push_back((scanner.Final(states[i]) ? Final_ : 0) | (scanner.Dead(states[i]) ? Dead_ : 0));
+		next.push_back(TVector<size_t>(MaxCharUnaligned));
+		for (Char c = 0; c != MaxCharUnaligned; ++c) {
+			// Epsilon never occurs in the input
+			typename Scanner::State to = states[i];
+			if (c != Epsilon)
+				Step(scanner, to, c);
+			auto ins = indices.insert(ymake_pair(scanner.StateIndex(to), states.size()));
+			if (ins.second)
+				states.push_back(to);
+			next[i][c] = ins.first->second;
+		}
+	}
+	Build(next, flags);
+}
+
+inline void Stride2Scanner::Build(const TVector<TVector<size_t> >& next, const TVector<ui8>& flags)
+{
+	// Characters leading to the same states from every state share a letter
+	TMap<TVector<size_t>, Letter> letters;
+	TVector<Char> representatives;
+	Letter letterOf[MaxChar] = {0};
+	for (Char c = 0; c != MaxCharUnaligned; ++c) {
+		TVector<size_t> column;
+		for (size_t s = 0; s != next.size(); ++s)
+			column.push_back(next[s][c]);
+		auto ins = letters.insert(ymake_pair(column, static_cast<Letter>(representatives.size())));
+		if (ins.second) {
+			if (representatives.size() == MaxLettersCount)
+				throw Error("Pire::Stride2Scanner: the scanner has too many letter classes");
+			representatives.push_back(c);
+		}
+		letterOf[c] = ins.first->second;
+	}
+
+	m_lettersCount = representatives.size();
+	const size_t width = m_lettersCount + 1;
+	for (Char c = 0; c != MaxChar; ++c) {
+		m_single[c] = letterOf[c] * width + m_lettersCount;
+		m_first[c] = letterOf[c] * width;
+		m_second[c] = letterOf[c];
+	}
+
+	const size_t rowBytes = RowSize() * sizeof(Transition);
+	// Offsets of all the rows should fit into a transition
+	if (next.size() > static_cast<Transition>(-1) / rowBytes)
+		throw Error("Pire::Stride2Scanner: the table is too large");
+	m_table.assign(next.size() * RowSize(), 0);
+	for (size_t s = 0; s != next.size(); ++s) {
+		Transition* row = &m_table[s * RowSize()];
+		*row++ = flags[s];
+		for (size_t a = 0; a != m_lettersCount; ++a) {
+			size_t mid = next[s][representatives[a]];
+			for (size_t b = 0; b != m_lettersCount; ++b)
+				row[a * width + b] = static_cast<Transition>(next[mid][representatives[b]] * rowBytes);
+			row[a * width + m_lettersCount] = static_cast<Transition>(mid * rowBytes);
+		}
+	}
+}
+
+#ifndef PIRE_DEBUG
+
+namespace Impl {
+
+// Runs the scanner two characters at a time in Run(),
+// and one character at a time otherwise
+template<>
+struct AlignedRunner<Stride2Scanner> {
+
+	template<class Pred>
+	static inline PIRE_HOT_FUNCTION
+	Action RunAligned(const Stride2Scanner& scanner, Stride2Scanner::State& state, const size_t* begin, const size_t* end, Pred stop)
+	{
+		Stride2Scanner::State st = state;
+		Action ret = Continue;
+		for (; begin != end && (ret = RunChunk(scanner, st, begin, 0, sizeof(void*), stop)) == Continue; ++begin)
+			;
+		state = st;
+		return ret;
+	}
+
+	template<class Pred>
+	static inline PIRE_HOT_FUNCTION
+	Action RunAlignedReverse(const Stride2Scanner& scanner, Stride2Scanner::State& state, const size_t* begin, const size_t* end, Pred stop)
+	{
+		Stride2Scanner::State st = state;
+		Action ret = Continue;
+		for (; end != begin && (ret = RunChunkReverse(scanner, st, end - 1, 0, sizeof(void*), stop)) == Continue; --end)
+			;
+		state = st;
+		return ret;
+	}
+
+	static inline PIRE_HOT_FUNCTION
+	Action RunAligned(const Stride2Scanner& scanner, Stride2Scanner::State& state, const size_t* begin, const size_t* end, RunPred<Stride2Scanner>)
+	{
+		PIRE_STATIC_ASSERT(sizeof(size_t) % 2 == 0);
+		Stride2Scanner::State st = state;
+		for (; begin != end; ++begin) {
+			size_t chunk = ToLittleEndian(*begin);
+			for (size_t i = sizeof(chunk); i != 0; i -= 2) {
+				scanner.NextPair(st, chunk & 0xFF, (chunk >> 8) & 0xFF);
+				chunk >>= 16;
+			}
+		}
+		state = st;
+		return Continue;
+	}
+};
+
+}
+
+#endif
+
+}
+
+namespace std {
+	inline void swap(Pire::Stride2Scanner& a, Pire::Stride2Scanner& b) {
+		a.Swap(b);
+	}
+}
+
+#endif
@@ -26,13 +26,11 @@
 
 namespace Pire {
 	
-	// FIXME: not thread safe.
+	// Thread safe, since C++11 initializes local statics only once
 	template<class T>
 	T* Singleton()
 	{
-		static T* p = 0;
-		if (!p)
-			p = new T;
+		static T* p = new T;
 		return p;
 	}
 	template<class T>
@@ -64,10 +64,12 @@ void Usage()
 
 void Generate(const std::string& outputFile)
 {
-    Pire::Fsm re = Pire::Fsm::MakeFalse();
+    Pire::TVector<Pire::ystring> domains;
     std::string domain;
     while (std::cin >> domain)
-        re |= Pire::Fsm().Append(domain);
+        domains.push_back(domain);
+    // Much faster than uniting a separate FSM for each domain
+    Pire::Fsm re = Pire::Fsm::FromStrings(domains);
     re = Pire::Lexer("^([a-z]+://)?([A-Za-z0-9\\-]+\\.)*").Parse() + re + Pire::Lexer("(/.*)?$").Parse();
     
     std::fstream ofs(outputFile.c_str(), std::ios::out | std::ios::binary);
@@ -0,0 +1,232 @@
+/*
+ * archive_ut.cpp --
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include <stub/hacks.h>
+#include <stub/saveload.h>
+#include <stub/memstreams.h>
+#include "stub/cppunit.h"
+#include <pire.h>
+#include <extra.h>
+#include <string.h>
+#include <stdio.h>
+#include <fstream>
+
+SIMPLE_UNIT_TEST_SUITE(TestArchive) {
+
+	Pire::Fsm MkFsm(const char* regexp)
+	{
+		return Pire::Lexer(regexp).Parse();
+	}
+
+	bool Matches(const Pire::Scanner& scanner, const char* str)
+	{
+		return Pire::Runner(scanner).Begin().Run(str, str + strlen(str)).End();
+	}
+
+	size_t Count(const Pire::CountingScanner& scanner, const char* str)
+	{
+		Pire::CountingScanner::State state;
+		scanner.Initialize(state);
+		Pire::Step(scanner, state, Pire::BeginMark);
+		Pire::Run(scanner, state, str, str + strlen(str));
+		Pire::Step(scanner, state, Pire::EndMark);
+		return state.Result(0);
+	}
+
+	ystring MakeArchive(bool checksums = true)
+	{
+		Pire::ArchiveWriter writer(Pire::ArchiveWriter::DefaultAlignment, checksums);
+		writer.Add("words", MkFsm("^[a-z]+$").Compile<Pire::Scanner>());
+		writer.Add("numbers", MkFsm("^[0-9]+$").Compile<Pire::Scanner>());
+		writer.Add("counter", Pire::CountingScanner(MkFsm("[a-z]+"), MkFsm(".*")));
+		writer.Add("nonreloc", MkFsm("^[0-9]+$").Compile<Pire::NonrelocScanner>());
+		BufferOutput buf;
+		writer.Save(&buf);
+		return ystring(buf.Buffer().Data(), buf.Buffer().Size());
+	}
+
+	// Copies data into a properly aligned buffer
+	const char* Place(TVector<size_t>& buf, const ystring& data)
+	{
+		buf.assign(data.size() / sizeof(size_t) + 1, 0);
+		memcpy(buf.data(), data.data(), data.size());
+		return reinterpret_cast<const char*>(buf.data());
+	}
+
+	SIMPLE_UNIT_TEST(Crc32c)
+	{
+		const char str[] = "123456789";
+		UNIT_ASSERT_EQUAL(Pire::Impl::Crc32c(str, 9), (Pire::ui32) 0xE3069283);
+		UNIT_ASSERT_EQUAL(Pire::Impl::Crc32c(str + 4, 5, Pire::Impl::Crc32c(str, 4)), (Pire::ui32) 0xE3069283);
+		UNIT_ASSERT_EQUAL(Pire::Impl::Crc32c(str, 0), (Pire::ui32) 0);
+
+		// Unaligned heads and tails
+		char buf[64];
+		for (size_t i = 0; i != sizeof(buf); ++i)
+			buf[i] = static_cast<char>(i * 7);
+		for (size_t i = 0; i != 9; ++i)
+			UNIT_ASSERT_EQUAL(Pire::Impl::Crc32c(buf + i, sizeof(buf) - 2 * i),
+				Pire::Impl::Crc32c(buf + i + 3, sizeof(buf) - 2 * i - 3, Pire::Impl::Crc32c(buf + i, 3)));
+	}
+
+	SIMPLE_UNIT_TEST(Directory)
+	{
+		TVector<size_t> buf;
+		ystring data = MakeArchive();
+		const char* ptr = Place(buf, data);
+		Pire::Archive archive(ptr, data.size());
+
+		UNIT_ASSERT_EQUAL(archive.Size(), (size_t) 4);
+		UNIT_ASSERT(archive.HasChecksums());
+		UNIT_ASSERT_EQUAL(archive.Name(0), ystring("counter"));
+		UNIT_ASSERT_EQUAL(archive.Name(3), ystring("words"));
+		UNIT_ASSERT_EQUAL(archive.Type(3), (Pire::ui32) Pire::ScannerIOTypes::Scanner);
+		UNIT_ASSERT(archive.Has("numbers"));
+		UNIT_ASSERT(!archive.Has("number"));
+		UNIT_ASSERT(!archive.Has("zzz"));
+
+		// Each object starts on its own page
+		for (size_t i = 0; i != archive.Size(); ++i) {
+			const char* entry = static_cast<const char*>(archive.Get(archive.Name(i)).first);
+			UNIT_ASSERT_EQUAL((entry - ptr) % Pire::ArchiveWriter::DefaultAlignment, (size_t) 0);
+		}
+
+		try {
+			archive.Get("zzz");
+			UNIT_ASSERT(!"Failed to report a missing entry");
+		}
+		catch (Pire::Error&) {}
+
+		Pire::ArchiveWriter writer;
+		writer.Add("a", Pire::Scanner());
+		try {
+			writer.Add("a", Pire::Scanner());
+			UNIT_ASSERT(!"Failed to report a duplicate entry");
+		}
+		catch (Pire::Error&) {}
+	}
+
+	SIMPLE_UNIT_TEST(Entries)
+	{
+		TVector<size_t> buf;
+		ystring data = MakeArchive();
+		Pire::Archive archive(Place(buf, data), data.size());
+
+		Pire::Scanner words, numbers;
+		archive.Mmap("words", words, true);
+		archive.Mmap("numbers", numbers);
+		UNIT_ASSERT(Matches(words, "abc"));
+		UNIT_ASSERT(!Matches(words, "123"));
+		UNIT_ASSERT(Matches(numbers, "123"));
+		UNIT_ASSERT(!Matches(numbers, "abc"));
+
+		Pire::CountingScanner counter;
+		archive.Mmap("counter", counter, true);
+		UNIT_ASSERT_EQUAL(Count(counter, "abc 123 de f"), (size_t) 3);
+
+		Pire::NonrelocScanner nonreloc;
+		archive.Load("nonreloc", nonreloc, true);
+		UNIT_ASSERT(Pire::Runner(nonreloc).Begin().Run("42", 2).End());
+
+		// Entries of mismatching types are rejected by scanners themselves
+		try {
+			archive.Mmap("counter", words);
+			UNIT_ASSERT(!"Failed to check the entry type");
+		}
+		catch (Pire::Error&) {}
+	}
+
+	SIMPLE_UNIT_TEST(Checksums)
+	{
+		TVector<size_t> buf;
+		ystring data = MakeArchive();
+		const char* ptr = Place(buf, data);
+		Pire::Archive archive(ptr, data.size());
+
+		// Damage the last bytes of a single entry
+		ypair<const void*, size_t> words = archive.Get("words");
+		const_cast<char*>(static_cast<const char*>(words.first))[words.second - 1] ^= 1;
+
+		archive.Get("words");
+		archive.Get("numbers", true);
+		try {
+			archive.Get("words", true);
+			UNIT_ASSERT(!"Failed to verify the checksum");
+		}
+		catch (Pire::Error&) {}
+
+		// Without checksums nothing is verified
+		data = MakeArchive(false);
+		Pire::Archive unchecked(Place(buf, data), data.size());
+		UNIT_ASSERT(!unchecked.HasChecksums());
+		unchecked.Get("words", true);
+	}
+
+	SIMPLE_UNIT_TEST(Corrupted)
+	{
+		TVector<size_t> buf;
+		ystring data = MakeArchive();
+		const char* ptr = Place(buf, data);
+
+		// Entries past the end
+		try {
+			Pire::Archive(ptr, data.size() - Pire::ArchiveWriter::DefaultAlignment);
+			UNIT_ASSERT(!"Failed to check the directory");
+		}
+		catch (Pire::Error&) {}
+
+		// Not an archive at all
+		BufferOutput scanner;
+		Save(&scanner, Pire::Scanner());
+		ystring notArchive(scanner.Buffer().Data(), scanner.Buffer().Size());
+		try {
+			Pire::Archive(Place(buf, notArchive), notArchive.size());
+			UNIT_ASSERT(!"Failed to check the header");
+		}
+		catch (Pire::Error&) {}
+
+		// Empty archives are fine
+		BufferOutput empty;
+		Pire::ArchiveWriter().Save(&empty);
+		ystring emptyData(empty.Buffer().Data(), empty.Buffer().Size());
+		UNIT_ASSERT_EQUAL(Pire::Archive(Place(buf, emptyData), emptyData.size()).Size(), (size_t) 0);
+	}
+
+	SIMPLE_UNIT_TEST(MappedArchive)
+	{
+		const char* filename = "archive_ut.tmp";
+		ystring data = MakeArchive();
+		{
+			std::ofstream out(filename, std::ios::binary);
+			out.write(data.data(), data.size());
+		}
+		{
+			Pire::MappedArchive archive(filename);
+			UNIT_ASSERT_EQUAL(archive.Size(), (size_t) 4);
+			Pire::Scanner words;
+			archive.Mmap("words", words, true);
+			UNIT_ASSERT(Matches(words, "abc"));
+		}
+		remove(filename);
+	}
+}
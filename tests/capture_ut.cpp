@@ -301,6 +301,82 @@ SIMPLE_UNIT_TEST_SUITE(TestPireCapture) {
 		MakeSlowCapturingTest(regexp, text, 2, true, ystring("100500"));
 	}
 
+	SIMPLE_UNIT_TEST(SlowCapturingStateReuse)
+	{
+		SlowCapturingScanner sc = SlowCompile(".*(pref.*suff)", 1);
+		SlowCapturingScanner::State st;
+		SlowCapturingScanner::SingleState fin;
+		for (const char* text : {"pref ala bla pref cla suff dla", "no match here", "xx pref yy suff"}) {
+			sc.Initialize(st);
+			Run(sc, st, text, text + strlen(text));
+			SlowCapturingScanner::State fresh = RunRegexp(sc, text);
+			UNIT_ASSERT_EQUAL(st.GetSize(), fresh.GetSize());
+			UNIT_ASSERT_EQUAL(sc.GetCapture(st, fin), sc.GetCapture(fresh, fin));
+		}
+		sc.Initialize(st);
+		const char* text = "xx pref yy suff";
+		Run(sc, st, text, text + strlen(text));
+		UNIT_ASSERT(sc.GetCapture(st, fin));
+		UNIT_ASSERT_EQUAL(ystring(text, fin.GetBegin(), fin.GetEnd() - fin.GetBegin()), ystring("pref yy suff"));
+	}
+
+	SIMPLE_UNIT_TEST(StateSerialization)
+	{
+		const char* text = "xx pref ala bla pref cla suff dla";
+		const char* mid = text + 12;
+		const char* end = text + strlen(text);
+
+		CapturingScanner fast = Compile("pref(.*)suff", 1);
+		State head;
+		fast.Initialize(head);
+		Step(fast, head, Pire::BeginMark);
+		Run(fast, head, text, mid);
+		SlowCapturingScanner slow = SlowCompile(".*?(pref.*suff)", 1);
+		SlowCapturingScanner::State slowHead;
+		slow.Initialize(slowHead);
+		Run(slow, slowHead, text, mid);
+
+		BufferOutput wbuf;
+		fast.SaveState(&wbuf, head);
+		slow.SaveState(&wbuf, slowHead);
+
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		CapturingScanner fastCopy(fast);
+		State tail;
+		fastCopy.LoadState(&rbuf, tail);
+		Run(fastCopy, tail, mid, end);
+		Step(fastCopy, tail, Pire::EndMark);
+		State full = RunRegexp(fast, text);
+		UNIT_ASSERT(tail.Captured());
+		UNIT_ASSERT_EQUAL(tail.Begin(), full.Begin());
+		UNIT_ASSERT_EQUAL(tail.End(), full.End());
+
+		SlowCapturingScanner slowCopy(slow);
+		SlowCapturingScanner::State slowTail;
+		slowCopy.LoadState(&rbuf, slowTail);
+		Run(slowCopy, slowTail, mid, end);
+		SlowCapturingScanner::SingleState fin;
+		UNIT_ASSERT(slowCopy.GetCapture(slowTail, fin));
+		UNIT_ASSERT_EQUAL(ystring(text, fin.GetBegin(), fin.GetEnd() - fin.GetBegin()), ystring("pref ala bla pref cla suff"));
+
+		// A truncated image leaves the state alone
+		BufferOutput sbuf;
+		slow.SaveState(&sbuf, slowHead);
+		SlowCapturingScanner::State other;
+		slow.Initialize(other);
+		Run(slow, other, text, text + 3);
+		size_t pos = other.GetPos(), size = other.GetSize();
+		UNIT_ASSERT(pos != slowHead.GetPos());
+		MemoryInput tbuf(sbuf.Buffer().Data(), sbuf.Buffer().Size() - 1);
+		try {
+			slow.LoadState(&tbuf, other);
+			UNIT_ASSERT(!"a truncated state loaded");
+		}
+		catch (std::exception&) {}
+		UNIT_ASSERT_EQUAL(other.GetPos(), pos);
+		UNIT_ASSERT_EQUAL(other.GetSize(), size);
+	}
+
 	SIMPLE_UNIT_TEST(Utf_8)
 	{
 		const char* regexp = "\xd0\x97\xd0\xb4\xd1\x80\xd0\xb0\xd0\xb2\xd1\x81\xd1\x82\xd0\xb2\xd1\x83\xd0\xb9\xd1\x82\xd0\xb5, ((\\s|\\w|[()]|-)+)!";
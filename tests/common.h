@@ -84,6 +84,9 @@ struct Scanners {
 	Pire::SlowScanner slow;
 	Pire::ScannerNoMask fastNoMask;
 	Pire::NonrelocScannerNoMask nonrelocNoMask;
+	Pire::NonrelocTaggedScanner nonrelocTagged;
+	Pire::NonrelocSplitScanner nonrelocSplit;
+	Pire::ClassMaskScanner fastClassMask;
 	Pire::HalfFinalScanner halfFinal;
 	Pire::HalfFinalScannerNoMask halfFinalNoMask;
 	Pire::NonrelocHalfFinalScanner nonrelocHalfFinal;
@@ -96,6 +99,9 @@ struct Scanners {
 		, slow(Pire::Fsm(fsm).Compile<Pire::SlowScanner>(distance))
 		, fastNoMask(Pire::Fsm(fsm).Compile<Pire::ScannerNoMask>(distance))
  		, nonrelocNoMask(Pire::Fsm(fsm).Compile<Pire::NonrelocScannerNoMask>(distance))
+		, nonrelocTagged(Pire::Fsm(fsm).Compile<Pire::NonrelocTaggedScanner>(distance))
+		, nonrelocSplit(Pire::Fsm(fsm).Compile<Pire::NonrelocSplitScanner>(distance))
+		, fastClassMask(Pire::Fsm(fsm).Compile<Pire::ClassMaskScanner>(distance))
 		, halfFinal(Pire::Fsm(fsm).Compile<Pire::HalfFinalScanner>(distance))
 		, halfFinalNoMask(Pire::Fsm(fsm).Compile<Pire::HalfFinalScannerNoMask>(distance))
 		, nonrelocHalfFinal(Pire::Fsm(fsm).Compile<Pire::NonrelocHalfFinalScanner>(distance))
@@ -111,6 +117,9 @@ struct Scanners {
 		slow = Pire::Fsm(fsm).Compile<Pire::SlowScanner>();
 		fastNoMask = Pire::Fsm(fsm).Compile<Pire::ScannerNoMask>();
 		nonrelocNoMask = Pire::Fsm(fsm).Compile<Pire::NonrelocScannerNoMask>();
+		nonrelocTagged = Pire::Fsm(fsm).Compile<Pire::NonrelocTaggedScanner>();
+		nonrelocSplit = Pire::Fsm(fsm).Compile<Pire::NonrelocSplitScanner>();
+		fastClassMask = Pire::Fsm(fsm).Compile<Pire::ClassMaskScanner>();
 		halfFinal = Pire::Fsm(fsm).Compile<Pire::HalfFinalScanner>();
 		halfFinalNoMask = Pire::Fsm(fsm).Compile<Pire::HalfFinalScannerNoMask>();
 		nonrelocHalfFinal = Pire::Fsm(fsm).Compile<Pire::NonrelocHalfFinalScanner>();
@@ -200,6 +209,9 @@ bool Matches(const Scanner& scanner, const char* str)
 		UNIT_ASSERT(Matches(m_scanners.slow, str));\
 		UNIT_ASSERT(Matches(m_scanners.fastNoMask, str));\
 		UNIT_ASSERT(Matches(m_scanners.nonrelocNoMask, str));\
+		UNIT_ASSERT(Matches(m_scanners.nonrelocTagged, str));\
+		UNIT_ASSERT(Matches(m_scanners.nonrelocSplit, str));\
+		UNIT_ASSERT(Matches(m_scanners.fastClassMask, str));\
 		UNIT_ASSERT(Matches(m_scanners.halfFinal, str));\
 		UNIT_ASSERT(Matches(m_scanners.halfFinalNoMask, str));\
 		UNIT_ASSERT(Matches(m_scanners.nonrelocHalfFinal, str));\
@@ -214,6 +226,9 @@ bool Matches(const Scanner& scanner, const char* str)
 		UNIT_ASSERT(!Matches(m_scanners.slow, str));\
 		UNIT_ASSERT(!Matches(m_scanners.fastNoMask, str));\
 		UNIT_ASSERT(!Matches(m_scanners.nonrelocNoMask, str));\
+		UNIT_ASSERT(!Matches(m_scanners.nonrelocTagged, str));\
+		UNIT_ASSERT(!Matches(m_scanners.nonrelocSplit, str));\
+		UNIT_ASSERT(!Matches(m_scanners.fastClassMask, str));\
 		UNIT_ASSERT(!Matches(m_scanners.halfFinal, str));\
 		UNIT_ASSERT(!Matches(m_scanners.halfFinalNoMask, str));\
 		UNIT_ASSERT(!Matches(m_scanners.nonrelocHalfFinal, str));\
@@ -0,0 +1,249 @@
+/*
+ * compile_service_ut.cpp --
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+
+#include <stub/hacks.h>
+#include <stub/saveload.h>
+#include <stub/memstreams.h>
+#include "stub/cppunit.h"
+#include <pire.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+SIMPLE_UNIT_TEST_SUITE(TestCompileService) {
+
+	TVector<ystring> Patterns(size_t count)
+	{
+		TVector<ystring> patterns;
+		for (size_t i = 0; i != count; ++i)
+			patterns.push_back("^w" + Pire::ToString(i) + "[a-c]*x$");
+		return patterns;
+	}
+
+	Pire::Scanner CompileSerially(const TVector<ystring>& patterns)
+	{
+		Pire::Scanner sc;
+		for (auto&& pattern : patterns)
+			sc = Pire::Scanner::Glue(sc, Pire::Lexer(pattern).Parse().Compile<Pire::Scanner>());
+		return sc;
+	}
+
+	TVector<size_t> Accepted(const Pire::Scanner& scanner, const ystring& str)
+	{
+		Pire::Scanner::State state = Pire::Runner(scanner).Begin().Run(str.c_str(), str.c_str() + str.size()).End().State();
+		auto accepted = scanner.AcceptedRegexps(state);
+		return TVector<size_t>(accepted.first, accepted.second);
+	}
+
+	SIMPLE_UNIT_TEST(SameAsSerial)
+	{
+		TVector<ystring> patterns = Patterns(23);
+		patterns.push_back("^w1.*x$");
+		Pire::Scanner serial = CompileSerially(patterns);
+
+		Pire::CompileService service(4);
+		UNIT_ASSERT_EQUAL(service.ThreadsCount(), size_t(4));
+		Pire::CompileJob<Pire::Scanner> job = service.Compile<Pire::Scanner>(patterns);
+		Pire::Scanner parallel = job.Get();
+		UNIT_ASSERT(job.Ready());
+		UNIT_ASSERT_EQUAL(job.StepsDone(), 2 * patterns.size() - 1);
+		UNIT_ASSERT_EQUAL(parallel.RegexpsCount(), patterns.size());
+
+		const char* inputs[] = { "w0x", "w1abcx", "w12x", "w17cx", "w22aax", "w1zzx", "w23x", "abc", "" };
+		for (auto&& input : inputs)
+			UNIT_ASSERT(Accepted(parallel, input) == Accepted(serial, input));
+		UNIT_ASSERT_EQUAL(Accepted(parallel, "w12x").size(), size_t(2));
+	}
+
+	SIMPLE_UNIT_TEST(Options)
+	{
+		Pire::CompileService service(2);
+
+		// Literals, surrounded by anything
+		TVector<ystring> words;
+		words.push_back("bad");
+		words.push_back("ugly");
+		words.push_back("evil");
+		Pire::CompileOptions options;
+		options.Parse = [](const ystring& word) { Pire::Fsm fsm; fsm.Append(word); return fsm; };
+		options.Surround = true;
+		std::mutex lock;
+		TVector<size_t> progress;
+		size_t total = 0, maxBytes = 0;
+		options.Progress = [&](size_t done, size_t all) {
+			std::lock_guard<std::mutex> guard(lock);
+			progress.push_back(done);
+			total = all;
+		};
+		options.Memory = [&](size_t bytes) {
+			maxBytes = ymax(maxBytes, bytes);
+			return true;
+		};
+		Pire::Scanner sc = service.Compile<Pire::Scanner>(words, options).Get();
+		UNIT_ASSERT_EQUAL(Accepted(sc, "an ugly one"), TVector<size_t>(1, 1));
+		UNIT_ASSERT(Accepted(sc, "u.g.l.y").empty());
+		UNIT_ASSERT_EQUAL(total, size_t(5));
+		UNIT_ASSERT_EQUAL(progress.size(), size_t(5));
+		for (size_t i = 0; i != progress.size(); ++i)
+			UNIT_ASSERT_EQUAL(progress[i], i + 1);
+		UNIT_ASSERT(maxBytes > 0);
+
+		// Nothing to compile
+		Pire::CompileJob<Pire::Scanner> empty = service.Compile<Pire::Scanner>(TVector<ystring>());
+		UNIT_ASSERT(empty.Ready());
+		UNIT_ASSERT(empty.Get().Empty());
+	}
+
+	SIMPLE_UNIT_TEST(Errors)
+	{
+		Pire::CompileService service(2);
+
+		TVector<ystring> patterns = Patterns(8);
+		patterns[5] = "(unbalanced";
+		try {
+			service.Compile<Pire::Scanner>(patterns).Get();
+			UNIT_ASSERT(!"parse error expected");
+		} catch (Pire::Error&) {}
+
+		// Scanners too large to be glued
+		Pire::CompileOptions options;
+		options.MaxSize = 10;
+		try {
+			service.Compile<Pire::Scanner>(Patterns(8), options).Get();
+			UNIT_ASSERT(!"glue error expected");
+		} catch (Pire::Error&) {}
+
+		// Running out of memory
+		options = Pire::CompileOptions();
+		options.Memory = [](size_t bytes) { return bytes < 1; };
+		try {
+			service.Compile<Pire::Scanner>(Patterns(8), options).Get();
+			UNIT_ASSERT(!"cancellation expected");
+		} catch (Pire::Error&) {}
+
+		// Callbacks may use the job
+		options = Pire::CompileOptions();
+		std::atomic<Pire::CompileJob<Pire::Scanner>*> current(0);
+		std::atomic<size_t> seen(0);
+		options.Progress = [&](size_t done, size_t) {
+			if (done != 2)
+				return;
+			Pire::CompileJob<Pire::Scanner>* job;
+			while (!(job = current.load()))
+				std::this_thread::yield();
+			seen = job->Ready() ? 0 : job->StepsDone();
+			job->Cancel();
+		};
+		Pire::CompileJob<Pire::Scanner> job = service.Compile<Pire::Scanner>(Patterns(8), options);
+		current = &job;
+		try {
+			job.Get();
+			UNIT_ASSERT(!"cancellation expected");
+		} catch (Pire::Error&) {}
+		UNIT_ASSERT(seen.load() >= 2);
+	}
+
+	SIMPLE_UNIT_TEST(AnchoredLiterals)
+	{
+		ystring literal;
+		UNIT_ASSERT(Pire::AnchoredLiteral("^/index\\.html$", literal));
+		UNIT_ASSERT_EQUAL(literal, ystring("/index.html"));
+		UNIT_ASSERT(Pire::AnchoredLiteral("^a\\$\\\\$", literal));
+		UNIT_ASSERT_EQUAL(literal, ystring("a$\\"));
+		UNIT_ASSERT(Pire::AnchoredLiteral("^$", literal));
+		UNIT_ASSERT(literal.empty());
+
+		const char* regexps[] = { "abc", "^abc", "abc$", "^a.c$", "^ab?$", "^a|b$", "^[ab]$", "^a{2}$", "^\\d$", "^a\\$", "^caf\xC3\xA9$", "$" };
+		for (auto&& regexp : regexps)
+			UNIT_ASSERT(!Pire::AnchoredLiteral(regexp, literal));
+	}
+
+	SIMPLE_UNIT_TEST(Hybrid)
+	{
+		TVector<ystring> patterns = Patterns(12);
+		patterns.insert(patterns.begin() + 2, "^/index\\.html$");
+		patterns.insert(patterns.begin() + 5, "^w3x$");
+		patterns.push_back("^/index\\.html$");
+		patterns.push_back("^$");
+		patterns.push_back("^/a\\+b$");
+		Pire::Scanner serial = CompileSerially(patterns);
+
+		Pire::CompileService service(2);
+		Pire::HybridScanner<Pire::Scanner> hybrid = service.CompileHybrid<Pire::Scanner>(patterns).Get();
+		UNIT_ASSERT_EQUAL(hybrid.RegexpsCount(), patterns.size());
+		UNIT_ASSERT_EQUAL(hybrid.Literals().LiteralsCount(), size_t(5));
+		UNIT_ASSERT_EQUAL(hybrid.Regexps().RegexpsCount(), size_t(12));
+
+		const char* inputs[] = { "/index.html", "/index-html", "w3x", "w3aax", "w10bx", "", "/a+b", "/ab", "w" };
+		TVector<size_t> ids;
+		for (auto&& input : inputs) {
+			ystring str(input);
+			hybrid.Match(str.c_str(), str.c_str() + str.size(), ids);
+			UNIT_ASSERT(ids == Accepted(serial, str));
+			UNIT_ASSERT_EQUAL(hybrid.Matches(str.c_str(), str.c_str() + str.size()), !ids.empty());
+		}
+		hybrid.Match("w3x", "w3x" + 3, ids);
+		UNIT_ASSERT_EQUAL(ids.size(), size_t(2));
+
+		// Nothing left to glue
+		TVector<ystring> literals = { "^a$", "^b$", "^a$" };
+		hybrid = service.CompileHybrid<Pire::Scanner>(literals).Get();
+		UNIT_ASSERT(hybrid.Regexps().Empty());
+		hybrid.Match("a", "a" + 1, ids);
+		UNIT_ASSERT(ids == TVector<size_t>({ 0, 2 }));
+		UNIT_ASSERT(!hybrid.Matches("c", "c" + 1));
+
+		// Patterns of another syntax are left to the parser
+		Pire::CompileOptions options;
+		options.Parse = [](const ystring& pattern) { return Pire::Lexer(pattern).AddFeature(Pire::Features::CaseInsensitive()).Parse(); };
+		hybrid = service.CompileHybrid<Pire::Scanner>(literals, options).Get();
+		UNIT_ASSERT_EQUAL(hybrid.Literals().LiteralsCount(), size_t(0));
+		UNIT_ASSERT(hybrid.Matches("A", "A" + 1));
+	}
+
+	SIMPLE_UNIT_TEST(Cancel)
+	{
+		Pire::CompileService service(1);
+
+		// Keeps the only thread busy until the job is cancelled
+		std::atomic<bool> cancelled(false);
+		Pire::CompileOptions options;
+		options.Parse = [&](const ystring& pattern) {
+			while (!cancelled)
+				std::this_thread::yield();
+			return Pire::Lexer(pattern).Parse();
+		};
+		Pire::CompileJob<Pire::Scanner> job = service.Compile<Pire::Scanner>(Patterns(16), options);
+		UNIT_ASSERT(!job.WaitFor(std::chrono::milliseconds(1)));
+		job.Cancel();
+		cancelled = true;
+		UNIT_ASSERT(job.Ready());
+		try {
+			job.Get();
+			UNIT_ASSERT(!"cancellation expected");
+		} catch (Pire::Error&) {}
+		job.Wait();
+		UNIT_ASSERT(job.StepsDone() < job.StepsTotal());
+	}
+}
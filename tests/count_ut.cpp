@@ -209,6 +209,26 @@ SIMPLE_UNIT_TEST_SUITE(TestCount) {
 		CountGlueOne<Pire::NoGlueLimitCountingScanner>();
 	}
 
+	template <class Scanner>
+	void CountCloneOne()
+	{
+		const auto& enc = Pire::Encodings::Utf8();
+		Scanner sc(MkFsm("[a-z]+", enc), MkFsm("\\s", enc));
+		Scanner copy(sc);
+		Scanner clone = sc.Clone();
+		sc = Scanner();
+		UNIT_ASSERT_EQUAL(Run(copy, "abc def, abc def ghi, abc").Result(0), size_t(3));
+		copy = Scanner();
+		UNIT_ASSERT_EQUAL(Run(clone, "abc def, abc def ghi, abc").Result(0), size_t(3));
+	}
+
+	SIMPLE_UNIT_TEST(CountClone)
+	{
+		CountCloneOne<Pire::CountingScanner>();
+		CountCloneOne<Pire::AdvancedCountingScanner>();
+		CountCloneOne<Pire::NoGlueLimitCountingScanner>();
+	}
+
 	template <class Scanner>
 	void CountManyGluesOne(size_t maxRegexps) {
 		const auto& encoding = Pire::Encodings::Utf8();
@@ -415,6 +435,157 @@ SIMPLE_UNIT_TEST_SUITE(TestCount) {
 		}
 	}
 
+	template<class Scanner>
+	void CountStateResumeOne(const Scanner& scanner, const char* text)
+	{
+		const char* mid = text + strlen(text) / 2;
+		const char* end = text + strlen(text);
+		auto head = InitializedState(scanner);
+		Pire::Step(scanner, head, Pire::BeginMark);
+		Pire::Run(scanner, head, text, mid);
+		BufferOutput wbuf;
+		scanner.SaveState(&wbuf, head);
+
+		Scanner copy(scanner);
+		typename Scanner::State tail;
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		copy.LoadState(&rbuf, tail);
+		Pire::Run(copy, tail, mid, end);
+		Pire::Step(copy, tail, Pire::EndMark);
+
+		auto full = Run(scanner, text);
+		for (size_t i = 0; i < scanner.RegexpsCount(); ++i)
+			UNIT_ASSERT_EQUAL(tail.Result(i), full.Result(i));
+	}
+
+	SIMPLE_UNIT_TEST(StateSerialization)
+	{
+		const auto& enc = Pire::Encodings::Latin1();
+		const char* text = "abc 123 de 4567 fghij 89";
+		auto sc1 = Pire::AdvancedCountingScanner(MkFsm("[a-z]+", enc), MkFsm(".*", enc));
+		auto sc2 = Pire::AdvancedCountingScanner(MkFsm("[0-9]+", enc), MkFsm(".*", enc));
+		CountStateResumeOne(Pire::CountingScanner(MkFsm("[a-z]+", enc), MkFsm(".*", enc)), text);
+		CountStateResumeOne(Pire::AdvancedCountingScanner::Glue(sc1, sc2), text);
+		auto ng1 = Pire::NoGlueLimitCountingScanner(MkFsm("[a-z]+", enc), MkFsm(".*", enc));
+		auto ng2 = Pire::NoGlueLimitCountingScanner(MkFsm("[0-9]+", enc), MkFsm(".*", enc));
+		CountStateResumeOne(Pire::NoGlueLimitCountingScanner::Glue(ng1, ng2), text);
+	}
+
+	template<class From, class To>
+	void RejectStateOne(const From& from, const To& to)
+	{
+		UNIT_ASSERT_EQUAL(from.Size(), to.Size());
+		auto st = InitializedState(from);
+		BufferOutput wbuf;
+		from.SaveState(&wbuf, st);
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		typename To::State other;
+		try {
+			to.LoadState(&rbuf, other);
+			UNIT_ASSERT(!"Scanner accepted a state of another kind");
+		}
+		catch (Pire::Error&) {}
+	}
+
+	SIMPLE_UNIT_TEST(StateOfAnotherKind)
+	{
+		const auto& enc = Pire::Encodings::Latin1();
+		const char* capture = "abcd(e)fg";
+		Pire::Lexer lexer(capture, capture + strlen(capture));
+		lexer.SetEncoding(enc).AddFeature(Pire::Features::Capture(1));
+		const auto capturing = lexer.Parse().Surround().Compile<Pire::CapturingScanner>();
+		const Pire::CountingScanner counting(MkFsm("[a-z]+", enc), MkFsm("\\s", enc));
+		RejectStateOne(counting, capturing);
+		RejectStateOne(capturing, counting);
+
+		const Pire::CountingScanner small(MkFsm("a", enc), MkFsm("\\s", enc));
+		const Pire::AdvancedCountingScanner advanced(MkFsm("abc", enc), MkFsm("\\s", enc));
+		RejectStateOne(small, advanced);
+		RejectStateOne(advanced, small);
+	}
+
+	SIMPLE_UNIT_TEST(CompileBudget)
+	{
+		const auto& enc = Pire::Encodings::Latin1();
+		const char* text = "axxxxxxxxb axxxxxxxb axxxxxxxxb";
+		const auto re = MkFsm("a.{8}b", enc);
+		const auto sep = MkFsm(".*", enc);
+		const auto expected = Run(Pire::AdvancedCountingScanner(re, sep), text).Result(0);
+
+		Pire::CountingCompileReport report;
+		Pire::AdvancedCountingScanner roomy(re, sep, Pire::CountingCompileBudget(100000), &report);
+		UNIT_ASSERT_EQUAL(report.Used, Pire::CountingCompileReport::Advanced);
+		UNIT_ASSERT(report.Reason.empty());
+		UNIT_ASSERT_EQUAL(Run(roomy, text).Result(0), expected);
+
+		Pire::NoGlueLimitCountingScanner tight(re, sep, Pire::CountingCompileBudget(100), &report);
+		UNIT_ASSERT_EQUAL(report.Used, Pire::CountingCompileReport::AdvancedSimple);
+		UNIT_ASSERT(!report.Reason.empty());
+		UNIT_ASSERT(tight.Size() <= 100);
+		UNIT_ASSERT_EQUAL(Run(tight, text).Result(0), size_t(2));
+
+		Pire::AdvancedCountingScanner small(re, sep, Pire::CountingCompileBudget(0, 64 * 1024), &report);
+		UNIT_ASSERT(small.BufSize() <= 64 * 1024);
+
+		// Neither advanced automaton fits, so the compiler falls back
+		// to the one of the CountingScanner, which should count the same
+		const auto space = MkFsm("\\s", enc);
+		Pire::AdvancedCountingScanner classic(re, space, Pire::CountingCompileBudget(17), &report);
+		UNIT_ASSERT_EQUAL(report.Used, Pire::CountingCompileReport::Classic);
+		UNIT_ASSERT(classic.Size() <= 17);
+		const Pire::CountingScanner counting(re, space);
+		const char* texts[] = { text, "axxxxxxxxbaxxxxxxxxb ab axxxxxxxxb", "a12345678b a12345678ba12345678b", "xx axxxxxxxxbb  axxxxxxxxxb", " ", "" };
+		for (auto&& t : texts)
+			UNIT_ASSERT_EQUAL(Run(classic, t).Result(0), Run(counting, t).Result(0));
+
+		try {
+			Pire::AdvancedCountingScanner(re, sep, Pire::CountingCompileBudget(5));
+			UNIT_ASSERT(!"Budget has not been enforced");
+		}
+		catch (Pire::Error&) {}
+	}
+
+	template<class Scanner>
+	void CountBatchOne(bool lagging)
+	{
+		const auto& enc = Pire::Encodings::Latin1();
+		const auto sc = Scanner::Glue(Scanner(MkFsm("abc", enc), MkFsm(".*", enc)), Scanner(MkFsm("x", enc), MkFsm(".*", enc)));
+
+		const char* text = "abcabcxxabcxabc";
+		auto windows = Pire::CountBatch::Windows(sc, text, text + strlen(text), 6);
+		UNIT_ASSERT_EQUAL(windows.Segments(), size_t(3));
+		UNIT_ASSERT_EQUAL(windows.RegexpsCount(), size_t(2));
+		auto whole = Run(sc, text);
+		for (size_t re = 0; re < 2; ++re) {
+			size_t sum = 0;
+			for (size_t i = 0; i < windows.Segments(); ++i)
+				sum += windows.Count(i, re);
+			UNIT_ASSERT_EQUAL(sum, whole.Result(re));
+		}
+		// CountingScanner only notices a match on the next character
+		if (!lagging) {
+			UNIT_ASSERT_EQUAL(windows.Counts(), TVector<ui32>({2, 0, 1, 3, 1, 0}));
+			// The second match ends in the second window
+			windows = Pire::CountBatch::Windows(sc, text, text + 6, 4);
+			UNIT_ASSERT_EQUAL(windows.Counts(), TVector<ui32>({1, 0, 1, 0}));
+		}
+
+		const char* docs = "abc x\nabcabc\n\nxx";
+		auto batch = Pire::CountBatch::Documents(sc, docs, docs + strlen(docs), '\n');
+		UNIT_ASSERT_EQUAL(batch.Segments(), size_t(4));
+		UNIT_ASSERT_EQUAL(batch.Counts(), TVector<ui32>({1, 1, 2, 0, 0, 0, 0, 2}));
+		auto single = Run(sc, "abcabc");
+		UNIT_ASSERT_EQUAL(batch.Count(1, 0), single.Result(0));
+		UNIT_ASSERT_EQUAL(batch.Row(3)[1], ui32(2));
+	}
+
+	SIMPLE_UNIT_TEST(CountBatch)
+	{
+		CountBatchOne<Pire::CountingScanner>(true);
+		CountBatchOne<Pire::AdvancedCountingScanner>(false);
+		CountBatchOne<Pire::NoGlueLimitCountingScanner>(false);
+	}
+
 	SIMPLE_UNIT_TEST(Serialization_v6_compatibility)
 	{
 		Serialization_v6_compatibilityOne<Pire::CountingScanner>();
@@ -558,6 +729,113 @@ SIMPLE_UNIT_TEST_SUITE(TestCount) {
 		TestHalfFinalCount<Pire::NonrelocHalfFinalScannerNoMask>();
 	}
 
+	SIMPLE_UNIT_TEST(HalfFinalAcceptedRegexps)
+	{
+		const auto& enc = Pire::Encodings::Latin1();
+		const char* regexps[] = { "[a-z]+", "[0-9]+", "x", "[A-Z]+" };
+		Pire::HalfFinalScanner glued;
+		for (auto&& re : regexps) {
+			HalfFinalFsm fsm(MkFsm(re, enc));
+			fsm.MakeGreedyCounter(true);
+			Pire::HalfFinalScanner sc(fsm);
+			glued = glued.Empty() ? sc : Pire::HalfFinalScanner::Glue(glued, sc);
+		}
+		UNIT_ASSERT(!glued.Empty());
+
+		auto state = Run(glued, "abc 12 de FG");
+		auto ids = glued.AcceptedRegexps(state);
+		TVector<size_t> accepted(ids.first, ids.second);
+		UNIT_ASSERT_EQUAL(accepted, TVector<size_t>({0, 1, 3}));
+		UNIT_ASSERT_EQUAL(state.Result(0), size_t(2));
+		UNIT_ASSERT_EQUAL(state.Result(2), size_t(0));
+
+		auto copy = state;
+		UNIT_ASSERT(copy == state);
+
+		// Scanners counting more regexps than the state keeps inline
+		// are glued and run as usual, with the counters on the heap
+		Pire::HalfFinalScanner many = glued;
+		while (many.RegexpsCount() < 2 * Pire::HalfFinalScanner::MAX_RE_COUNT)
+			many = Pire::HalfFinalScanner::Glue(many, many, 1000000);
+		UNIT_ASSERT(!many.Empty());
+		UNIT_ASSERT_EQUAL(many.RegexpsCount(), size_t(128));
+		auto manyState = Run(many, "abc 12 de FG");
+		auto manyIds = many.AcceptedRegexps(manyState);
+		TVector<size_t> manyAccepted(manyIds.first, manyIds.second);
+		UNIT_ASSERT_EQUAL(manyAccepted.size(), size_t(96));
+		UNIT_ASSERT_EQUAL(size_t(manyIds.second - manyIds.first), size_t(96));
+		UNIT_ASSERT_EQUAL(manyAccepted[48], size_t(64));
+		UNIT_ASSERT_EQUAL(manyAccepted.back(), size_t(127));
+		UNIT_ASSERT_EQUAL(manyState.Result(125), size_t(1));
+		UNIT_ASSERT_EQUAL(manyState.Result(124), size_t(2));
+		auto manyCopy = manyState;
+		UNIT_ASSERT(manyCopy == manyState);
+
+		// Gluing too large scanners fails as for any other scanner
+		UNIT_ASSERT(Pire::HalfFinalScanner::Glue(many, many, 1).Empty());
+
+		// A larger capacity keeps them inline, and scanners convert
+		// and load regardless of the capacity
+		typedef Pire::Impl::HalfFinalScanner<Pire::Impl::Relocatable, Pire::Impl::ExitMasks<2>, 128> WideScanner;
+		WideScanner wide = many;
+		auto wideState = Run(wide, "abc 12 de FG");
+		auto wideIds = wide.AcceptedRegexps(wideState);
+		UNIT_ASSERT_EQUAL(TVector<size_t>(wideIds.first, wideIds.second), manyAccepted);
+
+		BufferOutput wbuf;
+		::Save(&wbuf, wide);
+		Pire::HalfFinalScanner loaded;
+		MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		::Load(&rbuf, loaded);
+		UNIT_ASSERT_EQUAL(loaded.RegexpsCount(), size_t(128));
+		auto loadedState = Run(loaded, "abc 12 de FG");
+		auto loadedIds = loaded.AcceptedRegexps(loadedState);
+		UNIT_ASSERT_EQUAL(TVector<size_t>(loadedIds.first, loadedIds.second), manyAccepted);
+		UNIT_ASSERT_EQUAL(loadedState.Result(124), size_t(2));
+
+		TVector<size_t> image(wbuf.Buffer().Size() / sizeof(size_t) + 1);
+		memcpy(image.data(), wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Pire::HalfFinalScanner mapped;
+		mapped.Mmap(image.data(), wbuf.Buffer().Size());
+		auto mappedState = Run(mapped, "abc 12 de FG");
+		UNIT_ASSERT_EQUAL(mappedState.Result(124), size_t(2));
+
+		BufferOutput sbuf;
+		many.SaveState(&sbuf, manyState);
+		MemoryInput sin(sbuf.Buffer().Data(), sbuf.Buffer().Size());
+		Pire::HalfFinalScanner::State restored;
+		loaded.LoadState(&sin, restored);
+		UNIT_ASSERT(restored == loadedState);
+	}
+
+	template<typename Scanner>
+	void TestHalfFinalClone() {
+		auto scanners = MakeHalfFinalCount<Scanner>("ab+");
+		static_assert(std::is_same<decltype(scanners[0].Clone()), Scanner>::value, "Clone() must keep the scanner type");
+
+		BufferOutput wbuf;
+		::Save(&wbuf, scanners[2]);
+		TVector<size_t> image(wbuf.Buffer().Size() / sizeof(size_t) + 1);
+		memcpy(image.data(), wbuf.Buffer().Data(), wbuf.Buffer().Size());
+		Scanner mapped;
+		mapped.Mmap(image.data(), wbuf.Buffer().Size());
+		Scanner clone = mapped.Clone();
+		std::fill(image.begin(), image.end(), 0);
+		mapped = Scanner();
+
+		auto state = Run(clone, "abbabbbabbbbbb");
+		UNIT_ASSERT_EQUAL(state.Result(0), size_t(3));
+		auto ids = clone.AcceptedRegexps(state);
+		UNIT_ASSERT_EQUAL(TVector<size_t>(ids.first, ids.second), TVector<size_t>({0}));
+		UNIT_ASSERT(Scanner().Clone().Empty());
+	}
+
+	SIMPLE_UNIT_TEST(HalfFinalClone)
+	{
+		TestHalfFinalClone<Pire::HalfFinalScanner>();
+		TestHalfFinalClone<Pire::HalfFinalScannerNoMask>();
+	}
+
 	template<typename Scanner>
 	void TestHalfFinalSerialization() {
 		auto oldScanners = MakeHalfFinalCount<Scanner>("(\\w\\w)+");
@@ -573,6 +851,16 @@ SIMPLE_UNIT_TEST_SUITE(TestCount) {
 		}
 
 		HalfFinalCount(scanners, "ab abbb ababa a", {3, 3, 8, 8, 5});
+
+		// The old raw format of states still loads, with counters zeroed
+		auto st = Run(scanners[0], "ab abbb", -1);
+		BufferOutput sbuf;
+		st.Save(&sbuf);
+		MemoryInput sin(sbuf.Buffer().Data(), sbuf.Buffer().Size());
+		typename Scanner::State raw;
+		raw.Load(&sin);
+		UNIT_ASSERT_EQUAL(scanners[0].StateIndex(raw), scanners[0].StateIndex(st));
+		UNIT_ASSERT_EQUAL(raw.Result(0), size_t(0));
 	}
 
 	SIMPLE_UNIT_TEST(HalfFinalSerialization)
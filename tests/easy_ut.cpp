@@ -53,5 +53,24 @@ SIMPLE_UNIT_TEST(TwoFeatures)
 	UNIT_ASSERT("ABC" ==~ re);
 	UNIT_ASSERT(!("adc" ==~ re));
 }
+
+SIMPLE_UNIT_TEST(Copy)
+{
+	Pire::Regexp copy("x");
+	{
+		Pire::Regexp re("a.*b");
+		copy = re;
+	}
+	UNIT_ASSERT("axxb" ==~ copy);
+	UNIT_ASSERT(!("axx" ==~ copy));
+
+	Pire::Fsm fsm = Pire::Lexer("a.*b").Parse();
+	fsm.PrependAnything();
+	fsm.AppendAnything();
+	Pire::Regexp slow(fsm.Compile<Pire::SlowScanner>());
+	Pire::Regexp slowCopy(slow);
+	UNIT_ASSERT(slowCopy.Matches("axxb"));
+	UNIT_ASSERT(!slowCopy.Matches("bxxa"));
+}
 	
 }
@@ -91,4 +91,26 @@ SIMPLE_UNIT_TEST(InlineGlue)
 	UNIT_ASSERT(!Matches2(sc, "xxx"));
 }
 
+SIMPLE_UNIT_TEST(InlineBundle)
+{
+	// The bundle is used before its regexps are listed
+	Pire::Scanner sc = PIRE_BUNDLE("words");
+	size_t foo = PIRE_BUNDLED("words", "foo", "");
+	size_t bar = PIRE_BUNDLED("words", "ba[rz]", "");
+
+	UNIT_ASSERT_EQUAL(foo, (size_t) 0);
+	UNIT_ASSERT_EQUAL(bar, (size_t) 1);
+	UNIT_ASSERT(ParticularMatch(sc, Pire::Runner(sc).Run("foo").State(), foo));
+	UNIT_ASSERT(ParticularMatch(sc, Pire::Runner(sc).Run("baz").State(), bar));
+	UNIT_ASSERT(!Matches2(sc, "xxx"));
+
+	// All sites of a bundle map the same image
+	Pire::Scanner again = PIRE_BUNDLE("words");
+	Pire::Scanner::State st1, st2;
+	sc.Initialize(st1);
+	again.Initialize(st2);
+	UNIT_ASSERT_EQUAL(st1, st2);
+	UNIT_ASSERT(ParticularMatch(again, Pire::Runner(again).Run("bar").State(), bar));
+}
+
 }
@@ -29,6 +29,11 @@
 #include <stdexcept>
 #include "common.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 SIMPLE_UNIT_TEST_SUITE(TestPire) {
 
 /*****************************************************************************
@@ -526,6 +531,10 @@ SIMPLE_UNIT_TEST(Copying)
 {
 	TestCopying<Pire::Scanner, Pire::NonrelocScanner>();
 	TestCopying<Pire::ScannerNoMask, Pire::NonrelocScannerNoMask>();
+	TestCopying<Pire::Scanner, Pire::NonrelocTaggedScanner>();
+	TestCopying<Pire::NonrelocScanner, Pire::NonrelocTaggedScanner>();
+	TestCopying<Pire::Scanner, Pire::NonrelocSplitScanner>();
+	TestCopying<Pire::NonrelocTaggedScanner, Pire::NonrelocSplitScanner>();
 	TestCopying<Pire::HalfFinalScanner, Pire::NonrelocHalfFinalScanner>();
 	TestCopying<Pire::HalfFinalScannerNoMask, Pire::NonrelocHalfFinalScannerNoMask>();
 }
@@ -625,6 +634,582 @@ SIMPLE_UNIT_TEST(Serialization)
 	}
 }
 
+template<class Scanner, class Relocatable>
+void TestStreamedSerialization(const char* regexp)
+{
+	Scanner sc = ParseRegexp(regexp, "").template Compile<Scanner>();
+
+	// Rows are converted on the fly into the very same bytes
+	// a relocatable copy would have produced
+	BufferOutput direct, copied;
+	Save(&direct, sc);
+	Save(&copied, Relocatable(sc));
+	UNIT_ASSERT_EQUAL(direct.Buffer().Size(), copied.Buffer().Size());
+	UNIT_ASSERT(!memcmp(direct.Buffer().Data(), copied.Buffer().Data(), direct.Buffer().Size()));
+
+	MemoryInput rbuf(direct.Buffer().Data(), direct.Buffer().Size());
+	Scanner loaded;
+	Load(&rbuf, loaded);
+	UNIT_ASSERT_EQUAL(loaded.Size(), sc.Size());
+	for (auto&& str : {"regexp", "regxp", "a regexp", "regexp42", ""})
+		UNIT_ASSERT_EQUAL(Matches(loaded, str), Matches(sc, str));
+
+	// Saving the loaded scanner again gives the same bytes as well
+	BufferOutput again;
+	Save(&again, loaded);
+	UNIT_ASSERT(!memcmp(direct.Buffer().Data(), again.Buffer().Data(), direct.Buffer().Size()));
+}
+
+SIMPLE_UNIT_TEST(StreamedSerialization)
+{
+	const char* regexp = "^(a+|regexp[0-9]*|[^x]*p)$";
+	TestStreamedSerialization<Pire::NonrelocScanner, Pire::Scanner>(regexp);
+	TestStreamedSerialization<Pire::NonrelocScannerNoMask, Pire::ScannerNoMask>(regexp);
+	TestStreamedSerialization<Pire::NonrelocTaggedScanner, Pire::Scanner>(regexp);
+	TestStreamedSerialization<Pire::NonrelocSplitScanner, Pire::Scanner>(regexp);
+	TestStreamedSerialization<Pire::NonrelocClassMaskScanner, Pire::ClassMaskScanner>(regexp);
+	TestStreamedSerialization<Pire::NonrelocScanner, Pire::Scanner>("^$");
+
+	// Empty scanners
+	BufferOutput wbuf;
+	Save(&wbuf, Pire::NonrelocScanner());
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::NonrelocScanner empty = ParseRegexp("a", "").Compile<Pire::NonrelocScanner>();
+	Load(&rbuf, empty);
+	UNIT_ASSERT(empty.Empty());
+}
+
+template<class Scanner>
+bool StateWithin(const Scanner& scanner, const TVector<size_t>& buf)
+{
+	typename Scanner::State state;
+	scanner.Initialize(state);
+	return state >= reinterpret_cast<size_t>(buf.data()) && state < reinterpret_cast<size_t>(buf.data() + buf.size());
+}
+
+template<class Scanner>
+void TestFixedImage()
+{
+	Scanner sc = ParseRegexp("^regexp$", "").Compile<Scanner>();
+	TVector<size_t> place(4096), other(4096);
+	BufferOutput wbuf;
+	sc.SaveFixed(&wbuf, reinterpret_cast<size_t>(place.data()));
+	size_t size = wbuf.Buffer().Size();
+	UNIT_ASSERT(size <= place.size() * sizeof(size_t));
+
+	// At the address it was saved for, the image is used in place...
+	memcpy(place.data(), wbuf.Buffer().Data(), size);
+	Scanner inPlace;
+	const void* tail = inPlace.MmapFixed(place.data(), size);
+	UNIT_ASSERT_EQUAL(tail, (const void*) ((const char*) place.data() + size));
+	UNIT_ASSERT(StateWithin(inPlace, place));
+	UNIT_ASSERT(Matches(inPlace, "regexp"));
+	UNIT_ASSERT(!Matches(inPlace, "regxp"));
+
+	// ...and anywhere else it is relocated into a private copy
+	memcpy(other.data(), wbuf.Buffer().Data(), size);
+	Scanner moved;
+	moved.MmapFixed(other.data(), size);
+	UNIT_ASSERT(!StateWithin(moved, other));
+	memset(other.data(), 0, size);
+	UNIT_ASSERT(Matches(moved, "regexp"));
+	UNIT_ASSERT(!Matches(moved, "regexp t"));
+
+	// A scanner used in place can be saved for another address
+	BufferOutput wbuf2;
+	inPlace.SaveFixed(&wbuf2, reinterpret_cast<size_t>(other.data()));
+	memcpy(other.data(), wbuf2.Buffer().Data(), wbuf2.Buffer().Size());
+	moved.MmapFixed(other.data(), wbuf2.Buffer().Size());
+	UNIT_ASSERT(StateWithin(moved, other));
+	UNIT_ASSERT(Matches(moved, "regexp"));
+
+	// Empty scanners survive, too
+	BufferOutput wbuf3;
+	Scanner().SaveFixed(&wbuf3, 0);
+	memcpy(other.data(), wbuf3.Buffer().Data(), wbuf3.Buffer().Size());
+	moved.MmapFixed(other.data(), wbuf3.Buffer().Size());
+	UNIT_ASSERT(moved.Empty());
+
+	// Ordinary images are rejected
+	BufferOutput wbuf4;
+	Save(&wbuf4, sc);
+	memcpy(other.data(), wbuf4.Buffer().Data(), wbuf4.Buffer().Size());
+	try {
+		moved.MmapFixed(other.data(), wbuf4.Buffer().Size());
+		UNIT_ASSERT(!"Failed to check the image type");
+	}
+	catch (Pire::Error&) {}
+}
+
+SIMPLE_UNIT_TEST(FixedImage)
+{
+	TestFixedImage<Pire::NonrelocScanner>();
+	TestFixedImage<Pire::NonrelocScannerNoMask>();
+	TestFixedImage<Pire::NonrelocTaggedScanner>();
+	TestFixedImage<Pire::NonrelocSplitScanner>();
+}
+
+#ifndef _WIN32
+SIMPLE_UNIT_TEST(FixedMappedScanner)
+{
+	// Find an address which is surely free
+	const size_t Size = 1 << 16;
+	void* hole = mmap(0, Size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	UNIT_ASSERT(hole != MAP_FAILED);
+	munmap(hole, Size);
+	// Files are mapped at page boundaries only, so the base must be page-aligned
+	UNIT_ASSERT_EQUAL(reinterpret_cast<size_t>(hole) % sysconf(_SC_PAGESIZE), 0u);
+
+	Pire::NonrelocScanner sc = ParseRegexp("^regexp$", "").Compile<Pire::NonrelocScanner>();
+	BufferOutput wbuf;
+	sc.SaveFixed(&wbuf, reinterpret_cast<size_t>(hole));
+	UNIT_ASSERT(wbuf.Buffer().Size() <= Size);
+	char name[] = "/tmp/pire_fixed_XXXXXX";
+	int fd = mkstemp(name);
+	UNIT_ASSERT(fd != -1);
+	UNIT_ASSERT_EQUAL(write(fd, wbuf.Buffer().Data(), wbuf.Buffer().Size()), (ssize_t) wbuf.Buffer().Size());
+	close(fd);
+
+	{
+		// An image saved for a word-aligned base in the middle of a page
+		// cannot be mapped there and gets relocated
+		BufferOutput wbuf2;
+		sc.SaveFixed(&wbuf2, reinterpret_cast<size_t>(hole) + sizeof(size_t));
+		char name2[] = "/tmp/pire_fixed_XXXXXX";
+		int fd2 = mkstemp(name2);
+		UNIT_ASSERT(fd2 != -1);
+		UNIT_ASSERT_EQUAL(write(fd2, wbuf2.Buffer().Data(), wbuf2.Buffer().Size()), (ssize_t) wbuf2.Buffer().Size());
+		close(fd2);
+		Pire::FixedMappedScanner<Pire::NonrelocScanner> misaligned(name2);
+		unlink(name2);
+		UNIT_ASSERT(!misaligned.Shared());
+		UNIT_ASSERT(Matches(misaligned.GetScanner(), "regexp"));
+		UNIT_ASSERT(!Matches(misaligned.GetScanner(), "regxp"));
+	}
+
+	{
+		Pire::FixedMappedScanner<Pire::NonrelocScanner> shared(name);
+		UNIT_ASSERT(shared.Shared());
+		UNIT_ASSERT(Matches(shared.GetScanner(), "regexp"));
+		UNIT_ASSERT(!Matches(shared.GetScanner(), "regxp"));
+
+		// The address is taken now
+		Pire::FixedMappedScanner<Pire::NonrelocScanner> relocated(name);
+		UNIT_ASSERT(!relocated.Shared());
+		UNIT_ASSERT(Matches(relocated.GetScanner(), "regexp"));
+		UNIT_ASSERT(!Matches(relocated.GetScanner(), "regxp"));
+	}
+	unlink(name);
+	try {
+		Pire::FixedMappedScanner<Pire::NonrelocScanner> missing(name);
+		UNIT_ASSERT(!"Failed to report a missing file");
+	}
+	catch (Pire::Error&) {}
+}
+#endif
+
+template<class Scanner>
+void TestMemoryPolicy(unsigned policy)
+{
+	Scanner sc = ParseRegexp("^regexp$", "").Compile<Scanner>();
+	unsigned applied = sc.ApplyMemoryPolicy(policy);
+	UNIT_ASSERT_EQUAL((applied & ~policy & ~(unsigned) Pire::MemoryPolicy::HugePages), 0u);
+	UNIT_ASSERT(Matches(sc, "regexp"));
+	UNIT_ASSERT(!Matches(sc, "regxp"));
+
+	// The scanner owns its tables now
+	Scanner copy(sc);
+	sc = Scanner();
+	UNIT_ASSERT(Matches(copy, "regexp"));
+	UNIT_ASSERT_EQUAL(sc.ApplyMemoryPolicy(policy), 0u);
+}
+
+SIMPLE_UNIT_TEST(MemoryPolicy)
+{
+	using namespace Pire::MemoryPolicy;
+	const unsigned policies[] = { 0, HugePages, ExplicitHugePages, Prefault, Lock, HugePages | Prefault | Lock };
+	for (unsigned policy : policies) {
+		TestMemoryPolicy<Pire::Scanner>(policy);
+		TestMemoryPolicy<Pire::NonrelocScanner>(policy);
+		TestMemoryPolicy<Pire::NonrelocTaggedScanner>(policy);
+	}
+
+	// Mmap()-ed scanners get a private copy
+	BufferOutput wbuf;
+	Save(&wbuf, ParseRegexp("^regexp$", "").Compile<Pire::Scanner>());
+	TVector<char> image(wbuf.Buffer().Data(), wbuf.Buffer().Data() + wbuf.Buffer().Size());
+	Pire::Scanner mapped;
+	mapped.Mmap(image.data(), image.size());
+	mapped.ApplyMemoryPolicy(Prefault);
+	std::fill(image.begin(), image.end(), 0);
+	UNIT_ASSERT(Matches(mapped, "regexp"));
+}
+
+SIMPLE_UNIT_TEST(ReplicatedScanner)
+{
+	Pire::Scanner sc = ParseRegexp("^regexp$", "").Compile<Pire::Scanner>();
+
+	// A single node uses the original scanner
+	Pire::ReplicatedScanner<Pire::Scanner> single(sc, 0, 1);
+	UNIT_ASSERT_EQUAL(&single.GetScanner(), &sc);
+	UNIT_ASSERT_EQUAL(&single.Replica(3), &sc);
+
+	// Several nodes get separate copies, made once
+	Pire::ReplicatedScanner<Pire::Scanner> replicated(sc, Pire::MemoryPolicy::Prefault, 4);
+	UNIT_ASSERT_EQUAL(replicated.NodesCount(), (size_t) 4);
+	for (size_t node = 0; node != 4; ++node) {
+		const Pire::Scanner& replica = replicated.Replica(node);
+		UNIT_ASSERT(&replica != &sc);
+		UNIT_ASSERT_EQUAL(&replicated.Replica(node), &replica);
+		UNIT_ASSERT(Matches(replica, "regexp"));
+		UNIT_ASSERT(!Matches(replica, "regxp"));
+	}
+	UNIT_ASSERT(&replicated.Replica(0) != &replicated.Replica(1));
+	UNIT_ASSERT(Matches(replicated.GetScanner(), "regexp"));
+
+	// Replicas of an Mmap()-ed scanner own their tables
+	BufferOutput wbuf;
+	Save(&wbuf, sc);
+	TVector<char> image(wbuf.Buffer().Data(), wbuf.Buffer().Data() + wbuf.Buffer().Size());
+	Pire::Scanner mapped;
+	mapped.Mmap(image.data(), image.size());
+	Pire::ReplicatedScanner<Pire::Scanner> fromMapped(mapped, 0, 2);
+	const Pire::Scanner& replica = fromMapped.Replica(1);
+	std::fill(image.begin(), image.end(), 0);
+	UNIT_ASSERT(Matches(replica, "regexp"));
+}
+
+template<class Scanner>
+void TestSharedTables()
+{
+	Scanner sc = ParseRegexp("^regexp$", "").Compile<Scanner>();
+	typename Scanner::State orig, copied, cloned;
+	sc.Initialize(orig);
+
+	// Copies share the tables...
+	Scanner copy(sc);
+	copy.Initialize(copied);
+	UNIT_ASSERT_EQUAL(copied, orig);
+	sc = Scanner();
+	UNIT_ASSERT(Matches(copy, "regexp"));
+
+	// ...while clones get their own
+	Scanner clone = copy.Clone();
+	clone.Initialize(cloned);
+	UNIT_ASSERT(cloned != copied);
+	copy = Scanner();
+	UNIT_ASSERT(Matches(clone, "regexp"));
+	UNIT_ASSERT(!Matches(clone, "regxp"));
+	UNIT_ASSERT(Scanner().Clone().Empty());
+
+	// Clones of mmap()-ed scanners survive the memory they were built on
+	BufferOutput wbuf;
+	Save(&wbuf, clone);
+	TVector<size_t> image(wbuf.Buffer().Size() / sizeof(size_t) + 1);
+	memcpy(image.data(), wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Scanner mapped;
+	mapped.Mmap(image.data(), wbuf.Buffer().Size());
+	Scanner mappedClone = mapped.Clone();
+	std::fill(image.begin(), image.end(), 0);
+	UNIT_ASSERT(Matches(mappedClone, "regexp"));
+}
+
+SIMPLE_UNIT_TEST(SharedTables)
+{
+	TestSharedTables<Pire::Scanner>();
+	TestSharedTables<Pire::SimpleScanner>();
+}
+
+template<class Scanner>
+void TestStateResume(const Scanner& scanner, const char* str)
+{
+	const char* mid = str + strlen(str) / 2;
+	const char* end = str + strlen(str);
+
+	typename Scanner::State full;
+	scanner.Initialize(full);
+	Pire::Step(scanner, full, Pire::BeginMark);
+	Pire::Run(scanner, full, str, end);
+	Pire::Step(scanner, full, Pire::EndMark);
+
+	typename Scanner::State head;
+	scanner.Initialize(head);
+	Pire::Step(scanner, head, Pire::BeginMark);
+	Pire::Run(scanner, head, str, mid);
+	BufferOutput wbuf;
+	scanner.SaveState(&wbuf, head);
+
+	// A reloaded scanner has its tables at another address (unlike a copy,
+	// which shares them), so the state must not carry pointers
+	BufferOutput sbuf;
+	Pire::Save(&sbuf, scanner);
+	MemoryInput sin(sbuf.Buffer().Data(), sbuf.Buffer().Size());
+	Scanner copy;
+	Pire::Load(&sin, copy);
+	typename Scanner::State tail;
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	copy.LoadState(&rbuf, tail);
+	Pire::Run(copy, tail, mid, end);
+	Pire::Step(copy, tail, Pire::EndMark);
+
+	UNIT_ASSERT_EQUAL(copy.Final(tail), scanner.Final(full));
+}
+
+SIMPLE_UNIT_TEST(StateSerialization)
+{
+	Scanners s("^a[bc]+d$");
+	const char* strs[] = { "abcbcd", "abcbce", "abd", "ad" };
+	for (auto&& str : strs) {
+		TestStateResume(s.fast, str);
+		TestStateResume(s.nonreloc, str);
+		TestStateResume(s.simple, str);
+		TestStateResume(s.slow, str);
+		TestStateResume(s.fastNoMask, str);
+		TestStateResume(s.nonrelocTagged, str);
+		TestStateResume(s.nonrelocSplit, str);
+		TestStateResume(s.halfFinal, str);
+		TestStateResume(s.nonrelocHalfFinal, str);
+	}
+
+	Pire::Scanner other = Pire::Lexer("x+").Parse().Compile<Pire::Scanner>();
+	Pire::Scanner::State st;
+	s.fast.Initialize(st);
+	BufferOutput wbuf;
+	s.fast.SaveState(&wbuf, st);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	try {
+		other.LoadState(&rbuf, st);
+		UNIT_ASSERT(!"Scanner accepted a state of another scanner");
+	}
+	catch (Pire::Error&) {}
+}
+
+Pire::Fsm SaveAndLoad(const Pire::Fsm& fsm)
+{
+	BufferOutput wbuf;
+	Pire::Save(&wbuf, fsm);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::Fsm loaded;
+	Pire::Load(&rbuf, loaded);
+	return loaded;
+}
+
+ystring Dump(const Pire::Fsm& fsm)
+{
+	std::ostringstream s;
+	s << fsm;
+	return s.str();
+}
+
+SIMPLE_UNIT_TEST(FsmSerialization)
+{
+	const char* regexps[] = { "^a[bc]+d$", "x|y*z", "(ab|ac)+", "^$" };
+	for (auto&& regexp : regexps) {
+		Pire::Fsm raw = Pire::Lexer(regexp).Parse();
+		Pire::Fsm canonized = raw;
+		canonized.Canonize();
+		for (auto&& fsm : { raw, canonized }) {
+			Pire::Fsm loaded = SaveAndLoad(fsm);
+			UNIT_ASSERT_EQUAL(Dump(loaded), Dump(fsm));
+			UNIT_ASSERT_EQUAL(loaded.IsDetermined(), fsm.IsDetermined());
+			UNIT_ASSERT(loaded.Letters() == fsm.Letters());
+		}
+	}
+
+	// Loaded FSMs can be compiled and glued as usual
+	Pire::Fsm ab = SaveAndLoad(Pire::Lexer("^a+b$").Parse().Canonize());
+	Pire::Fsm cd = SaveAndLoad(Pire::Lexer("c+d").Parse().Canonize().Surround());
+	Pire::Scanner glued = Pire::Scanner::Glue(ab.Compile<Pire::Scanner>(), cd.Compile<Pire::Scanner>());
+	UNIT_ASSERT_EQUAL(glued.RegexpsCount(), size_t(2));
+	UNIT_ASSERT(Matches(glued, "aab"));
+	UNIT_ASSERT(Matches(glued, "--cd--"));
+	UNIT_ASSERT(!Matches(glued, "ab--"));
+	UNIT_ASSERT(Matches((ab | cd).Compile<Pire::SimpleScanner>(), "--cccd"));
+
+	// Tags and outputs
+	Pire::Fsm tagged = Pire::Lexer("ab").Parse();
+	tagged.SetTag(1, 0x5);
+	tagged.SetOutput(0, 1, 0x300000000ul);
+	Pire::Fsm loaded = SaveAndLoad(tagged);
+	UNIT_ASSERT_EQUAL(loaded.Tag(1), 0x5ul);
+	UNIT_ASSERT_EQUAL(loaded.Output(0, 1), 0x300000000ul);
+
+	// Truncated and foreign data
+	BufferOutput wbuf;
+	Pire::Save(&wbuf, Pire::Lexer("^a[bc]+d$").Parse().Canonize());
+	for (size_t size : { wbuf.Buffer().Size() - 8, size_t(16) }) {
+		MemoryInput rbuf(wbuf.Buffer().Data(), size);
+		try {
+			Pire::Load(&rbuf, loaded);
+			UNIT_ASSERT(!"truncated FSM loaded");
+		}
+		catch (std::exception&) {}
+	}
+	BufferOutput sbuf;
+	Pire::Save(&sbuf, ab.Compile<Pire::Scanner>());
+	MemoryInput rbuf(sbuf.Buffer().Data(), sbuf.Buffer().Size());
+	try {
+		Pire::Load(&rbuf, loaded);
+		UNIT_ASSERT(!"a scanner loaded as FSM");
+	}
+	catch (Pire::Error&) {}
+
+	// Corrupted data: the header is followed by the number of words,
+	// the flags, the size, the initial state and the letter classes
+	const size_t countAt = Pire::Impl::AlignUp(sizeof(Pire::Header), sizeof(size_t));
+	const size_t wordsAt = countAt + sizeof(size_t);
+	ystring image(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	ui32 firstClass[2];
+	memcpy(firstClass, image.data() + wordsAt + 4 * sizeof(ui32), sizeof(firstClass));
+	UNIT_ASSERT(firstClass[0] > 0);
+	ystring huge = image, twice = image;
+	const size_t hugeCount = static_cast<size_t>(-1) / 8;
+	memcpy(&huge[countAt], &hugeCount, sizeof(hugeCount));
+	// The first letter of the second class is put into the first one, too
+	memcpy(&twice[wordsAt + (5 + firstClass[0] + 1) * sizeof(ui32)], &firstClass[1], sizeof(ui32));
+	for (auto&& corrupted : { huge, twice }) {
+		// Unlike MemoryInput, it does not throw at the end of data
+		std::istringstream cbuf(corrupted);
+		try {
+			Pire::Load(&cbuf, loaded);
+			UNIT_ASSERT(!"corrupted FSM loaded");
+		}
+		catch (Pire::Error&) {}
+	}
+}
+
+template<class Scanner>
+bool MatchesWithoutMarks(const Scanner& scanner, const ystring& str)
+{
+	return Pire::Matches(scanner, str.data(), str.data() + str.size());
+}
+
+SIMPLE_UNIT_TEST(MinimizeLargeClasses)
+{
+	// All 2^10 states of the determined FSM are distinct, so Minimize()
+	// splits its two initial classes all the way down to single states
+	Pire::Fsm tenth = Pire::Lexer("(a|b)*a(a|b){9}").Parse();
+	tenth.Determine();
+	Pire::Fsm minimized = tenth;
+	minimized.Minimize();
+	UNIT_ASSERT_EQUAL(minimized.Size(), size_t(1024 + 1)); // and the dead state
+	Pire::SimpleScanner scanner = minimized.Compile<Pire::SimpleScanner>();
+	for (size_t len = 0; len <= 12; ++len)
+		for (size_t bits = 0; bits != (size_t(1) << len); ++bits) {
+			ystring str;
+			for (size_t i = 0; i != len; ++i)
+				str += (bits >> i) & 1 ? 'a' : 'b';
+			bool tenthFromEnd = len >= 10 && str[len - 10] == 'a';
+			UNIT_ASSERT_EQUAL(MatchesWithoutMarks(scanner, str), tenthFromEnd);
+		}
+
+	// Uniting words one by one leaves many equivalent states to merge,
+	// and the result is as small as the one built directly
+	TVector<ystring> words;
+	const char* syllables[] = { "ka", "ri", "mo", "tan", "se", "lu" };
+	for (size_t i = 0; i != 600; ++i) {
+		ystring word;
+		for (size_t n = i + 1; n; n /= 6)
+			word += syllables[(n * 7 + word.size()) % 6];
+		words.push_back(word);
+	}
+	Pire::Fsm united = Pire::Fsm::MakeFalse();
+	for (auto&& word : words)
+		united |= Pire::Fsm().Append(word);
+	united.Canonize();
+	UNIT_ASSERT_EQUAL(united.Size(), Pire::Fsm::FromStrings(words).Size() + 1);
+}
+
+SIMPLE_UNIT_TEST(FsmFromStrings)
+{
+	TVector<ystring> words = { "tap", "taps", "top", "tops", "stop", "stops", "tap", "\xFF\x01", "" };
+	Pire::Fsm fsm = Pire::Fsm::FromStrings(words);
+
+	Pire::Fsm united = Pire::Fsm::MakeFalse();
+	for (auto&& word : words)
+		united |= Pire::Fsm().Append(word);
+	united.Canonize();
+	Pire::Fsm built = fsm;
+	UNIT_ASSERT_EQUAL(built.Canonize().Size(), united.Size());
+	UNIT_ASSERT_EQUAL(fsm.Size() + 1, united.Size()); // all but the dead state
+
+	Pire::SimpleScanner scanner = fsm.Compile<Pire::SimpleScanner>();
+	for (auto&& word : words)
+		UNIT_ASSERT(MatchesWithoutMarks(scanner, word));
+	const char* others[] = { "ta", "tapss", "sto", "xtop", "\xFF", "\x01" };
+	for (auto&& other : others)
+		UNIT_ASSERT(!MatchesWithoutMarks(scanner, other));
+
+	// Survives saving and further FSM operations
+	UNIT_ASSERT(MatchesWithoutMarks(SaveAndLoad(fsm).Compile<Pire::Scanner>(), "stops"));
+	Pire::Fsm hosts = Pire::Fsm::FromStrings({ "example.com", "example.org", "test.org" });
+	Pire::Fsm url = Pire::Lexer("^([a-z]+://)?([a-z]+\\.)*").Parse() + hosts + Pire::Lexer("(/.*)?$").Parse();
+	Pire::Scanner urls = url.Compile<Pire::Scanner>();
+	UNIT_ASSERT(Matches(urls, "http://www.example.com/index.html"));
+	UNIT_ASSERT(Matches(urls, "test.org"));
+	UNIT_ASSERT(!Matches(urls, "example.net"));
+	UNIT_ASSERT(!Matches(urls, "http://test.org.ru/"));
+	Pire::Scanner alt = (hosts | Pire::Lexer("[0-9]+").Parse()).Compile<Pire::Scanner>();
+	UNIT_ASSERT(MatchesWithoutMarks(alt, "123"));
+	UNIT_ASSERT(MatchesWithoutMarks(alt, "test.org"));
+
+	UNIT_ASSERT(!MatchesWithoutMarks(Pire::Fsm::FromStrings({}).Compile<Pire::Scanner>(), ""));
+}
+
+template<class Iter>
+size_t RangeSize(ypair<Iter, Iter> range)
+{
+	return range.second - range.first;
+}
+
+SIMPLE_UNIT_TEST(TaggedStates)
+{
+	Pire::Fsm fsm = ParseRegexp("ab+c|d", "");
+	Pire::NonrelocScanner plain = Pire::Fsm(fsm).Compile<Pire::NonrelocScanner>();
+	Pire::NonrelocTaggedScanner tagged = Pire::Fsm(fsm).Compile<Pire::NonrelocTaggedScanner>();
+
+	Pire::NonrelocScanner::State ps;
+	Pire::NonrelocTaggedScanner::State ts;
+	plain.Initialize(ps);
+	tagged.Initialize(ts);
+	for (const char* p = "xabbbcdxxabd"; *p; ++p) {
+		Pire::Step(plain, ps, (unsigned char) *p);
+		Pire::Step(tagged, ts, (unsigned char) *p);
+		UNIT_ASSERT_EQUAL(tagged.StateIndex(ts), plain.StateIndex(ps));
+		UNIT_ASSERT_EQUAL(tagged.Final(ts), plain.Final(ps));
+		UNIT_ASSERT_EQUAL(tagged.Dead(ts), plain.Dead(ps));
+		UNIT_ASSERT_EQUAL(RangeSize(tagged.AcceptedRegexps(ts)), RangeSize(plain.AcceptedRegexps(ps)));
+	}
+
+	BufferOutput wbuf;
+	Save(&wbuf, tagged);
+	MemoryInput rbuf(wbuf.Buffer().Data(), wbuf.Buffer().Size());
+	Pire::NonrelocTaggedScanner loaded;
+	Load(&rbuf, loaded);
+	UNIT_ASSERT(Matches(loaded, "abbc"));
+	UNIT_ASSERT(Matches(loaded, "d"));
+	UNIT_ASSERT(!Matches(loaded, "abx"));
+}
+
+SIMPLE_UNIT_TEST(SplitHeaders)
+{
+	Pire::Fsm fsm = ParseRegexp("ab+c|d", "");
+	Pire::NonrelocScanner plain = Pire::Fsm(fsm).Compile<Pire::NonrelocScanner>();
+	Pire::NonrelocSplitScanner split = Pire::Fsm(fsm).Compile<Pire::NonrelocSplitScanner>();
+
+	Pire::NonrelocScanner::State ps;
+	Pire::NonrelocSplitScanner::State ss;
+	plain.Initialize(ps);
+	split.Initialize(ss);
+	for (const char* p = "xabbbcdxxabd"; *p; ++p) {
+		Pire::Step(plain, ps, (unsigned char) *p);
+		Pire::Step(split, ss, (unsigned char) *p);
+		UNIT_ASSERT_EQUAL(split.StateIndex(ss), plain.StateIndex(ps));
+		UNIT_ASSERT_EQUAL(split.Final(ss), plain.Final(ps));
+		UNIT_ASSERT_EQUAL(split.Dead(ss), plain.Dead(ps));
+	}
+}
+
 SIMPLE_UNIT_TEST(TestShortcuts)
 {
 	REGEXP("aaa") {
@@ -645,6 +1230,74 @@ SIMPLE_UNIT_TEST(TestShortcuts)
 	}
 }
 
+SIMPLE_UNIT_TEST(ExitClasses)
+{
+	// States inside quotes have too many exit characters for exit masks
+	REGEXP("\"[^\"\\\\\n]*\":") {
+		ACCEPTS("....\"..................................................\":..");
+		DENIES ("....\"...........................\\......................\":..");
+		DENIES ("....\"..........................\n.......................\":..");
+	}
+
+	// Ten groups of low nibbles do not fit into eight buckets,
+	// so the class is only approximated; this must not break matching
+	// (the FSM is built by hand since the regexp parser rejects 8-bit characters)
+	const char exits[] = "\x01\x12\x23\x34\x45\x56\x67\x78\x89\x9Ay";
+	Pire::Fsm fsm;
+	fsm.Resize(3);
+	fsm.Connect(0, 1, 'x');
+	for (unsigned ch = 0; ch != 256; ++ch)
+		if (!strchr(exits, ch))
+			fsm.Connect(1, 1, ch);
+	fsm.Connect(1, 2, 'y');
+	fsm.ClearFinal();
+	fsm.SetFinal(2, true);
+	fsm.SetIsDetermined(false);
+	fsm.Surround();
+	Pire::Scanner plain = Pire::Fsm(fsm).Compile<Pire::Scanner>();
+	Pire::ClassMaskScanner classes = Pire::Fsm(fsm).Compile<Pire::ClassMaskScanner>();
+	for (unsigned ch = 1; ch != 256; ++ch) {
+		ystring text = ystring(30, '.') + "x" + ystring(100, (char) ch) + "y";
+		UNIT_ASSERT_EQUAL(Matches(classes, text), Matches(plain, text));
+		UNIT_ASSERT_EQUAL(Pire::LongestPrefix(classes, text.c_str(), text.c_str() + text.size()),
+			Pire::LongestPrefix(plain, text.c_str(), text.c_str() + text.size()));
+	}
+}
+
+SIMPLE_UNIT_TEST(Stride2)
+{
+	const char* regexps[] = { "ab+c", "^[0-9]+-[0-9]+$", "(a|b)*abb$", "x.y", "" };
+	const ystring text = "xxabbbc 12-345 aabbabbzxzyab 0-1";
+	for (auto&& re : regexps) {
+		Pire::NonrelocScanner sc = ParseRegexp(re).Compile<Pire::NonrelocScanner>();
+		Pire::Stride2Scanner stride(sc);
+		UNIT_ASSERT(!stride.Empty());
+		for (size_t begin = 0; begin <= text.size(); ++begin)
+			for (size_t end = begin; end <= text.size(); ++end) {
+				const char* b = text.c_str() + begin;
+				const char* e = text.c_str() + end;
+
+				Pire::NonrelocScanner::State st;
+				Pire::Stride2Scanner::State sst;
+				sc.Initialize(st);
+				stride.Initialize(sst);
+				Pire::Run(sc, st, b, e);
+				Pire::Run(stride, sst, b, e);
+				UNIT_ASSERT_EQUAL(stride.Final(sst), sc.Final(st));
+				UNIT_ASSERT_EQUAL(Matches(stride, ystring(b, e)), Matches(sc, ystring(b, e)));
+				UNIT_ASSERT_EQUAL(Pire::LongestPrefix(stride, b, e), Pire::LongestPrefix(sc, b, e));
+				UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(stride, b, e), Pire::ShortestPrefix(sc, b, e));
+			}
+	}
+
+	UNIT_ASSERT(Pire::Stride2Scanner().Empty());
+	try {
+		Pire::Stride2Scanner(ParseRegexp("abcdefghijklmnopqrstuvwxyz0123456789").Compile<Pire::NonrelocScanner>());
+		UNIT_ASSERT(!"Should reject a scanner with too many letters");
+	}
+	catch (Pire::Error&) {}
+}
+
 template<class Scanner>
 void TestGlue()
 {
@@ -698,6 +1351,10 @@ SIMPLE_UNIT_TEST(Glue)
 	TestGlue<Pire::NonrelocScanner>();
 	TestGlue<Pire::ScannerNoMask>();
 	TestGlue<Pire::NonrelocScannerNoMask>();
+	TestGlue<Pire::NonrelocTaggedScanner>();
+	TestGlue<Pire::NonrelocTaggedScannerNoMask>();
+	TestGlue<Pire::NonrelocSplitScanner>();
+	TestGlue<Pire::NonrelocSplitScannerNoMask>();
 	TestGlue<Pire::HalfFinalScanner>();
 	TestGlue<Pire::NonrelocHalfFinalScanner>();
 	TestGlue<Pire::HalfFinalScannerNoMask>();
@@ -757,6 +1414,137 @@ SIMPLE_UNIT_TEST(Aligned)
 
 #undef Run
 
+template<class Scanner>
+void TestFragmentsOn(const char* regexp)
+{
+	Scanner sc = Pire::Lexer(regexp).Parse().Surround().Compile<Scanner>();
+	Scanner anchored = Pire::Lexer(regexp).Parse().Compile<Scanner>();
+
+	ystring text;
+	for (size_t i = 0; i != 40; ++i)
+		text += "some text with a needle and some more -- ";
+	const char* begin = text.c_str();
+	const char* end = begin + text.size();
+
+	typename Scanner::State whole;
+	sc.Initialize(whole);
+	Pire::Run(sc, whole, begin, end);
+
+	// Split the text into fragments of pseudo-random sizes, both shorter and longer
+	// than a staging buffer threshold, including empty ones.
+	ui32 seed = 17;
+	for (size_t iter = 0; iter != 50; ++iter) {
+		TVector<Pire::IoVec> frags;
+		for (const char* p = begin; p != end;) {
+			seed = seed * 1103515245 + 12345;
+			size_t len = ymin<size_t>((seed >> 16) % (iter % 2 ? 200 : 12), end - p);
+			Pire::IoVec frag = { p, len };
+			frags.push_back(frag);
+			p += len;
+		}
+		const Pire::IoVec* fb = &frags[0];
+		const Pire::IoVec* fe = fb + frags.size();
+
+		typename Scanner::State st;
+		sc.Initialize(st);
+		Pire::Run(sc, st, fb, fe);
+		UNIT_ASSERT_EQUAL(sc.StateIndex(st), sc.StateIndex(whole));
+		UNIT_ASSERT_EQUAL(sc.Final(st), sc.Final(whole));
+
+		UNIT_ASSERT(Pire::Runner(sc).Begin().Run(fb, fe).End());
+
+		for (size_t skip = 0; skip != 3; ++skip) {
+			const char* from = begin + skip * 11;
+			Pire::IoVec first = { from, 0 };
+			TVector<Pire::IoVec> tail;
+			tail.push_back(first);
+			for (size_t i = 0; i != frags.size(); ++i) {
+				const char* fragBegin = static_cast<const char*>(frags[i].iov_base);
+				const char* fragEnd = fragBegin + frags[i].iov_len;
+				if (fragEnd <= from)
+					continue;
+				Pire::IoVec frag = { ymax(fragBegin, from), static_cast<size_t>(fragEnd - ymax(fragBegin, from)) };
+				tail.push_back(frag);
+			}
+			const Pire::IoVec* tb = &tail[0];
+			const Pire::IoVec* te = tb + tail.size();
+			UNIT_ASSERT_EQUAL(Pire::LongestPrefix(sc, tb, te), Pire::LongestPrefix(sc, from, end));
+			UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(sc, tb, te), Pire::ShortestPrefix(sc, from, end));
+			UNIT_ASSERT_EQUAL(Pire::LongestPrefix(anchored, tb, te, true, true), Pire::LongestPrefix(anchored, from, end, true, true));
+			UNIT_ASSERT_EQUAL(Pire::ShortestPrefix(anchored, tb, te, true, true), Pire::ShortestPrefix(anchored, from, end, true, true));
+		}
+	}
+}
+
+SIMPLE_UNIT_TEST(Fragments)
+{
+	TestFragmentsOn<Pire::Scanner>("needle");
+	TestFragmentsOn<Pire::NonrelocScanner>("ne+dle");
+	TestFragmentsOn<Pire::ScannerNoMask>("needle");
+	TestFragmentsOn<Pire::SimpleScanner>("some|needle");
+	TestFragmentsOn<Pire::NonrelocTaggedScanner>("needle");
+	TestFragmentsOn<Pire::NonrelocSplitScanner>("ne+dle");
+	TestFragmentsOn<Pire::Scanner>("[a-z ]+");
+}
+
+template<class Scanner>
+const char* NaiveLongestSuffix(const Scanner& sc, const char* rbegin, const char* rend)
+{
+	typename Scanner::State st;
+	sc.Initialize(st);
+	const char* pos = 0;
+	for (; rbegin != rend && !sc.Dead(st); --rbegin) {
+		if (sc.Final(st))
+			pos = rbegin;
+		Pire::Step(sc, st, (unsigned char) *rbegin);
+	}
+	return sc.Final(st) ? rbegin : pos;
+}
+
+template<class Scanner>
+const char* NaiveShortestSuffix(const Scanner& sc, const char* rbegin, const char* rend)
+{
+	typename Scanner::State st;
+	sc.Initialize(st);
+	for (; rbegin != rend && !sc.Final(st) && !sc.Dead(st); --rbegin)
+		Pire::Step(sc, st, (unsigned char) *rbegin);
+	return sc.Final(st) ? rbegin : 0;
+}
+
+template<class Scanner>
+void TestReverseOn(const char* regexp)
+{
+	Scanner sc = Pire::Lexer(regexp).Parse().Reverse().Compile<Scanner>();
+	Scanner unanchored = (~Pire::Fsm::MakeFalse() + Pire::Lexer(regexp).Parse()).Reverse().Compile<Scanner>();
+
+	ystring text = "www.needle.example.com ";
+	for (size_t i = 0; i != 10; ++i)
+		text += "zzzzzzzzzzzzzzzzzzzzzzzzzzzzzz ";
+	text += "yet another needle.example.com";
+	for (size_t b = 0; b != 2 * sizeof(Pire::Impl::MaxSizeWord); ++b)
+		for (size_t e = text.size(); e + 2 * sizeof(Pire::Impl::MaxSizeWord) > text.size() && e > b; --e) {
+			const char* rbegin = text.c_str() + e - 1;
+			const char* rend = text.c_str() + b - 1;
+			UNIT_ASSERT_EQUAL(Pire::LongestSuffix(sc, rbegin, rend), NaiveLongestSuffix(sc, rbegin, rend));
+			UNIT_ASSERT_EQUAL(Pire::ShortestSuffix(sc, rbegin, rend), NaiveShortestSuffix(sc, rbegin, rend));
+			UNIT_ASSERT_EQUAL(Pire::LongestSuffix(unanchored, rbegin, rend), NaiveLongestSuffix(unanchored, rbegin, rend));
+			UNIT_ASSERT_EQUAL(Pire::ShortestSuffix(unanchored, rbegin, rend), NaiveShortestSuffix(unanchored, rbegin, rend));
+		}
+}
+
+SIMPLE_UNIT_TEST(ReverseAligned)
+{
+	TestReverseOn<Pire::Scanner>("needle\\.example\\.com");
+	TestReverseOn<Pire::Scanner>("[a-z]+\\.com");
+	TestReverseOn<Pire::NonrelocScanner>("needle.*com");
+	TestReverseOn<Pire::ScannerNoMask>("e.*com");
+	TestReverseOn<Pire::SimpleScanner>("[a-z]+\\.com");
+	TestReverseOn<Pire::NonrelocTaggedScanner>("needle.*com");
+	TestReverseOn<Pire::NonrelocSplitScanner>("needle.*com");
+	TestReverseOn<Pire::NonrelocSplitScannerNoMask>("[a-z]+\\.com");
+	TestReverseOn<Pire::SlowScanner>("n.*e\\.com");
+}
+
 template <class Scanner>
 void BasicTestEmptySaveLoadMmap()
 {
@@ -0,0 +1,185 @@
+/*
+ * registry_ut.cpp --
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+#include <stub/hacks.h>
+#include <stub/saveload.h>
+#include <stub/memstreams.h>
+#include "stub/cppunit.h"
+#include <pire.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+SIMPLE_UNIT_TEST_SUITE(TestRegistry) {
+
+	Pire::Scanner Compile(const ystring& regexp)
+	{
+		return Pire::Lexer(regexp).Parse().Compile<Pire::Scanner>();
+	}
+
+	bool Matches(const Pire::Scanner& scanner, const ystring& str)
+	{
+		return Pire::Runner(scanner).Begin().Run(str.c_str(), str.c_str() + str.size()).End();
+	}
+
+	ystring Word(size_t version)
+	{
+		return "v" + Pire::ToString(version);
+	}
+
+	SIMPLE_UNIT_TEST(Publish)
+	{
+		Pire::ScannerRegistry<Pire::Scanner> registry;
+		UNIT_ASSERT_EQUAL(registry.CurrentVersion(), size_t(0));
+		UNIT_ASSERT(registry.Acquire()->Empty());
+
+		UNIT_ASSERT_EQUAL(registry.Publish(Compile("^v1$")), size_t(1));
+		auto first = registry.Acquire();
+		UNIT_ASSERT_EQUAL(first.Version(), size_t(1));
+		UNIT_ASSERT(Matches(*first, "v1"));
+
+		// A snapshot keeps its version while newer ones are published
+		UNIT_ASSERT_EQUAL(registry.Publish(Compile("^v2$")), size_t(2));
+		UNIT_ASSERT(Matches(*first, "v1"));
+		auto second = registry.Acquire();
+		UNIT_ASSERT_EQUAL(second.Version(), size_t(2));
+		UNIT_ASSERT(Matches(second.GetScanner(), "v2"));
+		UNIT_ASSERT(!Matches(second.GetScanner(), "v1"));
+	}
+
+	SIMPLE_UNIT_TEST(StorageLifetime)
+	{
+		Pire::ScannerRegistry<Pire::Scanner> registry;
+		std::atomic<bool> released(false);
+		{
+			BufferOutput wbuf;
+			Pire::Save(&wbuf, Compile("^mapped$"));
+			TVector<size_t>* image = new TVector<size_t>(wbuf.Buffer().Size() / sizeof(size_t) + 1);
+			memcpy(image->data(), wbuf.Buffer().Data(), wbuf.Buffer().Size());
+			Pire::Scanner mapped;
+			mapped.Mmap(image->data(), wbuf.Buffer().Size());
+			registry.Publish(mapped, std::shared_ptr<const void>(image, [&released](const TVector<size_t>* p) {
+				released = true;
+				delete p;
+			}));
+		}
+		UNIT_ASSERT(!released);
+		UNIT_ASSERT(Matches(*registry.Acquire(), "mapped"));
+		registry.Publish(Compile("^other$"));
+		UNIT_ASSERT(released);
+	}
+
+	SIMPLE_UNIT_TEST(GracePeriod)
+	{
+		Pire::ScannerRegistry<Pire::Scanner> registry;
+		std::atomic<bool> released(false);
+		registry.Publish(Compile("^v1$"), std::shared_ptr<const void>(new int(0), [&released](const int* p) {
+			released = true;
+			delete p;
+		}));
+		{
+			auto held = registry.Acquire();
+			registry.Publish(Compile("^v2$"));
+			registry.Publish(Compile("^v3$"));
+			UNIT_ASSERT(!released);
+			UNIT_ASSERT(registry.Reclaim() > 0);
+			UNIT_ASSERT(Matches(*held, "v1"));
+		}
+		UNIT_ASSERT_EQUAL(registry.Reclaim(), size_t(0));
+		UNIT_ASSERT(released);
+	}
+
+	SIMPLE_UNIT_TEST(Stress)
+	{
+		const size_t Writers = 2, Readers = 4, Publications = 40;
+
+		// Each version is Mmap()-ed from its own image, which is wiped
+		// when released, so a reader using a reclaimed version would notice
+		TVector< std::atomic<bool> > released(Writers * Publications + 1);
+		for (auto&& r : released)
+			r = false;
+		Pire::ScannerRegistry<Pire::Scanner> registry;
+		std::mutex numbering;
+		std::atomic<size_t> writersLeft(Writers);
+		std::atomic<size_t> failures(0), reads(0);
+
+		auto writer = [&] {
+			for (size_t i = 0; i != Publications; ++i) {
+				// Versions are numbered in the order of publishing
+				std::lock_guard<std::mutex> lock(numbering);
+				size_t version = registry.CurrentVersion() + 1;
+				BufferOutput wbuf;
+				Pire::Save(&wbuf, Compile("^" + Word(version) + "$"));
+				TVector<size_t>* image = new TVector<size_t>(wbuf.Buffer().Size() / sizeof(size_t) + 1);
+				memcpy(image->data(), wbuf.Buffer().Data(), wbuf.Buffer().Size());
+				Pire::Scanner mapped;
+				mapped.Mmap(image->data(), wbuf.Buffer().Size());
+				std::atomic<bool>* flag = &released[version];
+				std::shared_ptr<const void> storage(image, [flag](TVector<size_t>* p) {
+					std::fill(p->begin(), p->end(), 0);
+					*flag = true;
+					delete p;
+				});
+				if (registry.Publish(mapped, storage) != version)
+					++failures;
+			}
+			--writersLeft;
+		};
+
+		auto reader = [&] {
+			size_t last = 0;
+			while (writersLeft) {
+				auto snapshot = registry.Acquire();
+				size_t version = snapshot.Version();
+				if (version < last)
+					++failures;
+				last = version;
+				if (version) {
+					if (released[version] || !Matches(*snapshot, Word(version)) || Matches(*snapshot, Word(version + 1)))
+						++failures;
+					std::this_thread::yield();
+					if (released[version] || !Matches(*snapshot, Word(version)))
+						++failures;
+				}
+				++reads;
+			}
+		};
+
+		TVector<std::thread> threads;
+		for (size_t i = 0; i != Readers; ++i)
+			threads.push_back(std::thread(reader));
+		for (size_t i = 0; i != Writers; ++i)
+			threads.push_back(std::thread(writer));
+		for (auto&& t : threads)
+			t.join();
+
+		UNIT_ASSERT_EQUAL(failures.load(), size_t(0));
+		UNIT_ASSERT(reads > 0);
+		UNIT_ASSERT_EQUAL(registry.Reclaim(), size_t(0));
+		UNIT_ASSERT_EQUAL(registry.CurrentVersion(), Writers * Publications);
+		for (size_t v = 1; v != Writers * Publications; ++v)
+			UNIT_ASSERT(released[v]);
+		UNIT_ASSERT(!released[Writers * Publications]);
+	}
+}
@@ -0,0 +1,247 @@
+/*
+ * scanner_cache_ut.cpp --
+ *
+ * Copyright (c) 2007-2010, Dmitry Prokoptsev <dprokoptsev@gmail.com>,
+ *                          Alexander Gololobov <agololobov@gmail.com>
+ *
+ * This file is part of Pire, the Perl Incompatible
+ * Regular Expressions library.
+ *
+ * Pire is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Pire is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ * You should have received a copy of the GNU Lesser Public License
+ * along with Pire.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+
+
+#include <stub/hacks.h>
+#include <stub/saveload.h>
+#include <stub/memstreams.h>
+#include "stub/cppunit.h"
+#include <pire.h>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <stdlib.h>
+#include <dirent.h>
+#include <unistd.h>
+
+SIMPLE_UNIT_TEST_SUITE(TestScannerCache) {
+
+	/// A fresh directory, removed with its contents at the end
+	class TempDir {
+	public:
+		TempDir()
+		{
+			char name[] = "/tmp/pire_cache_ut.XXXXXX";
+			m_path = mkdtemp(name);
+		}
+
+		~TempDir()
+		{
+			for (auto&& file : Files())
+				unlink((m_path + "/" + file).c_str());
+			rmdir(m_path.c_str());
+		}
+
+		const ystring& Path() const { return m_path; }
+
+		TVector<ystring> Files() const
+		{
+			TVector<ystring> files;
+			DIR* dir = opendir(m_path.c_str());
+			while (struct dirent* entry = readdir(dir))
+				if (entry->d_name[0] != '.')
+					files.push_back(entry->d_name);
+			closedir(dir);
+			std::sort(files.begin(), files.end());
+			return files;
+		}
+
+	private:
+		ystring m_path;
+	};
+
+	Pire::CacheKey Key(const ystring& pattern)
+	{
+		Pire::CacheKey key;
+		key.Add(pattern).Add(Pire::ui64(0)); // a pattern and, say, a glue limit
+		return key;
+	}
+
+	bool Matches(const Pire::Scanner& scanner, const ystring& str)
+	{
+		return Pire::Runner(scanner).Begin().Run(str.c_str(), str.c_str() + str.size()).End();
+	}
+
+	struct Compiler {
+		ystring pattern;
+		size_t* calls;
+
+		Pire::Scanner operator()() const
+		{
+			++*calls;
+			return Pire::Lexer(pattern).Parse().Compile<Pire::Scanner>();
+		}
+	};
+
+	Pire::CachedScanner<Pire::Scanner> Get(Pire::ScannerCache& cache, const ystring& pattern, size_t& calls)
+	{
+		Compiler compiler = { pattern, &calls };
+		return cache.Get<Pire::Scanner>(Key(pattern), compiler);
+	}
+
+	SIMPLE_UNIT_TEST(Keys)
+	{
+		Pire::CacheKey a, b;
+		a.Add("ab").Add("c");
+		b.Add("a").Add("bc");
+		UNIT_ASSERT(a.Data() != b.Data());
+		UNIT_ASSERT(a.Digest() != b.Digest());
+		UNIT_ASSERT_EQUAL(a.Digest(), Pire::CacheKey(a).Digest());
+
+		TVector<ystring> patterns;
+		patterns.push_back("ab");
+		patterns.push_back("c");
+		Pire::CacheKey c;
+		c.Add(patterns.begin(), patterns.end());
+		UNIT_ASSERT(c.Data() != a.Data());
+	}
+
+	SIMPLE_UNIT_TEST(HitsAndMisses)
+	{
+		TempDir dir;
+		size_t calls = 0;
+		{
+			Pire::ScannerCache cache(dir.Path());
+			auto miss = Get(cache, "^abc$", calls);
+			UNIT_ASSERT(!miss.hit);
+			UNIT_ASSERT(miss.storage == nullptr);
+			UNIT_ASSERT_EQUAL(calls, size_t(1));
+			UNIT_ASSERT(Matches(miss.scanner, "abc"));
+			UNIT_ASSERT_EQUAL(dir.Files().size(), size_t(1));
+		}
+
+		// Another instance (as if after a restart) maps the stored scanner
+		Pire::ScannerCache cache(dir.Path());
+		auto hit = Get(cache, "^abc$", calls);
+		UNIT_ASSERT(hit.hit);
+		UNIT_ASSERT(hit.storage != nullptr);
+		UNIT_ASSERT_EQUAL(calls, size_t(1));
+		UNIT_ASSERT(Matches(hit.scanner, "abc"));
+		UNIT_ASSERT(!Matches(hit.scanner, "abd"));
+
+		// Other inputs and other scanner types make other keys
+		UNIT_ASSERT(!Get(cache, "^abd$", calls).hit);
+		Pire::SimpleScanner simple = cache.Get<Pire::SimpleScanner>(Key("^abc$"), [&] {
+			return Pire::Lexer("^abc$").Parse().Compile<Pire::SimpleScanner>();
+		}).scanner;
+		UNIT_ASSERT(Pire::Runner(simple).Begin().Run("abc", 3).End());
+		UNIT_ASSERT_EQUAL(dir.Files().size(), size_t(3));
+
+		// The mapping outlives the file
+		for (auto&& file : dir.Files())
+			unlink((dir.Path() + "/" + file).c_str());
+		UNIT_ASSERT(Matches(hit.scanner, "abc"));
+		UNIT_ASSERT(!Get(cache, "^abc$", calls).hit);
+	}
+
+	SIMPLE_UNIT_TEST(DamagedFiles)
+	{
+		TempDir dir;
+		Pire::ScannerCache cache(dir.Path());
+		size_t calls = 0;
+		Get(cache, "^abc$", calls);
+		ystring path = dir.Path() + "/" + dir.Files()[0];
+
+		// A flipped byte in the scanner image is caught by the checksum,
+		// if the cache verifies it
+		{
+			std::fstream file(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+			file.seekg(0, std::ios::end);
+			file.seekg(static_cast<size_t>(file.tellg()) - 1);
+			char last = static_cast<char>(file.get() ^ 1);
+			file.seekp(file.tellg() - std::streamoff(1));
+			file.put(last);
+		}
+		Pire::ScannerCache verifying(dir.Path(), 0, true);
+		auto recompiled = Get(verifying, "^abc$", calls);
+		UNIT_ASSERT(!recompiled.hit);
+		UNIT_ASSERT_EQUAL(calls, size_t(2));
+		UNIT_ASSERT(Get(verifying, "^abc$", calls).hit);
+		UNIT_ASSERT(Get(cache, "^abc$", calls).hit);
+
+		// A file holding another key is not used
+		Get(cache, "^xyz$", calls);
+		TVector<ystring> files = dir.Files();
+		UNIT_ASSERT_EQUAL(files.size(), size_t(2));
+		rename((dir.Path() + "/" + files[0]).c_str(), (dir.Path() + "/" + files[1]).c_str());
+		UNIT_ASSERT(!Get(cache, "^abc$", calls).hit);
+		UNIT_ASSERT(!Get(cache, "^xyz$", calls).hit);
+		UNIT_ASSERT_EQUAL(calls, size_t(5));
+	}
+
+	SIMPLE_UNIT_TEST(Eviction)
+	{
+		TempDir dir;
+		size_t calls = 0;
+		size_t size;
+		{
+			Pire::ScannerCache unbounded(dir.Path());
+			Get(unbounded, "^a$", calls);
+			size = unbounded.Evict();
+		}
+		UNIT_ASSERT(size > 0);
+
+		// Room for two files of about that size. File times may be
+		// as coarse as a few milliseconds, hence the pauses.
+		Pire::ScannerCache cache(dir.Path(), 2 * size + size / 2);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		Get(cache, "^b$", calls);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		UNIT_ASSERT(Get(cache, "^a$", calls).hit);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		Get(cache, "^c$", calls);
+		UNIT_ASSERT_EQUAL(dir.Files().size(), size_t(2));
+		UNIT_ASSERT(cache.Evict() <= 2 * size + size / 2);
+
+		// The least recently used one is gone
+		calls = 0;
+		UNIT_ASSERT(Get(cache, "^a$", calls).hit);
+		UNIT_ASSERT(Get(cache, "^c$", calls).hit);
+		UNIT_ASSERT_EQUAL(calls, size_t(0));
+		UNIT_ASSERT(!Get(cache, "^b$", calls).hit);
+	}
+
+	SIMPLE_UNIT_TEST(ConcurrentWriters)
+	{
+		TempDir dir;
+		TVector<std::thread> threads;
+		TVector<size_t> calls(4, 0);
+		std::atomic<size_t> wrong(0);
+		for (size_t t = 0; t != calls.size(); ++t)
+			threads.push_back(std::thread([&dir, &calls, &wrong, t] {
+				Pire::ScannerCache cache(dir.Path());
+				for (size_t i = 0; i != 20; ++i) {
+					auto cached = Get(cache, "^w" + Pire::ToString(i % 5) + "$", calls[t]);
+					if (!Matches(cached.scanner, "w" + Pire::ToString(i % 5)))
+						++wrong;
+				}
+			}));
+		for (auto&& thread : threads)
+			thread.join();
+		UNIT_ASSERT_EQUAL(wrong.load(), size_t(0));
+		// Every key is stored once, and no temporary files are left
+		UNIT_ASSERT_EQUAL(dir.Files().size(), size_t(5));
+		for (auto&& file : dir.Files())
+			UNIT_ASSERT(file.find(".tmp") == ystring::npos);
+	}
+}
@@ -77,6 +77,9 @@ private:
 
 typedef std::vector<std::string> Patterns;
 
+/// Threads compiling multiregexp scanners (0 to compile them serially)
+size_t CompileThreads = 0;
+
 class ITester {
 public:
 	enum Algorithm {
@@ -88,6 +91,9 @@ public:
 	virtual ~ITester() {}
 	virtual void Prepare(Algorithm alg, const std::vector<Patterns>& patterns) = 0;
 	virtual void Run(const char* begin, const char* end) = 0;
+	/// Moves the compiled tables according to Pire::MemoryPolicy flags,
+	/// returning the flags which took effect
+	virtual unsigned ApplyMemoryPolicy(unsigned) { return 0; }
 };
 
 // Sinlge regexp scanner
@@ -110,6 +116,12 @@ struct CompileRe< Pire::Impl::Scanner<Relocation, Shortcutting> > {
 	static Pire::Impl::Scanner<Relocation, Shortcutting> Do(const Patterns& patterns, bool surround)
 	{
 		typedef Pire::Impl::Scanner<Relocation, Shortcutting> Sc;
+		if (CompileThreads && patterns.size() > 1) {
+			Pire::CompileService service(CompileThreads);
+			Pire::CompileOptions options;
+			options.Surround = surround;
+			return service.Compile<Sc>(Pire::TVector<Pire::ystring>(patterns.begin(), patterns.end()), options).Get();
+		}
 		Sc sc;
 		for (Patterns::const_iterator i = patterns.begin(), ie = patterns.end(); i != ie; ++i) {
 			Pire::Fsm fsm = Pire::Lexer(*i).Parse();
@@ -131,6 +143,15 @@ struct CompileRe< Pire::Impl::Scanner<Relocation, Shortcutting> > {
 	}
 };
 
+// Stride-2 scanner is built from a regular one
+template<>
+struct CompileRe<Pire::Stride2Scanner> {
+	static Pire::Stride2Scanner Do(const Patterns& patterns, bool surround)
+	{
+		return Pire::Stride2Scanner(CompileRe<Pire::NonrelocScannerNoMask>::Do(patterns, surround));
+	}
+};
+
 // Single regexp
 template<class Scanner>
 struct PrintResult {
@@ -184,6 +205,19 @@ struct CompileRe<Pire::CapturingScanner> {
 	}
 };
 
+template <>
+struct CompileRe<Pire::SlowCapturingScanner> {
+	static Pire::SlowCapturingScanner Do(const Patterns& patterns, bool surround)
+	{
+		if (patterns.size() != 1)
+			throw std::runtime_error("Only one regexp is allowed for this scanner");
+		Pire::Fsm fsm = Pire::Lexer(patterns[0]).AddFeature(Pire::Features::Capture(1)).Parse();
+		if (surround)
+			fsm.Surround();
+		return fsm.Compile<Pire::SlowCapturingScanner>();
+	}
+};
+
 template <>
 struct CompileRe<Pire::CountingScanner> {
 	static Pire::CountingScanner Do(const Patterns& patterns, bool /*surround*/)
@@ -226,8 +260,54 @@ struct PrintResult<Pire::CapturingScanner> {
 			std::cout << "No match" << std::endl;
 	}
 };
+template<>
+struct PrintResult<Pire::SlowCapturingScanner> {
+	static void Do(const Pire::SlowCapturingScanner& sc, Pire::SlowCapturingScanner::State st)
+	{
+		Pire::SlowCapturingScanner::SingleState final;
+		if (sc.GetCapture(st, final))
+			std::cout << "Match: [" << final.GetBegin() << ", " << final.GetEnd() << "]" << std::endl;
+		else
+			std::cout << "No match" << std::endl;
+	}
+};
 #endif // BENCH_EXTRA_ENABLED
 
+// Prefix search (not every scanner supports it)
+template<class Scanner>
+struct FindPrefix {
+	static const char* Do(const Scanner& sc, ITester::Algorithm alg, const char* begin, const char* end)
+	{
+		return (alg == ITester::ShortestPrefix ?
+			Pire::ShortestPrefix(sc, begin, end) :
+			Pire::LongestPrefix(sc, begin, end));
+	}
+};
+
+#ifdef BENCH_EXTRA_ENABLED
+template<>
+struct FindPrefix<Pire::SlowCapturingScanner> {
+	static const char* Do(const Pire::SlowCapturingScanner&, ITester::Algorithm, const char*, const char*)
+	{
+		throw std::runtime_error("Prefix search is not supported by this scanner");
+	}
+};
+#endif
+
+// Only the table-driven scanners can be moved to another memory
+template<class Scanner>
+struct ApplyPolicy {
+	static unsigned Do(Scanner&, unsigned) { return 0; }
+};
+
+template<class Relocation, class Shortcutting>
+struct ApplyPolicy< Pire::Impl::Scanner<Relocation, Shortcutting> > {
+	static unsigned Do(Pire::Impl::Scanner<Relocation, Shortcutting>& sc, unsigned policy)
+	{
+		return sc.ApplyMemoryPolicy(policy);
+	}
+};
+
 // Common implementation for all scanners
 template<class Scanner>
 class TesterBase: public ITester {
@@ -243,9 +323,7 @@ public:
 		if (alg == DefaultRun)
 			PrintResult<Scanner>::Do(sc, Pire::Runner(sc).Begin().Run(begin, end).End().State());
 		else {
-			const char* pos = (alg == ShortestPrefix ? 
-				Pire::ShortestPrefix(sc, begin, end) :
-				Pire::LongestPrefix(sc, begin, end));
+			const char* pos = FindPrefix<Scanner>::Do(sc, alg, begin, end);
 			if (pos)
 				std::cout << "Prefix end: " << pos - begin << std::endl;
 			else
@@ -270,6 +348,11 @@ class Tester: public TesterBase<Scanner> {
 			throw std::runtime_error("Only one set of regexps is allowed for this scanner");
 		Base::sc = ::CompileRe<Scanner>::Do(patterns[0], surround);
 	}
+
+	unsigned ApplyMemoryPolicy(unsigned policy)
+	{
+		return ApplyPolicy<Scanner>::Do(Base::sc, policy);
+	}
 };
 
 template<class Scanner1, class Scanner2>
@@ -285,6 +368,11 @@ class PairTester: public TesterBase< Pire::ScannerPair<Scanner1, Scanner2> > {
 		typedef Pire::ScannerPair<Scanner1, Scanner2> Pair;
 		Base::sc = Pair(sc1, sc2);
 	}
+
+	unsigned ApplyMemoryPolicy(unsigned policy)
+	{
+		return ApplyPolicy<Scanner1>::Do(sc1, policy) & ApplyPolicy<Scanner2>::Do(sc2, policy);
+	}
 private:
 	Scanner1 sc1;
 	Scanner2 sc2;
@@ -307,10 +395,10 @@ public:
 
 std::runtime_error usage(
 	"Usage: bench -f file [-c repetition_count] "
-	"[-a run|shortestprefix|longestprefix] "
-	"-t {multi|nonreloc|multinomask|nonrelocnomask|simple|slow|null"
+	"[-a run|shortestprefix|longestprefix] [-m thp,hugetlb,prefault,lock] [-j compile_threads] "
+	"-t {multi|nonreloc|multinomask|nonrelocnomask|nonreloctagged|nonrelocsplit|classmask|nonrelocclassmask|stride2|simple|slow|null"
 #ifdef BENCH_EXTRA_ENABLED
-	"count|capture"
+	"|count|capture|slowcapture"
 #endif
 	"} regexp [regexp2 [-e regexp3...]] [-t <type> regexp4 [regexp5...]]");
 
@@ -325,6 +413,16 @@ ITester* CreateTester(const std::vector<std::string>& types)
 		return new Tester<Pire::ScannerNoMask>;
 	else if (types.size() == 1 && types[0] == "nonrelocnomask")
 		return new Tester<Pire::NonrelocScannerNoMask>;
+	else if (types.size() == 1 && types[0] == "nonreloctagged")
+		return new Tester<Pire::NonrelocTaggedScanner>;
+	else if (types.size() == 1 && types[0] == "nonrelocsplit")
+		return new Tester<Pire::NonrelocSplitScanner>;
+	else if (types.size() == 1 && types[0] == "classmask")
+		return new Tester<Pire::ClassMaskScanner>;
+	else if (types.size() == 1 && types[0] == "nonrelocclassmask")
+		return new Tester<Pire::NonrelocClassMaskScanner>;
+	else if (types.size() == 1 && types[0] == "stride2")
+		return new Tester<Pire::Stride2Scanner>;
 	else if (types.size() == 1 && types[0] == "simple")
 		return new Tester<Pire::SimpleScanner>;
 	else if (types.size() == 1 && types[0] == "slow")
@@ -358,6 +456,8 @@ ITester* CreateTester(const std::vector<std::string>& types)
 		return new Tester<Pire::CountingScanner>;
 	else if (types.size() == 1 && types[0] == "capture")
 		return new Tester<Pire::CapturingScanner>;
+	else if (types.size() == 1 && types[0] == "slowcapture")
+		return new Tester<Pire::SlowCapturingScanner>;
 	else if (types.size() == 2 && types[0] == "count" && types[1] == "count")
 		return new PairTester<Pire::CountingScanner, Pire::CountingScanner>;
 	else if (types.size() == 2 && types[0] == "capture" && types[1] == "capture")
@@ -368,6 +468,41 @@ ITester* CreateTester(const std::vector<std::string>& types)
 		throw usage;
 }
 
+unsigned ParseMemoryPolicy(const std::string& str)
+{
+	static const std::pair<const char*, unsigned> names[] = {
+		std::make_pair("thp", (unsigned) Pire::MemoryPolicy::HugePages),
+		std::make_pair("hugetlb", (unsigned) Pire::MemoryPolicy::ExplicitHugePages),
+		std::make_pair("prefault", (unsigned) Pire::MemoryPolicy::Prefault),
+		std::make_pair("lock", (unsigned) Pire::MemoryPolicy::Lock)
+	};
+	unsigned policy = 0;
+	std::istringstream stream(str);
+	std::string name;
+	while (std::getline(stream, name, ',')) {
+		size_t i = 0;
+		for (; i != sizeof(names) / sizeof(*names) && name != names[i].first; ++i)
+			;
+		if (i == sizeof(names) / sizeof(*names))
+			throw usage;
+		policy |= names[i].second;
+	}
+	return policy;
+}
+
+std::string PrintMemoryPolicy(unsigned policy)
+{
+	std::string str;
+	if (policy & Pire::MemoryPolicy::HugePages)
+		str += "thp ";
+	if (policy & Pire::MemoryPolicy::ExplicitHugePages)
+		str += "hugetlb ";
+	if (policy & Pire::MemoryPolicy::Prefault)
+		str += "prefault ";
+	if (policy & Pire::MemoryPolicy::Lock)
+		str += "lock ";
+	return str.empty() ? "none" : str.substr(0, str.size() - 1);
+}
 
 void Main(int argc, char** argv)
 {
@@ -377,6 +512,7 @@ void Main(int argc, char** argv)
 	std::string algName = "run";
 	int repCount = 10;
 	ITester::Algorithm alg;
+	unsigned policy = 0;
 	for (--argc, ++argv; argc; --argc, ++argv) {
 		if (!strcmp(*argv, "-t") && argc >= 2) {
 			types.push_back(argv[1]);
@@ -391,6 +527,12 @@ void Main(int argc, char** argv)
 		} else if (!strcmp(*argv, "-c") && argc >= 2) {
 			repCount = Pire::FromString<int>(argv[1]);
 			--argc, ++argv;
+		} else if (!strcmp(*argv, "-m") && argc >= 2) {
+			policy = ParseMemoryPolicy(argv[1]);
+			--argc, ++argv;
+		} else if (!strcmp(*argv, "-j") && argc >= 2) {
+			CompileThreads = Pire::FromString<size_t>(argv[1]);
+			--argc, ++argv;
 		} else if (!strcmp(*argv, "-e") && argc >= 2) {
 			if (patterns.empty())
 				throw usage;
@@ -416,8 +558,15 @@ void Main(int argc, char** argv)
 
 	std::unique_ptr<ITester> tester(CreateTester(types));
 
+	long long compileStart = GetUsec();
 	tester->Prepare(alg, patterns);
+	if (CompileThreads)
+		std::cout << "Compiled on " << CompileThreads << " threads in " << (GetUsec() - compileStart) << " us" << std::endl;
 	FileMmap fmap(file.c_str());
+	if (policy) {
+		std::cout << "Memory policy applied to the scanner: " << PrintMemoryPolicy(tester->ApplyMemoryPolicy(policy))
+			<< ", to the input: " << PrintMemoryPolicy(Pire::AdviseMemory(fmap.Begin(), fmap.Size(), policy)) << std::endl;
+	}
 
 	// Run the benchmark multiple times
 	std::ostringstream stream;